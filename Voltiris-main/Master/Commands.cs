@@ -260,6 +260,108 @@ namespace Voltiris
 
             return cmd;
         }
+
+        // Slave address of the discovery commands, processed by all slaves
+        internal const byte DiscoverySlaveId = 248;
+
+        internal const ushort DiscoveryStartAddress  = 0x03;
+        internal const ushort DiscoveryProbeAddress  = 0x04;
+        internal const ushort DiscoveryAssignAddress = 0x05;
+
+        static void addSerialNumber (List<byte> data, ulong serialNumber)
+        {
+            for (var i = 0; i < 8; i++)
+                data.Add ((byte) (serialNumber >> (56 - 8 * i)));
+        }
+
+        // Ask the undiscovered slaves whose serial number starts with the bitCount
+        // first bits of prefix to answer with their serial number (as an identification)
+        internal static CommandData probeSerialNumbersQuery (ulong prefix, int bitCount,
+                                                             out List<ExpectedResponse> expectedResponses)
+        {
+            var data = new List<byte> { 0, (byte) bitCount };
+            addSerialNumber (data, prefix);
+            var cmd = writeUint16ResultsQuery (DiscoverySlaveId, DiscoveryProbeAddress, data.ToArray (),
+                                               out List<ExpectedResponse> writeResponses);
+
+            var success = new ExpectedResponse { Result = Commands.ResultType.Succeed };
+            success.add8    (ExpectedResponse.FieldType.SlaveAddress, 1, DiscoverySlaveId);
+            success.add8    (ExpectedResponse.FieldType.Function, 1, ReadInputResults);
+            success.add8    (ExpectedResponse.FieldType.Count, 1, 8);
+            success.add8    (ExpectedResponse.FieldType.Data, 8);
+            success.addCRC8 ();
+
+            expectedResponses = new List<ExpectedResponse> ();
+            expectedResponses.Add (success);
+
+            return cmd;
+        }
+
+        // Give id to the slave with the serial number, the response comes from the new id
+        internal static CommandData assignSlaveIdQuery (ulong serialNumber, byte id,
+                                                        out List<ExpectedResponse> expectedResponses)
+        {
+            var data = new List<byte> ();
+            addSerialNumber (data, serialNumber);
+            data.Add (0);
+            data.Add (id);
+            var cmd = writeUint16ResultsQuery (DiscoverySlaveId, DiscoveryAssignAddress, data.ToArray (),
+                                               out List<ExpectedResponse> writeResponses);
+
+            var success = new ExpectedResponse { Result = Commands.ResultType.Succeed };
+            success.add8    (ExpectedResponse.FieldType.SlaveAddress, 1, id);
+            success.add8    (ExpectedResponse.FieldType.Function, 1, PresetMultipleRegisters);
+            success.add16   (ExpectedResponse.FieldType.Address, 1, DiscoveryAssignAddress);
+            success.add16   (ExpectedResponse.FieldType.Count, 1, (ushort) (data.Count / 2));
+            success.addCRC8 ();
+
+            expectedResponses = new List<ExpectedResponse> ();
+            expectedResponses.Add (success);
+
+            return cmd;
+        }
+
+        // Firmware update commands (see vltUpdate.hpp), normally broadcasted
+        internal const ushort UpdateStartAddress    = 0xc0;
+        internal const ushort UpdateBlockAddress    = 0xc1;
+        internal const ushort UpdateStatusAddress   = 0xc2;
+        internal const ushort UpdateVerifyAddress   = 0xc3;
+        internal const ushort UpdateActivateAddress = 0xc4;
+        internal const ushort UpdateMissingAddress  = 0xc8; // + bitmap page
+
+        internal const int UpdateBlockSize = 128;
+        internal const int UpdateBitmapPageSize = 128;
+        internal const int UpdateStatusRegisters = 4; // State, blocks, missing blocks, image CRC-16
+
+        internal enum UpdateState { Idle, Receiving, Verified, Failed }
+
+        // CRC-16 (Modbus RTU) of size bytes from offset
+        internal static ushort computeCRC16 (byte[] data, int offset, int size)
+        {
+            ushort crc = 0xffff;
+            for (var i = offset; i < offset + size; i++)
+            {
+                crc ^= data[i];
+                for (var bit = 0; bit < 8; bit++)
+                    crc = (ushort) ((crc & 1) != 0 ? (crc >> 1) ^ 0xa001 : crc >> 1);
+            }
+            return crc;
+        }
+
+        // Block of the image: block index, data, CRC-16 of the data
+        internal static byte[] updateBlockData (byte[] image, int block)
+        {
+            int offset = block * UpdateBlockSize;
+            int size = Math.Min (UpdateBlockSize, image.Length - offset);
+            ushort crc = computeCRC16 (image, offset, size);
+
+            var data = new List<byte> { (byte) (block >> 8), (byte) (block & 0xff) };
+            for (var i = 0; i < size; i++)
+                data.Add (image[offset + i]);
+            data.Add ((byte) (crc >> 8));
+            data.Add ((byte) (crc & 0xff));
+            return data.ToArray ();
+        }
     }
 
     public class CommandsWebServer
@@ -286,12 +388,12 @@ namespace Voltiris
             result = new CommandData ();
             response = null;
             try {
-                SerialCom.Instance.WriteAscii (cmd, timeoutWarning);
+                SerialCom.Instance.Write (cmd, timeoutWarning, expectedResponses.Count > 0);
                 
                 if (expectedResponses.Count == 0)
                     return Commands.ResultType.Succeed;
 
-                SerialCom.Instance.ReadAscii (out List<byte> buffer);
+                SerialCom.Instance.Read (out List<byte> buffer);
                 result.data = buffer.ToList ();
                 
                 foreach (var er in expectedResponses)
@@ -364,6 +466,39 @@ namespace Voltiris
             return result;
         }
 
+        [ResourceMethod("getRegisters")]
+        public Result getRegisters (int id, int address, int count) // http://localhost:8080/cmd/getRegisters?id=1&address=768&count=4  --> {"status":"Succeed","values":[0,0,0,0]}
+        {
+            var result = new Result ();
+
+            if (id < 0 || id > 247 || address < 0 || address > 0xffff || count < 1 || count > 127)
+            {
+                result.Status =  Commands.ResultType.ArgError;
+                return result;
+            }
+
+            lock (this)
+            {
+                var query = Commands.readUint16ResultsQuery ((byte) id, (ushort) address, 
+                                            (ushort) count, out List<Commands.ExpectedResponse> expectedResponses);
+
+                result.Status = execute (query, expectedResponses, 
+                                         out Commands.ExpectedResponse? responseTemplate,
+                                         out CommandData responseData);
+
+                if (result.Status == Commands.ResultType.Succeed)
+                {   
+                    Debug.Assert (responseTemplate != null);
+                    var data = responseTemplate.get (Commands.ExpectedResponse.FieldType.Data, responseData);
+                    Debug.Assert (data != null);
+                    for (var i = 0; i + 1 < data.Length; i += 2)
+                        result.Values.Add (data[i] << 8 | data[i + 1]);
+                }
+            }
+
+            return result;
+        }
+
         [ResourceMethod("setRegister")]
         public Result setRegister (int id, int address, int value) // http://localhost:8080/cmd/setRegister?id=1&address=800&value=-1  --> {"status":"Succeed","values":[]}
         {
@@ -387,9 +522,56 @@ namespace Voltiris
                 var query = Commands.writeUint16ResultsQuery ((byte) id, (ushort) address,
                                             data, out List<Commands.ExpectedResponse> expectedResponses);
 
+                if (id == 0)
+                    expectedResponses.Clear (); // Broadcast: slaves do not respond
+
+                result.Status = execute (query, expectedResponses, 
+                                    out Commands.ExpectedResponse? responseTemplate,
+                                    out CommandData responseData);
+            }
+            return result;
+        }
+
+        [ResourceMethod("setRegisters")]
+        public Result setRegisters (int id, int address, string values) // http://localhost:8080/cmd/setRegisters?id=1&address=768&values=100,200  --> {"status":"Succeed","values":[2]}
+        {
+            var result = new Result ();
+
+            var items = values.Split (',', StringSplitOptions.RemoveEmptyEntries);
+            if (id < 0 || id > 247 || address < 0 || address > 0xffff || items.Length < 1 || items.Length > 127)
+            {
+                result.Status =  Commands.ResultType.ArgError;
+                return result;
+            }
+
+            var data = new byte [2 * items.Length];
+            for (var i = 0; i < items.Length; i++)
+            {
+                if (!int.TryParse (items[i], out int value) || value < Int16.MinValue || value > 0xffff)
+                {
+                    result.Status =  Commands.ResultType.ArgError;
+                    return result;
+                }
+                if (value < 0)
+                    value = unchecked((ushort) value);
+                data[2 * i]     = (byte) (value >> 8);
+                data[2 * i + 1] = (byte) (value & 0xff);
+            }
+
+            lock (this)
+            {
+                var query = Commands.writeUint16ResultsQuery ((byte) id, (ushort) address,
+                                            data, out List<Commands.ExpectedResponse> expectedResponses);
+
+                if (id == 0)
+                    expectedResponses.Clear (); // Broadcast: slaves do not respond
+
                 result.Status = execute (query, expectedResponses, 
                                     out Commands.ExpectedResponse? responseTemplate,
                                     out CommandData responseData);
+
+                if (result.Status == Commands.ResultType.Succeed)
+                    result.Values.Add (items.Length);
             }
             return result;
         }
@@ -601,12 +783,139 @@ namespace Voltiris
             return result;
         }
 
+        const ushort optionDescriptorStartAddress = 0x60;
+        const ushort optionDescriptorEndAddress   = 0x90;
+        const ushort optionDescriptorHeaderSize   = 13;
+        const ushort optionDescriptorMaxSize      = 44; // Padded to 22 registers
+
+        [ResourceMethod("getOptionDescriptor")]
+        public Result getOptionDescriptor (int id, int optIndex) // http://localhost:8080/cmd/getOptionDescriptor?id=1&optIndex=0 --> {"status":"Succeed","values":[0,3,2,1,3,0,0,0,23,112,0,10,11,80,111,115,105,116,105,111,110,95,98,49]}
+        {
+            var result = new Result ();
+
+            if (id < 0 || id > 247 || optIndex < 0 || optIndex > optionDescriptorEndAddress - optionDescriptorStartAddress)
+            {
+                result.Status =  Commands.ResultType.ArgError;
+                return result;
+            }
+
+            lock (this)
+            {
+                var query = Commands.readUint16ResultsQuery ((byte) id, (ushort) (optionDescriptorStartAddress + optIndex), 
+                                            optionDescriptorMaxSize / 2, out List<Commands.ExpectedResponse> expectedResponses);
+
+                result.Status = execute (query, expectedResponses, 
+                                         out Commands.ExpectedResponse? responseTemplate,
+                                         out CommandData responseData);
+
+                if (result.Status != Commands.ResultType.Succeed)
+                    return result;
+
+                Debug.Assert (responseTemplate != null);
+                var data = responseTemplate.get (Commands.ExpectedResponse.FieldType.Data, responseData);
+                Debug.Assert (data != null);
+
+                // Remove the padding after the name
+                int size = optionDescriptorHeaderSize + data[optionDescriptorHeaderSize - 1];
+                if (size > data.Length)
+                {
+                    result.Status = Commands.ResultType.Error;
+                    return result;
+                }
+                for (var i = 0; i < size; i++)
+                    result.Values.Add (data[i]);
+            }
+            return result;
+        }
+
+        const ushort optionDumpStartAddress = 0xa0;
+        const ushort optionDumpEndAddress   = 0xaf;
+
+        // Read the size of the descriptor dump, the slave copies page in its memory
+        protected Result dumpOptionDescriptors (int id, int page)
+        {
+            var result = new Result ();
+
+            lock (this)
+            {
+                var querySize = Commands.readUint16ResultsQuery ((byte) id, (ushort) (optionDumpStartAddress + page), 
+                                            1, out List<Commands.ExpectedResponse> expectedResponsesSize);
+
+                result.Status = execute (querySize, expectedResponsesSize, 
+                                         out Commands.ExpectedResponse? responseTemplateSize,
+                                         out CommandData responseSize);
+
+                if (result.Status != Commands.ResultType.Succeed)
+                    return result;
+                
+                Debug.Assert (responseTemplateSize != null);
+                int? sizeInBytes = responseTemplateSize.get16 (Commands.ExpectedResponse.FieldType.Data, responseSize);
+                Debug.Assert (sizeInBytes != null);
+                result.Values.Add ((int) sizeInBytes);
+            }
+            return result;
+        }
+
+        [ResourceMethod("getOptionDescriptors")]
+        public Result getOptionDescriptors (int id) // http://localhost:8080/cmd/getOptionDescriptors?id=1 --> {"status":"Succeed","values":[0,3,2,1,3,0,0,0,23,112,0,10,11,80,111,...]}
+        {
+            var result = new Result ();
+
+            if (id < 0 || id > 247)
+            {
+                result.Status =  Commands.ResultType.ArgError;
+                return result;
+            }
+
+            var dump = dumpOptionDescriptors (id, 0);
+            if (dump.Status != Commands.ResultType.Succeed)
+                return dump;
+            int size = dump.Values[0];
+
+            for (var page = 0; page * memorySize < size; page++)
+            {
+                if (page > optionDumpEndAddress - optionDumpStartAddress)
+                {
+                    result.Status = Commands.ResultType.Error;
+                    return result;
+                }
+                if (page > 0)
+                {
+                    dump = dumpOptionDescriptors (id, page);
+                    if (dump.Status != Commands.ResultType.Succeed)
+                        return dump;
+                }
+
+                var memory = readMemory (id, 0, Math.Min (memorySize, size - page * memorySize));
+                if (memory.Status != Commands.ResultType.Succeed)
+                    return memory;
+                result.Values.AddRange (memory.Values);
+            }
+
+            result.Status = Commands.ResultType.Succeed;
+            return result;
+        }
+
         [ResourceMethod("serialNumber")]
         public Result serialNumber (int id) // http://localhost:8080/cmd/serialNumber?id=1 --> {"status":"Succeed","values":[222,173,190,239,192,254,186,190]}
         {
             return serialNumber (id, true);
         }
 
+        // Serial numbers of the slaves of ids (field poll). With the native
+        // master library, the reads are queued at once and sent back to back
+        protected Dictionary<int, Result> serialNumbers (List<int> ids)
+        {
+            var results = new Dictionary<int, Result> ();
+            lock (this)
+            {
+                var reads = SerialCom.Instance.readRegisters (ids, 2, 4 /* 4 * uint16 */);
+                for (var i = 0; i < ids.Count; i++)
+                    results[ids[i]] = reads != null ? reads[i].Result : serialNumber (ids[i], false);
+            }
+            return results;
+        }
+
         [ResourceMethod("detectSlaves")]
         public Result detectSlaves () // http://localhost:8080/cmd/detectSlaves --> {"status":"Succeed","values":[1]}
         {
@@ -620,11 +929,11 @@ namespace Voltiris
                 var problem = new List<int> ();
 
                 string mask = "";
+                var detects = serialNumbers (Enumerable.Range (1, 32).Where (sn => !detected.Contains (sn)).ToList ());
                 for (int sn = 1; sn < 33; sn++)
                 {   
-                    if (detected.Contains (sn))
+                    if (!detects.TryGetValue (sn, out Result? detect))
                         continue;
-                    var detect = serialNumber (sn, false);
                     
                     //if (i == 0 && sn == 1)
                     //    detect.Status = Commands.ResultType.Error;
@@ -656,5 +965,334 @@ namespace Voltiris
 
             return result;
         }
+
+        const int maxSlaveId = 33;
+        const int discoveryReadTimeoutMs = 10; // A probe without response only costs this timeout
+        const int discoveryRetries = 2;
+
+        class Discovery
+        {
+            public List<int> ids = new List<int> ();
+            public int nextId = 1;
+            public bool unresolved = false; // Identical serial numbers or more than maxSlaveId slaves
+        }
+
+        enum Presence { None, Single, Several }
+
+        Presence probeSerialNumbers (ulong prefix, int bitCount, out ulong serialNumber)
+        {
+            serialNumber = 0;
+            var query = Commands.probeSerialNumbersQuery (prefix, bitCount,
+                                        out List<Commands.ExpectedResponse> expectedResponses);
+
+            var status = execute (query, expectedResponses,
+                                  out Commands.ExpectedResponse? responseTemplate,
+                                  out CommandData responseData, false);
+            switch (status)
+            {
+                case Commands.ResultType.ComTimeout:
+                    return Presence.None;
+                case Commands.ResultType.ComError:
+                    throw new IOException ("Serial port error during discovery");
+                case Commands.ResultType.Succeed:
+                    break;
+                default:
+                    return Presence.Several; // Collision
+            }
+
+            Debug.Assert (responseTemplate != null);
+            var serial = responseTemplate.get (Commands.ExpectedResponse.FieldType.Data, responseData);
+            Debug.Assert (serial != null);
+            foreach (var b in serial)
+                serialNumber = serialNumber << 8 | b;
+
+            // Colliding responses may still give a valid frame
+            ulong mask = bitCount == 0 ? 0 : ulong.MaxValue << (64 - bitCount);
+            return (serialNumber & mask) == (prefix & mask) ? Presence.Single : Presence.Several;
+        }
+
+        // The assignment is idempotent: it is retried, and the id is not reused if it is not confirmed
+        bool assignSlaveId (ulong serialNumber, Discovery discovery)
+        {
+            var id = discovery.nextId++;
+            for (var attempt = 0; attempt <= discoveryRetries; attempt++)
+            {
+                var query = Commands.assignSlaveIdQuery (serialNumber, (byte) id,
+                                            out List<Commands.ExpectedResponse> expectedResponses);
+                var status = execute (query, expectedResponses,
+                                      out Commands.ExpectedResponse? responseTemplate,
+                                      out CommandData responseData, false);
+                if (status == Commands.ResultType.Succeed)
+                {
+                    discovery.ids.Add (id);
+                    Logger.Trace ("Slave " + serialNumber.ToString ("x16") + " discovered, id " + id);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Tree walk over the serial number prefixes. several: the prefix is known to match
+        // several slaves (no need to probe it). A prefix is done once its probe gets no
+        // response. Return false if no slave matched
+        bool discoverPrefix (ulong prefix, int bitCount, bool several, Discovery discovery)
+        {
+            bool inferred = several;
+            bool found = several;
+            while (!several)
+            {
+                var presence = probeSerialNumbers (prefix, bitCount, out ulong serialNumber);
+                if (presence == Presence.None)
+                    return found;
+                found = true;
+
+                if (discovery.nextId > maxSlaveId)
+                {
+                    discovery.unresolved = true;
+                    return true;
+                }
+
+                // Colliding responses may look valid: probe again once the slave is quiet
+                if (presence == Presence.Single && assignSlaveId (serialNumber, discovery))
+                    continue;
+                several = true;
+            }
+
+            if (bitCount == 64)
+            {
+                discovery.unresolved = true;
+                return true;
+            }
+
+            // If nothing matches the 0 branch, the collision comes from the 1 branch
+            // (only inferred from a probed collision: a spurious one costs a few probes)
+            bool low = discoverPrefix (prefix, bitCount + 1, false, discovery);
+            discoverPrefix (prefix | 1UL << (63 - bitCount), bitCount + 1, !low && !inferred, discovery);
+            return true;
+        }
+
+        [ResourceMethod("discoverSlaves")]
+        public Result discoverSlaves () // http://localhost:8080/cmd/discoverSlaves --> {"status":"Succeed","values":[1,2]}
+        {
+            var result = new Result ();
+            var discovery = new Discovery ();
+
+            lock (this)
+            {
+                var readTimeout = SerialCom.Instance.ReadTimeout;
+                try {
+                    // Every slave forgets its discovery
+                    var start = Commands.writeUint16ResultsQuery (Commands.DiscoverySlaveId, Commands.DiscoveryStartAddress,
+                                            new byte[0], out List<Commands.ExpectedResponse> expectedResponses);
+                    expectedResponses.Clear (); // Interpreted by all slaves, no response
+                    result.Status = execute (start, expectedResponses,
+                                             out Commands.ExpectedResponse? responseTemplate,
+                                             out CommandData responseData);
+                    if (result.Status != Commands.ResultType.Succeed)
+                        return result;
+
+                    // A slave missing a request is found by the next pass
+                    SerialCom.Instance.ReadTimeout = discoveryReadTimeoutMs;
+                    for (var pass = 0; pass <= discoveryRetries && discovery.nextId <= maxSlaveId; pass++)
+                    {
+                        if (!discoverPrefix (0, 0, false, discovery))
+                            break;
+                    }
+                }
+                catch (IOException)
+                {
+                    result.Status = Commands.ResultType.ComError;
+                    return result;
+                }
+                finally {
+                    SerialCom.Instance.ReadTimeout = readTimeout;
+                }
+            }
+
+            result.Values = discovery.ids;
+            result.Status = discovery.unresolved ? Commands.ResultType.Error : Commands.ResultType.Succeed;
+            return result;
+        }
+
+        const int maxUpdateRounds = 10;   // Block transmissions and bitmap collections before giving up
+        const int updateVerifyWaitMs = 100; // The slaves read back the staged image
+        const int updateActivateWaitMs = 2000; // The slaves install the image and restart
+        const int updateRetries = 2;
+
+        // Broadcast a firmware update command, no response
+        Commands.ResultType broadcastUpdate (ushort address, byte[] data)
+        {
+            var query = Commands.writeUint16ResultsQuery (0, address, data,
+                                        out List<Commands.ExpectedResponse> expectedResponses);
+            expectedResponses.Clear (); // Interpreted by all slaves, no response
+            return execute (query, expectedResponses,
+                            out Commands.ExpectedResponse? responseTemplate,
+                            out CommandData responseData);
+        }
+
+        // Read count registers of a slave (retried), null if it does not answer
+        byte[]? readUpdateRegisters (int id, ushort address, int count)
+        {
+            for (var attempt = 0; attempt <= updateRetries; attempt++)
+            {
+                var query = Commands.readUint16ResultsQuery ((byte) id, address, (ushort) count,
+                                            out List<Commands.ExpectedResponse> expectedResponses);
+                var status = execute (query, expectedResponses,
+                                      out Commands.ExpectedResponse? responseTemplate,
+                                      out CommandData responseData, false);
+                if (status == Commands.ResultType.Succeed)
+                {
+                    Debug.Assert (responseTemplate != null);
+                    return responseTemplate.get (Commands.ExpectedResponse.FieldType.Data, responseData);
+                }
+                if (status == Commands.ResultType.ComError)
+                    throw new IOException ("Serial port error during the firmware update");
+            }
+            return null;
+        }
+
+        // Distribute the image to the slaves: the blocks are broadcasted once, then each round
+        // collects the missing-block bitmap of the slaves not verified yet and broadcasts the
+        // union of their missing blocks. The image is activated on all slaves at once, only
+        // if every slave verified it. Values: the slaves running the new image
+        [ResourceMethod("updateFirmware")]
+        public Result updateFirmware (string file, string ids) // http://localhost:8080/cmd/updateFirmware?file=firmware.bin&ids=1,2 --> {"status":"Succeed","values":[1,2]}
+        {
+            var result = new Result ();
+
+            var pending = new List<int> ();
+            foreach (var item in ids.Split (',', StringSplitOptions.RemoveEmptyEntries))
+            {
+                if (!int.TryParse (item, out int id) || id < 1 || id > 247)
+                {
+                    result.Status = Commands.ResultType.ArgError;
+                    return result;
+                }
+                pending.Add (id);
+            }
+
+            byte[] image;
+            try {
+                image = File.ReadAllBytes (file);
+            }
+            catch (Exception)
+            {
+                result.Status = Commands.ResultType.ArgError;
+                return result;
+            }
+            if (pending.Count == 0 || image.Length == 0)
+            {
+                result.Status = Commands.ResultType.ArgError;
+                return result;
+            }
+
+            int blockCount = (image.Length + Commands.UpdateBlockSize - 1) / Commands.UpdateBlockSize;
+            ushort imageCrc = Commands.computeCRC16 (image, 0, image.Length);
+            var start = new byte[] { (byte) (image.Length >> 24), (byte) (image.Length >> 16),
+                                     (byte) (image.Length >> 8), (byte) image.Length,
+                                     (byte) (imageCrc >> 8), (byte) (imageCrc & 0xff) };
+            var crc = new byte[] { (byte) (imageCrc >> 8), (byte) (imageCrc & 0xff) };
+            var slaves = new List<int> (pending);
+
+            lock (this)
+            {
+                try {
+                    bool sendStart = true;
+                    var sendBlock = Enumerable.Repeat (true, blockCount).ToArray ();
+                    for (var round = 0; round < maxUpdateRounds && pending.Count > 0; round++)
+                    {
+                        // Slaves that missed the start keep it, then take the blocks
+                        if (sendStart)
+                            broadcastUpdate (Commands.UpdateStartAddress, start);
+                        int sent = 0;
+                        for (var block = 0; block < blockCount; block++)
+                        {
+                            if (!sendBlock[block])
+                                continue;
+                            broadcastUpdate (Commands.UpdateBlockAddress, Commands.updateBlockData (image, block));
+                            sent++;
+                        }
+                        // Ignored by the slaves still missing blocks
+                        broadcastUpdate (Commands.UpdateVerifyAddress, crc);
+                        Thread.Sleep (updateVerifyWaitMs);
+
+                        sendStart = false;
+                        Array.Fill (sendBlock, false);
+                        var stillPending = new List<int> ();
+                        foreach (var id in pending)
+                        {
+                            var status = readUpdateRegisters (id, Commands.UpdateStatusAddress, Commands.UpdateStatusRegisters);
+                            if (status == null)
+                            {
+                                stillPending.Add (id); // Unreachable this round
+                                continue;
+                            }
+                            var state = (Commands.UpdateState) (status[0] << 8 | status[1]);
+                            int missing = status[4] << 8 | status[5];
+                            int slaveCrc = status[6] << 8 | status[7];
+                            if (state == Commands.UpdateState.Verified && slaveCrc == imageCrc)
+                                continue;
+                            stillPending.Add (id);
+
+                            // Start missed (or staging failed): every block again
+                            if (state != Commands.UpdateState.Receiving || slaveCrc != imageCrc)
+                            {
+                                sendStart = true;
+                                Array.Fill (sendBlock, true);
+                                continue;
+                            }
+
+                            // Bitmap pages covering the blocks of the image
+                            int bitmapSize = (blockCount + 15) / 16 * 2;
+                            for (var offset = 0; missing > 0 && offset < bitmapSize; offset += Commands.UpdateBitmapPageSize)
+                            {
+                                int size = Math.Min (bitmapSize - offset, Commands.UpdateBitmapPageSize);
+                                var bitmap = readUpdateRegisters (id, (ushort) (Commands.UpdateMissingAddress + offset / Commands.UpdateBitmapPageSize), size / 2);
+                                for (var b = 0; b < 8 * size && 8 * offset + b < blockCount; b++)
+                                    if (bitmap == null || ((bitmap[b / 8] >> (b % 8)) & 1) != 0)
+                                        sendBlock[8 * offset + b] = true;
+                            }
+                        }
+                        Logger.Trace ("Firmware update, round " + round + ", " + sent + " blocks sent, slaves not verified: " + stillPending.Count);
+                        pending = stillPending;
+                    }
+
+                    // Coordinated activation: all slaves or none
+                    if (pending.Count > 0)
+                    {
+                        result.Status = Commands.ResultType.Error;
+                        return result;
+                    }
+
+                    // A slave that missed the activation is still verified, activated ones are idle
+                    var verified = slaves;
+                    for (var attempt = 0; attempt <= updateRetries && verified.Count > 0; attempt++)
+                    {
+                        broadcastUpdate (Commands.UpdateActivateAddress, crc);
+                        Thread.Sleep (updateActivateWaitMs);
+                        var stillVerified = new List<int> ();
+                        foreach (var id in verified)
+                        {
+                            var status = readUpdateRegisters (id, Commands.UpdateStatusAddress, Commands.UpdateStatusRegisters);
+                            if (status == null)
+                                stillVerified.Add (id); // Still restarting
+                            else if ((Commands.UpdateState) (status[0] << 8 | status[1]) == Commands.UpdateState.Idle)
+                                result.Values.Add (id);
+                            else
+                                stillVerified.Add (id);
+                        }
+                        verified = stillVerified;
+                    }
+                }
+                catch (IOException)
+                {
+                    result.Status = Commands.ResultType.ComError;
+                    return result;
+                }
+            }
+
+            result.Status = result.Values.Count == slaves.Count ? Commands.ResultType.Succeed : Commands.ResultType.Error;
+            return result;
+        }
     }
 }
\ No newline at end of file
@@ -0,0 +1,653 @@
+#include "mstMaster.hpp"
+
+#include <chrono>
+
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #define NOMINMAX
+    #include <windows.h>
+    #include <string>
+#else
+    #include <errno.h>
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <termios.h>
+    #include <unistd.h>
+#endif
+
+namespace voltiris
+{
+    typedef std::chrono::steady_clock Clock;
+    typedef std::chrono::microseconds Microseconds;
+
+    // Size of the blocks read on the serial port
+    const int MASTER_READ_CHUNK_SIZE = 256;
+
+    // Largest command (without checksum)
+    const uint16 MASTER_COMMAND_SIZE = PRESET_MULT_REGISTERS_CMD_SIZE + 2 * MAX_READ_INPUT_REGISTERS;
+
+    // Time to send size characters at baudRate (in us, 10 bits per character)
+    static inline uint32 wireTimeUs (size_t size, uint32 baudRate)
+    {
+        return (uint32) ((unsigned long long) size * 10 * 1000000 / baudRate);
+    }
+
+#ifdef _WIN32
+
+    Master* Master::open (const char* portName, uint32 baudRate, Framing framing)
+    {
+        if (baudRate == 0)
+            return NULL;
+
+        // "COM10" and above are only reachable through the device namespace
+        std::string path = portName;
+        if (path.compare (0, 4, "\\\\.\\") != 0)
+            path = "\\\\.\\" + path;
+
+        HANDLE handle = CreateFileA (path.c_str (), GENERIC_READ | GENERIC_WRITE, 0, NULL,
+                                     OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
+        if (handle == INVALID_HANDLE_VALUE)
+            return NULL;
+
+        // 8 data bits, no parity, 1 stop bit, no flow control
+        DCB dcb;
+        memset (&dcb, 0, sizeof (dcb));
+        dcb.DCBlength = sizeof (dcb);
+        if (!GetCommState (handle, &dcb))
+        {
+            CloseHandle (handle);
+            return NULL;
+        }
+        dcb.BaudRate = baudRate;
+        dcb.ByteSize = 8;
+        dcb.Parity = NOPARITY;
+        dcb.StopBits = ONESTOPBIT;
+        dcb.fBinary = TRUE;
+        dcb.fParity = FALSE;
+        dcb.fOutxCtsFlow = FALSE;
+        dcb.fOutxDsrFlow = FALSE;
+        dcb.fDtrControl = DTR_CONTROL_ENABLE;
+        dcb.fRtsControl = RTS_CONTROL_ENABLE;
+        dcb.fDsrSensitivity = FALSE;
+        dcb.fOutX = FALSE;
+        dcb.fInX = FALSE;
+        dcb.fErrorChar = FALSE;
+        dcb.fNull = FALSE;
+        dcb.fAbortOnError = FALSE;
+        if (!SetCommState (handle, &dcb))
+        {
+            CloseHandle (handle);
+            return NULL;
+        }
+        PurgeComm (handle, PURGE_RXCLEAR | PURGE_TXCLEAR);
+
+        return new Master (handle, baudRate, framing);
+    }
+
+#else
+
+    static inline speed_t toSpeed (uint32 baudRate)
+    {
+        switch (baudRate)
+        {
+            case 9600:   return B9600;
+            case 19200:  return B19200;
+            case 38400:  return B38400;
+            case 57600:  return B57600;
+            case 115200: return B115200;
+            case 230400: return B230400;
+        }
+        return B0;
+    }
+
+    Master* Master::open (const char* portName, uint32 baudRate, Framing framing)
+    {
+        speed_t speed = toSpeed (baudRate);
+        if (speed == B0)
+            return NULL;
+
+        int fd = ::open (portName, O_RDWR | O_NOCTTY | O_NONBLOCK);
+        if (fd < 0)
+            return NULL;
+
+        // Raw mode, 8 data bits, no parity, 1 stop bit
+        struct termios tio;
+        if (tcgetattr (fd, &tio) != 0)
+        {
+            close (fd);
+            return NULL;
+        }
+        cfmakeraw (&tio);
+        tio.c_cflag |= CLOCAL | CREAD;
+        tio.c_cflag &= ~(CSTOPB | PARENB);
+        cfsetispeed (&tio, speed);
+        cfsetospeed (&tio, speed);
+        if (tcsetattr (fd, TCSANOW, &tio) != 0)
+        {
+            close (fd);
+            return NULL;
+        }
+        tcflush (fd, TCIOFLUSH);
+
+        return new Master (fd, baudRate, framing);
+    }
+
+#endif
+
+    Master::Master (MasterPort port, uint32 baudRate, Framing framing):
+        port (port),
+        baudRate (baudRate),
+        framing (framing),
+        turnaroundUs (framing == FRAMING_RTU ? rtuSilenceUs (baudRate) : 0)
+    {
+#ifdef _WIN32
+        // A read returns the characters received, or waits for the first one
+        // (until readPort () cancels it)
+        COMMTIMEOUTS timeouts = {MAXDWORD, MAXDWORD, MAXDWORD - 1, 0, 0};
+        readEvent = CreateEventA (NULL, TRUE, FALSE, NULL);
+        writeEvent = CreateEventA (NULL, TRUE, FALSE, NULL);
+        if (readEvent == NULL || writeEvent == NULL || !SetCommTimeouts ((HANDLE) port, &timeouts))
+            failed = true;
+#else
+        fcntl (port, F_SETFL, fcntl (port, F_GETFL) | O_NONBLOCK);
+#endif
+        thread = std::thread (&Master::run, this);
+    }
+
+    Master::~Master ()
+    {
+        {
+            std::lock_guard<std::mutex> lock (mutex);
+            closing = true;
+        }
+        queued.notify_all ();
+        thread.join ();
+        closePort ();
+    }
+
+    void Master::setTurnaround (uint32 turnaroundUs)
+    {
+        std::lock_guard<std::mutex> lock (mutex);
+        this->turnaroundUs = turnaroundUs;
+    }
+
+    void Master::wait ()
+    {
+        std::unique_lock<std::mutex> lock (mutex);
+        completed.wait (lock, [this] { return requests.empty () && !busy; });
+    }
+
+    // Encode the request and add it to the queue
+    void Master::queue (Request& request, uint8 id, uint8 command, uint16 address, uint16 count,
+                        uint32 timeoutUs, MasterCallback callback, const uint8* data, uint16 dataSize)
+    {
+        request.id = id;
+        request.command = command;
+        request.address = address;
+        request.count = count;
+        request.timeoutUs = timeoutUs;
+        request.response = id != BROADCAST_SLAVE_ID;
+        request.raw = false;
+        request.callback = callback;
+
+        uint8 bin [MASTER_COMMAND_SIZE + 1];
+        uint16 size = 0;
+        bin [size++] = id;
+        bin [size++] = command;
+        bin [size++] = (uint8) (address >> 8);
+        bin [size++] = (uint8) (address & 0xff);
+        bin [size++] = (uint8) (count >> 8);
+        bin [size++] = (uint8) (count & 0xff);
+        if (command == PRESET_MULT_REGISTERS_CMD)
+        {
+            bin [size++] = (uint8) dataSize;
+            for (uint16 i = 0; i < dataSize; i++)
+                bin [size++] = data [i];
+        }
+        push (request, bin, size);
+    }
+
+    // Frame the command (size bytes of bin, followed by room for
+    // the checksum) and add the request to the queue
+    void Master::push (Request& request, uint8* bin, uint16 size)
+    {
+        std::vector<uint8>& frame = request.frame;
+        if (framing == FRAMING_RTU)
+        {
+            uint16 crc16 = computeCRC16 (bin, size);
+            frame.assign (bin, bin + size);
+            frame.push_back ((uint8) (crc16 & 0xff)); // CRC-16 is sent low byte first
+            frame.push_back ((uint8) (crc16 >> 8));
+        }
+        else
+        {
+            char hi, low;
+            bin [size] = computeCRC8 (bin, size);
+            frame.reserve (2 * (size + 1) + 3);
+            frame.push_back (':');
+            for (uint16 i = 0; i <= size; i++)
+            {
+                toChar (bin [i], hi, low);
+                frame.push_back ((uint8) hi);
+                frame.push_back ((uint8) low);
+            }
+            frame.push_back ('\r');
+            frame.push_back ('\n');
+        }
+
+        {
+            std::lock_guard<std::mutex> lock (mutex);
+            requests.push_back (std::move (request));
+        }
+        queued.notify_one ();
+    }
+
+    void Master::readRegisters (uint8 id, uint16 address, uint16 count, uint32 timeoutUs, MasterCallback callback)
+    {
+        if (id == BROADCAST_SLAVE_ID || count == 0 || count > MAX_READ_INPUT_REGISTERS)
+        {
+            callback (MasterResult {MASTER_ARG_ERROR, {}});
+            return;
+        }
+
+        Request request;
+        queue (request, id, READ_INPUT_REGISTERS_CMD, address, count, timeoutUs, callback, NULL, 0);
+    }
+
+    void Master::writeRegisters (uint8 id, uint16 address, const uint16* values, uint16 count, uint32 timeoutUs, MasterCallback callback)
+    {
+        if (count > MAX_READ_INPUT_REGISTERS || (count > 0 && values == NULL))
+        {
+            callback (MasterResult {MASTER_ARG_ERROR, {}});
+            return;
+        }
+
+        uint8 data [2 * MAX_READ_INPUT_REGISTERS];
+        for (uint16 i = 0; i < count; i++)
+        {
+            data [2 * i]     = (uint8) (values [i] >> 8);
+            data [2 * i + 1] = (uint8) (values [i] & 0xff);
+        }
+
+        Request request;
+        queue (request, id, PRESET_MULT_REGISTERS_CMD, address, count, timeoutUs, callback, data, 2 * count);
+    }
+
+    void Master::transfer (const uint8* data, uint16 size, bool response, uint32 timeoutUs, MasterCallback callback)
+    {
+        if (data == NULL || size < 2 || size > MASTER_COMMAND_SIZE)
+        {
+            callback (MasterResult {MASTER_ARG_ERROR, {}});
+            return;
+        }
+
+        uint8 bin [MASTER_COMMAND_SIZE + 1];
+        memcpy (bin, data, size);
+
+        Request request;
+        request.id = data [0];
+        request.command = data [1];
+        request.address = 0;
+        request.count = 0;
+        request.timeoutUs = timeoutUs;
+        request.response = response;
+        request.raw = true;
+        request.callback = callback;
+        push (request, bin, size);
+    }
+
+    std::future<MasterResult> Master::readRegisters (uint8 id, uint16 address, uint16 count, uint32 timeoutUs)
+    {
+        auto promise = std::make_shared<std::promise<MasterResult>> ();
+        readRegisters (id, address, count, timeoutUs,
+                       [promise] (const MasterResult& result) { promise->set_value (result); });
+        return promise->get_future ();
+    }
+
+    std::future<MasterResult> Master::writeRegisters (uint8 id, uint16 address, const uint16* values, uint16 count, uint32 timeoutUs)
+    {
+        auto promise = std::make_shared<std::promise<MasterResult>> ();
+        writeRegisters (id, address, values, count, timeoutUs,
+                        [promise] (const MasterResult& result) { promise->set_value (result); });
+        return promise->get_future ();
+    }
+
+#ifdef _WIN32
+
+    // Write the whole buffer. Return false in case of serial port error
+    bool Master::writePort (const uint8* data, size_t size)
+    {
+        OVERLAPPED overlapped;
+        memset (&overlapped, 0, sizeof (overlapped));
+        overlapped.hEvent = (HANDLE) writeEvent;
+        DWORD count = 0;
+        if (!WriteFile ((HANDLE) port, data, (DWORD) size, &count, &overlapped) &&
+            (GetLastError () != ERROR_IO_PENDING || !GetOverlappedResult ((HANDLE) port, &overlapped, &count, TRUE)))
+            return false;
+        return count == size;
+    }
+
+    // Read the characters received, waiting at most timeoutMs for the first one.
+    // Return the number of characters, -1 in case of serial port error
+    long Master::readPort (uint8* data, size_t size, int timeoutMs)
+    {
+        OVERLAPPED overlapped;
+        memset (&overlapped, 0, sizeof (overlapped));
+        overlapped.hEvent = (HANDLE) readEvent;
+        DWORD count = 0;
+        if (ReadFile ((HANDLE) port, data, (DWORD) size, &count, &overlapped))
+            return (long) count;
+        if (GetLastError () != ERROR_IO_PENDING)
+            return -1;
+
+        // Characters received before the cancellation are still returned
+        if (WaitForSingleObject ((HANDLE) readEvent, (DWORD) timeoutMs) != WAIT_OBJECT_0)
+            CancelIo ((HANDLE) port);
+        if (!GetOverlappedResult ((HANDLE) port, &overlapped, &count, TRUE))
+            return GetLastError () == ERROR_OPERATION_ABORTED ? 0 : -1;
+        return (long) count;
+    }
+
+    // Drop the characters received outside of a transaction (late responses, noise)
+    void Master::discardInput ()
+    {
+        PurgeComm ((HANDLE) port, PURGE_RXCLEAR);
+    }
+
+    void Master::closePort ()
+    {
+        CloseHandle ((HANDLE) port);
+        if (readEvent != NULL)
+            CloseHandle ((HANDLE) readEvent);
+        if (writeEvent != NULL)
+            CloseHandle ((HANDLE) writeEvent);
+    }
+
+#else
+
+    // Write the whole buffer. Return false in case of serial port error
+    bool Master::writePort (const uint8* data, size_t size)
+    {
+        while (size > 0)
+        {
+            ssize_t count = write (port, data, size);
+            if (count > 0)
+            {
+                data += count;
+                size -= count;
+                continue;
+            }
+            if (count < 0 && errno != EAGAIN && errno != EINTR)
+                return false;
+
+            struct pollfd pfd = {port, POLLOUT, 0};
+            poll (&pfd, 1, 100);
+        }
+        return true;
+    }
+
+    // Read the characters received, waiting at most timeoutMs for the first one.
+    // Return the number of characters, -1 in case of serial port error
+    long Master::readPort (uint8* data, size_t size, int timeoutMs)
+    {
+        struct pollfd pfd = {port, POLLIN, 0};
+        int ready = poll (&pfd, 1, timeoutMs);
+        if (ready < 0)
+            return errno == EINTR ? 0 : -1;
+        if (ready == 0)
+            return 0;
+
+        ssize_t count = read (port, data, size);
+        if (count == 0 || (count < 0 && errno != EAGAIN && errno != EINTR))
+            return -1;
+        return count < 0 ? 0 : (long) count;
+    }
+
+    // Drop the characters received outside of a transaction (late responses, noise)
+    void Master::discardInput ()
+    {
+        uint8 chunk [MASTER_READ_CHUNK_SIZE];
+        while (read (port, chunk, sizeof (chunk)) > 0);
+    }
+
+    void Master::closePort ()
+    {
+        close (port);
+    }
+
+#endif
+
+    // Write the whole frame of the request.
+    // Return false in case of serial port error
+    bool Master::send (const Request& request)
+    {
+        if (failed)
+            return false;
+
+        discardInput ();
+
+        if (!writePort (request.frame.data (), request.frame.size ()))
+        {
+            failed = true;
+            return false;
+        }
+        return true;
+    }
+
+    // Check a complete response (without checksum) against its request
+    MasterResult Master::check (const Request& request, const std::vector<uint8>& response)
+    {
+        if (request.raw)
+            return MasterResult {MASTER_SUCCEED, response};
+
+        MasterResult result {MASTER_UNKNOWN, {}};
+        if (response.size () < 3 || response [0] != request.id || response [1] != request.command)
+            return result;
+
+        if (request.command == READ_INPUT_REGISTERS_CMD)
+        {
+            uint8 byteCount = response [2];
+            if (response.size () != 3u + byteCount)
+                return result;
+            if (byteCount == 0)
+                result.status = MASTER_ERROR;
+            else if (byteCount == 2 * request.count)
+            {
+                result.status = MASTER_SUCCEED;
+                result.data.assign (response.begin () + 3, response.end ());
+            }
+            return result;
+        }
+
+        // Preset multiple registers: address and number of registers written
+        if (response.size () != 6 ||
+            (uint16) ((response [2] << 8) | response [3]) != request.address)
+            return result;
+        result.status = (response [4] == 0 && response [5] == 0) ? MASTER_ERROR : MASTER_SUCCEED;
+        result.data.assign (response.begin () + 4, response.end ());
+        return result;
+    }
+
+    // Wait for the response of the request (sent by send () at time sent)
+    MasterResult Master::receive (const Request& request, std::chrono::steady_clock::time_point sent)
+    {
+        uint32 wireTime = wireTimeUs (request.frame.size (), baudRate);
+
+        if (!request.response)
+        {
+            // No response, the line is free once the frame is sent
+            std::this_thread::sleep_until (sent + Microseconds (wireTime));
+            return MasterResult {MASTER_SUCCEED, {}};
+        }
+
+        Clock::time_point deadline = sent + Microseconds (wireTime + request.timeoutUs);
+        std::vector<uint8> response;
+        bool started = false;        // ':' received (ASCII)
+        bool hasHigh = false;        // High nibble received (ASCII)
+        bool carriageReturn = false; // '\r' received (ASCII)
+        bool invalid = false;        // Invalid character (ASCII)
+        uint8 high = 0;
+
+        while (true)
+        {
+            Clock::time_point now = Clock::now ();
+            if (now >= deadline)
+                return MasterResult {MASTER_COM_TIMEOUT, {}};
+
+            long long left = std::chrono::duration_cast<Microseconds> (deadline - now).count ();
+            uint8 chunk [MASTER_READ_CHUNK_SIZE];
+            long count = readPort (chunk, sizeof (chunk), (int) ((left + 999) / 1000));
+            if (count < 0)
+            {
+                failed = true;
+                return MasterResult {MASTER_COM_ERROR, {}};
+            }
+
+            for (long i = 0; i < count; i++)
+            {
+                uint8 c = chunk [i];
+                if (framing == FRAMING_RTU)
+                {
+                    // Frame size is known from the command
+                    response.push_back (c);
+                    size_t size = response.size ();
+                    size_t expected = 0;
+                    if (size >= 3 && response [1] == READ_INPUT_REGISTERS_CMD)
+                        expected = 3 + response [2] + 2;
+                    else if (size >= 2 && response [1] == PRESET_MULT_REGISTERS_CMD)
+                        expected = 6 + 2;
+                    if (expected == 0 || size < expected)
+                        continue;
+
+                    uint16 crcIndex = (uint16) (size - 2);
+                    uint16 crc16 = (uint16) (response [crcIndex] | (response [crcIndex + 1] << 8));
+                    if (crc16 != computeCRC16 (response.data (), crcIndex))
+                        return MasterResult {MASTER_UNKNOWN, {}};
+                    response.resize (crcIndex);
+                    return check (request, response);
+                }
+
+                switch (c)
+                {
+                    case ':':
+                        response.clear ();
+                        started = true;
+                        hasHigh = carriageReturn = invalid = false;
+                        break;
+
+                    case '\r':
+                        carriageReturn = true;
+                        break;
+
+                    case '\n':
+                    {
+                        if (!started)
+                            break;
+                        // Complete line: the response is invalid or for this request
+                        if (invalid || hasHigh || !carriageReturn || response.empty ())
+                            return MasterResult {MASTER_UNKNOWN, {}};
+                        uint16 crcIndex = (uint16) (response.size () - 1);
+                        if (response [crcIndex] != computeCRC8 (response.data (), crcIndex))
+                            return MasterResult {MASTER_UNKNOWN, {}};
+                        response.resize (crcIndex);
+                        return check (request, response);
+                    }
+
+                    default:
+                    {
+                        bool error = carriageReturn;
+                        uint8 nibble = toByte ((char) c, error);
+                        if (error)
+                        {
+                            invalid = true;
+                            break;
+                        }
+                        if (!hasHigh)
+                        {
+                            high = nibble;
+                            hasHigh = true;
+                            break;
+                        }
+                        response.push_back ((uint8) ((high << 4) | nibble));
+                        hasHigh = false;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    // Send the requests one after the other. The next request is sent as soon
+    // as the response of the previous one is received (and the turnaround
+    // elapsed), then the callback of the previous request is called while
+    // the next request is on the line.
+    void Master::run ()
+    {
+        Clock::time_point lineFree = Clock::now ();
+        std::unique_lock<std::mutex> lock (mutex);
+        bool hasCurrent = false;
+        Request current;
+        MasterResult currentResult;
+
+        while (true)
+        {
+            // Wait for a request if the line is idle
+            if (!hasCurrent)
+            {
+                busy = false;
+                completed.notify_all ();
+                queued.wait (lock, [this] { return closing || !requests.empty (); });
+            }
+
+            bool hasNext = !requests.empty () && !closing;
+            Request next;
+            if (hasNext)
+            {
+                next = std::move (requests.front ());
+                requests.pop_front ();
+                busy = true;
+            }
+            uint32 turnaround = turnaroundUs;
+            lock.unlock ();
+
+            bool sent = false;
+            Clock::time_point sentTime;
+            if (hasNext)
+            {
+                std::this_thread::sleep_until (lineFree);
+                sent = send (next);
+                sentTime = Clock::now ();
+            }
+
+            if (hasCurrent && current.callback)
+                current.callback (currentResult);
+
+            MasterResult nextResult {MASTER_COM_ERROR, {}};
+            if (hasNext)
+            {
+                nextResult = sent ? receive (next, sentTime) : MasterResult {MASTER_COM_ERROR, {}};
+                lineFree = Clock::now () + Microseconds (turnaround);
+            }
+
+            lock.lock ();
+            if (!hasNext && closing)
+                break;
+
+            hasCurrent = hasNext;
+            current = std::move (next);
+            currentResult = std::move (nextResult);
+        }
+
+        // Requests not sent
+        std::deque<Request> cancelled;
+        cancelled.swap (requests);
+        busy = false;
+        lock.unlock ();
+        for (Request& request : cancelled)
+        {
+            if (request.callback)
+                request.callback (MasterResult {MASTER_COM_ERROR, {}});
+        }
+        completed.notify_all ();
+    }
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include "vltFraming.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace voltiris
+{
+    // Status of a request, same values as Commands.ResultType of the C# application
+    enum MasterStatus: int
+    {
+        MASTER_SUCCEED,     // Response received
+        MASTER_ERROR,       // Error response received
+        MASTER_UNKNOWN,     // Complete but unexpected response (CRC, slave id...)
+        MASTER_COM_TIMEOUT, // No complete response before the timeout
+        MASTER_COM_ERROR,   // Serial port error, or master closed before the request was sent
+        MASTER_ARG_ERROR    // Invalid request
+    };
+
+    // Result of a request
+    struct MasterResult
+    {
+        MasterStatus status;
+        std::vector<uint8> data; // Read: register bytes (big endian), write: number of registers written (uint16)
+    };
+
+    // Called by the master thread once a request is complete
+    typedef std::function<void (const MasterResult& result)> MasterCallback;
+
+    #ifdef _WIN32
+        typedef void* MasterPort; // HANDLE of a port opened for overlapped I/O
+    #else
+        typedef int MasterPort;   // File descriptor
+    #endif
+
+    // Master of the serial bus. Requests are queued and sent by a dedicated thread:
+    // a request is on the line as soon as the previous response is complete
+    // (plus turnaround), before the callback of the previous request runs.
+    // Requests can be queued from any thread. Invalid requests are completed
+    // immediately with MASTER_ARG_ERROR (callback called by the calling thread)
+    class Master
+    {
+        public:
+
+            // Open a serial port (8 data bits, no parity, 1 stop bit): a device
+            // (eg: "/dev/ttyUSB0") or, on Windows, a COM port (eg: "COM3")
+            // Return NULL if the port cannot be opened
+            static Master* open (const char* portName, uint32 baudRate, Framing framing);
+
+            // Use an already opened port (eg: a pseudo-terminal), closed by the master.
+            // On Windows, the handle must be opened with FILE_FLAG_OVERLAPPED
+            Master (MasterPort port, uint32 baudRate, Framing framing);
+
+            // Complete the requests not yet sent with MASTER_COM_ERROR
+            ~Master ();
+
+            // Read count registers from address of slave id
+            void readRegisters (uint8 id, uint16 address, uint16 count, uint32 timeoutUs, MasterCallback callback);
+            std::future<MasterResult> readRegisters (uint8 id, uint16 address, uint16 count, uint32 timeoutUs);
+
+            // Write count registers from address of slave id
+            // (id BROADCAST_SLAVE_ID: all slaves, no response expected)
+            void writeRegisters (uint8 id, uint16 address, const uint16* values, uint16 count, uint32 timeoutUs, MasterCallback callback);
+            std::future<MasterResult> writeRegisters (uint8 id, uint16 address, const uint16* values, uint16 count, uint32 timeoutUs);
+
+            // Send a command (size bytes without checksum) and give its response as it is
+            // (without checksum, MASTER_UNKNOWN if the checksum is wrong), for the commands
+            // answered by another slave id or command (eg: discovery).
+            // No response expected: complete once the command is sent
+            void transfer (const uint8* data, uint16 size, bool response, uint32 timeoutUs, MasterCallback callback);
+
+            // Wait until every queued request is complete
+            void wait ();
+
+            // Silence between a response and the next request (in us).
+            // Default: 0 for ASCII, 3.5 characters for RTU
+            void setTurnaround (uint32 turnaroundUs);
+
+        private:
+
+            struct Request
+            {
+                std::vector<uint8> frame; // Encoded request
+                uint8  id;
+                uint8  command;
+                uint16 address;
+                uint16 count;
+                uint32 timeoutUs;
+                bool response;            // A response is expected
+                bool raw;                 // Response given without check ()
+                MasterCallback callback;
+            };
+
+            Master (const Master&) = delete;
+            Master& operator= (const Master&) = delete;
+
+            void queue (Request& request, uint8 id, uint8 command, uint16 address, uint16 count,
+                        uint32 timeoutUs, MasterCallback callback, const uint8* data, uint16 dataSize);
+            void push (Request& request, uint8* bin, uint16 size);
+            void run ();
+            bool send (const Request& request);
+            MasterResult receive (const Request& request, std::chrono::steady_clock::time_point sent);
+            MasterResult check (const Request& request, const std::vector<uint8>& response);
+
+            // Serial port (POSIX or Win32)
+            bool writePort (const uint8* data, size_t size);
+            long readPort (uint8* data, size_t size, int timeoutMs);
+            void discardInput ();
+            void closePort ();
+
+            MasterPort port;
+            #ifdef _WIN32
+                void* readEvent;  // Events of the overlapped reads and writes
+                void* writeEvent;
+            #endif
+            uint32 baudRate;
+            Framing framing;
+            uint32 turnaroundUs;
+
+            std::mutex mutex;
+            std::condition_variable queued;    // A request was queued or the master is closed
+            std::condition_variable completed; // Every request is complete
+            std::deque<Request> requests;
+            bool busy = false;
+            bool closing = false;
+            bool failed = false; // Serial port error
+            std::thread thread;
+    };
+}
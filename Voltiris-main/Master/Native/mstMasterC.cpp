@@ -0,0 +1,85 @@
+#include "mstMasterC.h"
+#include "mstMaster.hpp"
+
+#include <string.h>
+
+using namespace voltiris;
+
+struct VoltirisMaster
+{
+    Master* master;
+};
+
+static inline Framing toFraming (int rtu)
+{
+    return rtu ? FRAMING_RTU : FRAMING_ASCII;
+}
+
+static inline MasterCallback toCallback (VoltirisMasterCallback callback, void* user)
+{
+    return [callback, user] (const MasterResult& result)
+    {
+        if (callback != NULL)
+            callback (user, (int) result.status, result.data.data (), (uint16_t) result.data.size ());
+    };
+}
+
+VoltirisMaster* voltirisMasterOpen (const char* portName, uint32_t baudRate, int rtu)
+{
+    Master* master = Master::open (portName, baudRate, toFraming (rtu));
+    return master != NULL ? new VoltirisMaster {master} : NULL;
+}
+
+#ifndef _WIN32
+VoltirisMaster* voltirisMasterOpenFd (int fd, uint32_t baudRate, int rtu)
+{
+    if (fd < 0 || baudRate == 0)
+        return NULL;
+    return new VoltirisMaster {new Master (fd, baudRate, toFraming (rtu))};
+}
+#endif
+
+void voltirisMasterClose (VoltirisMaster* master)
+{
+    if (master == NULL)
+        return;
+    delete master->master;
+    delete master;
+}
+
+void voltirisMasterRead (VoltirisMaster* master, uint8_t id, uint16_t address, uint16_t count,
+                         uint32_t timeoutUs, VoltirisMasterCallback callback, void* user)
+{
+    master->master->readRegisters (id, address, count, timeoutUs, toCallback (callback, user));
+}
+
+void voltirisMasterWrite (VoltirisMaster* master, uint8_t id, uint16_t address, const uint16_t* values,
+                          uint16_t count, uint32_t timeoutUs, VoltirisMasterCallback callback, void* user)
+{
+    master->master->writeRegisters (id, address, values, count, timeoutUs, toCallback (callback, user));
+}
+
+void voltirisMasterTransfer (VoltirisMaster* master, const uint8_t* data, uint16_t size, int response,
+                             uint32_t timeoutUs, VoltirisMasterCallback callback, void* user)
+{
+    master->master->transfer (data, size, response != 0, timeoutUs, toCallback (callback, user));
+}
+
+int voltirisMasterReadSync (VoltirisMaster* master, uint8_t id, uint16_t address, uint16_t count,
+                            uint32_t timeoutUs, uint8_t* data)
+{
+    MasterResult result = master->master->readRegisters (id, address, count, timeoutUs).get ();
+    if (result.status == MASTER_SUCCEED && data != NULL)
+        memcpy (data, result.data.data (), result.data.size ());
+    return (int) result.status;
+}
+
+void voltirisMasterWait (VoltirisMaster* master)
+{
+    master->master->wait ();
+}
+
+void voltirisMasterSetTurnaround (VoltirisMaster* master, uint32_t turnaroundUs)
+{
+    master->master->setTurnaround (turnaroundUs);
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+/* C interface of the master library (used by the C# application through P/Invoke) */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Status of a request, same values as Commands.ResultType of the C# application */
+enum
+{
+    VOLTIRIS_MASTER_SUCCEED,
+    VOLTIRIS_MASTER_ERROR,
+    VOLTIRIS_MASTER_UNKNOWN,
+    VOLTIRIS_MASTER_COM_TIMEOUT,
+    VOLTIRIS_MASTER_COM_ERROR,
+    VOLTIRIS_MASTER_ARG_ERROR
+};
+
+typedef struct VoltirisMaster VoltirisMaster;
+
+/* Called by the master thread once a request is complete. data (size bytes) is the
+   register bytes of a read or the number of registers written (big endian),
+   it is only valid during the call */
+typedef void (*VoltirisMasterCallback) (void* user, int status, const uint8_t* data, uint16_t size);
+
+/* Open a serial port ("/dev/ttyUSB0", "COM3"...), rtu != 0 selects the RTU framing.
+   Return NULL on failure */
+VoltirisMaster* voltirisMasterOpen (const char* portName, uint32_t baudRate, int rtu);
+
+#ifndef _WIN32
+/* Use an already opened descriptor, closed by voltirisMasterClose () */
+VoltirisMaster* voltirisMasterOpenFd (int fd, uint32_t baudRate, int rtu);
+#endif
+
+/* Wait for the request being sent and complete the others with VOLTIRIS_MASTER_COM_ERROR */
+void voltirisMasterClose (VoltirisMaster* master);
+
+/* Queue a read of count registers from address of slave id */
+void voltirisMasterRead (VoltirisMaster* master, uint8_t id, uint16_t address, uint16_t count,
+                         uint32_t timeoutUs, VoltirisMasterCallback callback, void* user);
+
+/* Queue a write of count registers from address of slave id (id 0: all slaves, no response) */
+void voltirisMasterWrite (VoltirisMaster* master, uint8_t id, uint16_t address, const uint16_t* values,
+                          uint16_t count, uint32_t timeoutUs, VoltirisMasterCallback callback, void* user);
+
+/* Queue a command (size bytes without checksum) and give its response as it is, without
+   checksum (commands answered by another slave id or command, eg: discovery).
+   response == 0: no response expected */
+void voltirisMasterTransfer (VoltirisMaster* master, const uint8_t* data, uint16_t size, int response,
+                             uint32_t timeoutUs, VoltirisMasterCallback callback, void* user);
+
+/* Read count registers and wait for the result. data receives 2 * count bytes.
+   Return the status */
+int voltirisMasterReadSync (VoltirisMaster* master, uint8_t id, uint16_t address, uint16_t count,
+                            uint32_t timeoutUs, uint8_t* data);
+
+/* Wait until every queued request is complete */
+void voltirisMasterWait (VoltirisMaster* master);
+
+/* Silence between a response and the next request (in us) */
+void voltirisMasterSetTurnaround (VoltirisMaster* master, uint32_t turnaroundUs);
+
+#ifdef __cplusplus
+}
+#endif
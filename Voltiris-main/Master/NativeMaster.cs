@@ -0,0 +1,123 @@
+using System.Runtime.InteropServices;
+
+namespace Voltiris
+{
+    // Binding of the native master library ('Native' directory, libvoltiris-master.so
+    // or voltiris-master.dll). Requests are queued and sent back to back by the library,
+    // results are returned as tasks completed by the library thread.
+    // SerialCom uses it instead of SerialPort when the library is found.
+    public class NativeMaster : IDisposable
+    {
+        private const string Library = "voltiris-master";
+
+        [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+        private delegate void Callback (IntPtr user, int status, IntPtr data, ushort size);
+
+        [DllImport(Library)]
+        private static extern IntPtr voltirisMasterOpen (string portName, uint baudRate, int rtu);
+
+        [DllImport(Library)]
+        private static extern void voltirisMasterClose (IntPtr master);
+
+        [DllImport(Library)]
+        private static extern void voltirisMasterRead (IntPtr master, byte id, ushort address, ushort count,
+                                                       uint timeoutUs, Callback callback, IntPtr user);
+
+        [DllImport(Library)]
+        private static extern void voltirisMasterWrite (IntPtr master, byte id, ushort address, ushort[] values,
+                                                        ushort count, uint timeoutUs, Callback callback, IntPtr user);
+
+        [DllImport(Library)]
+        private static extern void voltirisMasterTransfer (IntPtr master, byte[] data, ushort size, int response,
+                                                           uint timeoutUs, Callback callback, IntPtr user);
+
+        [DllImport(Library)]
+        private static extern int voltirisMasterReadSync (IntPtr master, byte id, ushort address, ushort count,
+                                                          uint timeoutUs, byte[] data);
+
+        [DllImport(Library)]
+        private static extern void voltirisMasterWait (IntPtr master);
+
+        // Single delegate for every request (must stay alive while the library may call it)
+        private static readonly Callback callback = onComplete;
+
+        private IntPtr master;
+
+        public NativeMaster (string portName, FramingEnum framing, uint baudRate = 115200)
+        {
+            master = voltirisMasterOpen (portName, baudRate, framing == FramingEnum.Rtu ? 1 : 0);
+            if (master == IntPtr.Zero)
+                throw new Exception ("Cannot open serial port '" + portName + "'");
+        }
+
+        // Read count registers from address of slave id.
+        // Values are the bytes of the registers (big endian)
+        public Task<CommandsWebServer.Result> readRegisters (byte id, ushort address, ushort count, uint timeoutUs = 100000)
+        {
+            var completion = new TaskCompletionSource<CommandsWebServer.Result> (TaskCreationOptions.RunContinuationsAsynchronously);
+            voltirisMasterRead (master, id, address, count, timeoutUs, callback, GCHandle.ToIntPtr (GCHandle.Alloc (completion)));
+            return completion.Task;
+        }
+
+        // Write registers from address of slave id (id 0: all slaves, no response).
+        // Value is the number of registers written
+        public Task<CommandsWebServer.Result> writeRegisters (byte id, ushort address, ushort[] values, uint timeoutUs = 100000)
+        {
+            var completion = new TaskCompletionSource<CommandsWebServer.Result> (TaskCreationOptions.RunContinuationsAsynchronously);
+            voltirisMasterWrite (master, id, address, values, (ushort) values.Length, timeoutUs, callback, GCHandle.ToIntPtr (GCHandle.Alloc (completion)));
+            return completion.Task;
+        }
+
+        // Read count registers from address of slave id and wait for the result
+        // (no task: the calling thread is blocked)
+        public CommandsWebServer.Result readRegistersSync (byte id, ushort address, ushort count, uint timeoutUs = 100000)
+        {
+            var data = new byte [2 * count];
+            var result = new CommandsWebServer.Result ();
+            result.Status = (Commands.ResultType) voltirisMasterReadSync (master, id, address, count, timeoutUs, data);
+            if (result.Status == Commands.ResultType.Succeed)
+                foreach (var value in data)
+                    result.Values.Add (value);
+            return result;
+        }
+
+        // Send a command (without checksum) and give its response as it is (without checksum,
+        // Unknown if the checksum is wrong), for the commands answered by another slave id or
+        // command (eg: discovery). Without response, the task completes once the command is sent
+        public Task<CommandsWebServer.Result> transfer (byte[] data, bool response, uint timeoutUs = 100000)
+        {
+            var completion = new TaskCompletionSource<CommandsWebServer.Result> (TaskCreationOptions.RunContinuationsAsynchronously);
+            voltirisMasterTransfer (master, data, (ushort) data.Length, response ? 1 : 0, timeoutUs, callback, GCHandle.ToIntPtr (GCHandle.Alloc (completion)));
+            return completion.Task;
+        }
+
+        // Wait until every queued request is complete
+        public void wait ()
+        {
+            voltirisMasterWait (master);
+        }
+
+        public void Dispose ()
+        {
+            if (master == IntPtr.Zero)
+                return;
+            voltirisMasterClose (master);
+            master = IntPtr.Zero;
+        }
+
+        private static void onComplete (IntPtr user, int status, IntPtr data, ushort size)
+        {
+            var handle = GCHandle.FromIntPtr (user);
+            var completion = (TaskCompletionSource<CommandsWebServer.Result>) handle.Target!;
+            handle.Free ();
+
+            var result = new CommandsWebServer.Result { Status = (Commands.ResultType) status };
+            var values = new byte [size];
+            if (size > 0)
+                Marshal.Copy (data, values, 0, size);
+            foreach (var value in values)
+                result.Values.Add (value);
+            completion.SetResult (result);
+        }
+    }
+}
@@ -12,6 +12,13 @@ namespace Voltiris
     // For RS485, check Controlling the RTS and DTR pins of Serial Port using C#
     // https://www.xanthium.in/Serial-Programming-using-Csharp-on-Windows
 
+    // Framing of the packets on the serial line (must match the Slaves configuration)
+    public enum FramingEnum
+    {
+        Ascii, // ':' + hex characters + CRC8 + "\r\n"
+        Rtu    // Binary, CRC-16 and delimited by a silence
+    }
+
     public class SerialCom
     {
         // --- start of singleton implementation ---
@@ -29,8 +36,46 @@ namespace Voltiris
 
         private SerialPort serialPort = new SerialPort ();
 
+        // Native master library, owns the port instead of serialPort when it is found
+        private NativeMaster? nativeMaster = null;
+
+        // Command queued by Write () on the native master library, completed by Read ()
+        private Task<CommandsWebServer.Result>? pendingRequest = null;
+
         private readonly object serialLock = new object();
 
+        private FramingEnum framing = FramingEnum.Ascii;
+
+        public FramingEnum Framing
+        {
+            get { return framing; }
+            set
+            {
+                lock (serialLock)
+                {
+                    // The framing of the native master library is chosen when the port is opened
+                    bool reopen = nativeMaster != null && value != framing;
+                    framing = value;
+                    if (reopen)
+                    {
+                        nativeMaster!.Dispose ();
+                        nativeMaster = null;
+                        open (serialPort.PortName);
+                    }
+                }
+            }
+        }
+
+        // Time to wait for a response (ms)
+        public int ReadTimeout
+        {
+            get { lock (serialLock) return serialPort.ReadTimeout; }
+            set { lock (serialLock) serialPort.ReadTimeout = value; }
+        }
+
+        // Silence ending a RTU frame (1750us above 19200 bauds, rounded up)
+        private const int rtuSilenceMs = 2;
+
         private SerialCom ()
         {
             foreach (string s in SerialPort.GetPortNames())
@@ -55,10 +100,13 @@ namespace Voltiris
                     serialPort.ReadTimeout  = 100; //500; // !!!
                     serialPort.WriteTimeout = 500; // !!!
 
-                    serialPort.Open();
+                    if (!openNativeMaster ())
+                    {
+                        serialPort.Open();
 
-                    serialPort.DiscardOutBuffer ();
-                    serialPort.DiscardInBuffer ();
+                        serialPort.DiscardOutBuffer ();
+                        serialPort.DiscardInBuffer ();
+                    }
 
                     if (RuntimeInformation.IsOSPlatform(OSPlatform.OSX))
                     {
@@ -69,7 +117,8 @@ namespace Voltiris
                     else
                         Logger.Warning ("SerialPort initialization not tested on this platform");
 
-                    Logger.Information ("Serial port '" + serialPort.PortName + "' opened");
+                    Logger.Information ("Serial port '" + serialPort.PortName + "' opened" +
+                                        (nativeMaster != null ? " by the native master library" : ""));
                 }
                 catch (UnauthorizedAccessException e)
                 {
@@ -84,6 +133,111 @@ namespace Voltiris
             }
         }
 
+        // Open the port with the native master library (requests sent back to back
+        // by the library thread). Return false if the library is not found
+        private bool openNativeMaster ()
+        {
+            try {
+                nativeMaster = new NativeMaster (serialPort.PortName, Framing, (uint) serialPort.BaudRate);
+                return true;
+            }
+            catch (DllNotFoundException)
+            {
+                Logger.Information ("Native master library not found, using SerialPort");
+                return false;
+            }
+        }
+
+        // Queue a read of count registers from address on every slave of ids, sent back
+        // to back by the native master library. Return null without the library
+        public Task<CommandsWebServer.Result>[]? readRegisters (IEnumerable<int> ids, ushort address, ushort count)
+        {
+            lock (serialLock)
+            {
+                var master = nativeMaster;
+                if (master == null)
+                    return null;
+                uint timeoutUs = (uint) serialPort.ReadTimeout * 1000;
+                return ids.Select (id => master.readRegisters ((byte) id, address, count, timeoutUs)).ToArray ();
+            }
+        }
+
+        // Write a command using the selected framing.
+        // response: a response is expected (read by Read ())
+        public void Write (CommandData cmd, bool timeoutWarning = true, bool response = true)
+        {
+            if (nativeMaster != null)
+                WriteNative (cmd, response);
+            else if (Framing == FramingEnum.Rtu)
+                WriteRtu (cmd, timeoutWarning);
+            else
+                WriteAscii (cmd, timeoutWarning);
+        }
+
+        // Read a response using the selected framing.
+        // The buffer always ends with the CRC8 of the ASCII framing
+        public void Read (out List<byte> buffer)
+        {
+            if (nativeMaster != null)
+                ReadNative (out buffer);
+            else if (Framing == FramingEnum.Rtu)
+                ReadRtu (out buffer);
+            else
+                ReadAscii (out buffer);
+        }
+
+        // Queue the command (without its CRC8) on the native master library
+        public void WriteNative (CommandData cmd, bool response)
+        {
+            lock (serialLock)
+            {
+                if (nativeMaster == null)
+                    throw new Exception ("Serial port is not open");
+
+                var frame = cmd.data.GetRange (0, cmd.data.Count - 1).ToArray ();
+                Console.WriteLine ("WRITE: "+ BitConverter.ToString(frame).Replace("-",""));
+                var request = nativeMaster.transfer (frame, response, (uint) serialPort.ReadTimeout * 1000);
+                pendingRequest = response ? request : null;
+            }
+        }
+
+        // Wait for the response of the command queued by WriteNative ().
+        // As in ReadRtu (), the buffer ends with a CRC8 (empty if the checksum is wrong)
+        public void ReadNative (out List<byte> buffer)
+        {
+            buffer = new List<byte> ();
+
+            Task<CommandsWebServer.Result>? request;
+            lock (serialLock)
+            {
+                request = pendingRequest;
+                pendingRequest = null;
+            }
+            if (request == null)
+                throw new Exception ("No command written");
+
+            var result = request.Result;
+            switch (result.Status)
+            {
+                case Commands.ResultType.ComTimeout:
+                    Logger.Warning ("Timeout during read operation");
+                    throw new TimeoutException ();
+                case Commands.ResultType.ComError:
+                    Logger.Critical ("Serial port error");
+                    throw new Exception ("Serial port error");
+                case Commands.ResultType.Succeed:
+                    byte crc8 = 0;
+                    foreach (var value in result.Values)
+                    {
+                        buffer.Add ((byte) value);
+                        crc8 += (byte) value;
+                    }
+                    buffer.Add (crc8);
+                    break;
+            }
+            Console.WriteLine ("READ: "+ BitConverter.ToString(buffer.ToArray ()).Replace("-",""));
+        }
+
         public void WriteAscii (CommandData cmd, bool timeoutWarning = true)
         {
             lock (serialLock)
@@ -116,6 +270,105 @@ namespace Voltiris
             }
         }
 
+        // CRC-16 of the Modbus RTU framing
+        public static ushort crc16 (IList<byte> data, int count)
+        {
+            ushort crc = 0xffff;
+            for (var i = 0; i < count; i++)
+            {
+                crc ^= data[i];
+                for (var bit = 0; bit < 8; bit++)
+                    crc = (ushort) ((crc & 1) != 0 ? (crc >> 1) ^ 0xa001 : crc >> 1);
+            }
+            return crc;
+        }
+
+        // Command data ends with a CRC8 (see CommandData.addCRC8 ())
+        // It is replaced by the CRC-16, low byte first
+        public void WriteRtu (CommandData cmd, bool timeoutWarning = true)
+        {
+            lock (serialLock)
+            {
+                if (!serialPort.IsOpen)
+                    throw new Exception ("Serial port is not open");
+
+                try {
+                    var frame = cmd.data.GetRange (0, cmd.data.Count - 1);
+                    ushort crc = crc16 (frame, frame.Count);
+                    frame.Add ((byte) (crc & 0xff));
+                    frame.Add ((byte) (crc >> 8));
+                    Console.WriteLine ("WRITE: "+ BitConverter.ToString(frame.ToArray ()).Replace("-",""));
+                    serialPort.Write (frame.ToArray (), 0, frame.Count);
+                }
+                catch (InvalidOperationException e) // The specified port is not open.
+                {
+                    serialPort.Close ();
+                    Logger.Critical ("Serial port disconnection: " + e.ToString ());
+                    throw;
+                }
+                catch (TimeoutException) // The operation did not complete before the time-out period ended.
+                {
+                    if (timeoutWarning)
+                        Logger.Warning ("Timeout during write operation");
+                    throw;
+                }
+            }
+        }
+
+        // Read a frame until the line is silent. The CRC-16 is verified and
+        // replaced by a CRC8 so that responses can be matched as in ASCII.
+        public void ReadRtu (out List<byte> buffer)
+        {
+            buffer = new List<byte> ();
+
+            lock (serialLock)
+            {
+                if (!serialPort.IsOpen)
+                    throw new Exception ("Serial port is not open");
+
+                try {
+                    var frame = new List<byte> ();
+                    frame.Add ((byte) serialPort.ReadByte ());
+
+                    var readTimeout = serialPort.ReadTimeout;
+                    try {
+                        serialPort.ReadTimeout = rtuSilenceMs;
+                        while (true)
+                            frame.Add ((byte) serialPort.ReadByte ());
+                    }
+                    catch (TimeoutException) {} // End of frame
+                    finally {
+                        serialPort.ReadTimeout = readTimeout;
+                    }
+
+                    Console.WriteLine ("READ: "+ BitConverter.ToString(frame.ToArray ()).Replace("-",""));
+
+                    int crcIndex = frame.Count - 2;
+                    if (crcIndex >= 2 && crc16 (frame, crcIndex) == (ushort) (frame[crcIndex] | frame[crcIndex + 1] << 8))
+                    {
+                        byte crc8 = 0;
+                        for (var i = 0; i < crcIndex; i++)
+                        {
+                            buffer.Add (frame[i]);
+                            crc8 += frame[i];
+                        }
+                        buffer.Add (crc8);
+                    }
+                }
+                catch (InvalidOperationException e) // The specified port is not open.
+                {
+                    serialPort.Close ();
+                    Logger.Critical ("Serial port disconnection: " + e.ToString ());
+                    throw;
+                }
+                catch (TimeoutException) // The operation did not complete before the time-out period ended.
+                {
+                    Logger.Warning ("Timeout during read operation");
+                    throw;
+                }
+            }
+        }
+
         public static byte toByte (char c)
         {
             if (c >= '0' && c <= '9')
@@ -16,6 +16,12 @@ namespace Voltiris
         }
 
         public string SerialPortName {get; set;} = "";
+
+        [JsonConverter(typeof(JsonStringEnumConverter))]
+        public FramingEnum Framing {
+            get { return SerialCom.Instance.Framing; }
+            set { SerialCom.Instance.Framing = value; }
+        }
     }
 
     // An instance of this class is created by web engine
@@ -115,6 +121,32 @@ namespace Voltiris
             return settings.LogLevel.ToString ();
         }
 
+        [ResourceMethod("framings")]
+        public List<string> GetFramings() // http://localhost:8080/settings/framings --> ["Ascii","Rtu"]
+        {
+            var list = (from action in (FramingEnum[]) Enum.GetValues(typeof(FramingEnum)) select action.ToString()).ToList();
+            return list;
+        }
+
+        [ResourceMethod("getFraming")]
+        public string GetFraming() // http://localhost:8080/settings/getFraming --> Ascii
+        {
+            return settings.Framing.ToString();
+        }
+
+        [ResourceMethod("setFraming")]
+        public string SetFraming(string framing) // http://localhost:8080/settings/setFraming?framing=Rtu --> Rtu
+        {
+            if (Enum.TryParse(framing, out FramingEnum newFraming))
+            {
+                settings.Framing = newFraming;
+                save ();
+            }
+            else
+                Logger.Error ("Invalid framing value '" + framing + "'");
+            return settings.Framing.ToString();
+        }
+
         [ResourceMethod("getLogs")]
         public List<Logger.LogItem> GetLogs() // http://localhost:8080/settings/getLogs --> [{"date":"2023-06-28 16:58:17.655","logLevel":2,"description":"Voltiris.log is created."} ...
         {
@@ -66,6 +66,49 @@ function setupSerialPortName()
   });
 }
 
+// ------------------------------------------------------------
+// Retrieve the current framing, display dropdown and update it
+// ------------------------------------------------------------
+
+function setupFramingDropDown()
+{
+  let framingDropDown = document.getElementById('framingDropDown');
+
+  // Remove any existing options
+  while (framingDropDown.firstChild)
+    framingDropDown.firstChild.remove();
+
+  fetch("http://localhost:8080/settings/getFraming")
+  .then((response) => response.text())
+  .then((currentFraming) =>
+  {
+    fetch("http://localhost:8080/settings/framings")
+    .then((response) => response.json())
+    .then((json) => 
+    {
+      json.forEach(function(optionText) 
+      {
+        let newOption = document.createElement('option');
+        newOption.text = optionText;
+        newOption.value = optionText;
+        newOption.selected = (optionText == currentFraming);
+        framingDropDown.add(newOption);
+      })
+    });
+  });
+
+  framingDropDown.addEventListener('change', function(e) 
+  {
+    let selectedOption = e.target.value;
+    fetch(`http://localhost:8080/settings/setFraming?framing=${selectedOption}`)
+    .then((response) => response.text())
+    .then((currentFraming) => {
+      if (currentFraming != selectedOption)
+        console.error (`Cannot change framing to: ${selectedOption}`);
+      });
+  });
+}
+
 // ------------------------------------------------------------
 // Retrieve logs and display them
 // ------------------------------------------------------------
@@ -59,9 +59,28 @@ class UnitTest {
 let tests = [];
 
 // -----------------------------------------------------------------
-// Retrieve connected devices (required for later tests)
+// Assign ids from the serial numbers, then retrieve connected
+// devices (required for later tests)
 // -----------------------------------------------------------------
 
+tests.push (new UnitTest('Discover devices from their serial numbers', async function() {
+
+    const url = `discoverSlaves`;
+
+    this.log (`Executing command '${url}'`, UnitTestStatus.Info);
+    return this.fetchJson (url)
+        .then ((json) => {
+            if (json.values.length == 0)
+                throw new Error (`No device discovered`);
+            // Ids are assigned from 1
+            json.values.forEach ((val, index) => {
+                if (val != index + 1)
+                    throw new Error (`Expected id ${index + 1}, got ${val}`);
+            });
+            this.log (`${json.values.length} device(s) discovered`, UnitTestStatus.Info);
+        });
+}));
+
 let connectedDevice = 1;
 
 tests.push (new UnitTest('Retrieve connected devices', async function() {
@@ -159,6 +178,96 @@ tests.push (new UnitTest(`Read the ${expectedOptions} Options of current device`
     return promise;
 }));
 
+tests.push (new UnitTest(`Compare binary and JSON option descriptors`, async function() {
+
+    let promise = Promise.resolve();
+
+    for (let i = 0; i < expectedOptions; i++)
+        promise = promise.then (() => getOptionInformation (this, i))
+                        .then (() => this.fetchJson (`getOptionDescriptor?id=${connectedDevice}&optIndex=${i}`))
+                        .then ((json) => {
+                            const d = json.values;
+                            const name = String.fromCharCode.apply (null, d.slice (13, 13 + d[12]));
+                            const address = d[4] << 8 | d[5];
+                            this.log (`Binary descriptor ${i}: '${name}' at address ${address}`, UnitTestStatus.Info);
+                            if (name != this.objJson.name || address != this.objJson.address || d[2] != this.objJson.dim)
+                                throw new Error (`Binary descriptor of option ${i} does not match the JSON one`);
+                        });
+
+    return promise;
+}));
+
+tests.push (new UnitTest(`Read all binary option descriptors at once`, async function() {
+
+    return this.fetchJson (`getOptionDescriptors?id=${connectedDevice}`)
+        .then ((json) => {
+            const d = json.values;
+            let count = 0;
+            for (let i = 0; i < d.length; i += 13 + d[i + 12])
+            {
+                const name = String.fromCharCode.apply (null, d.slice (i + 13, i + 13 + d[i + 12]));
+                this.log (`Binary descriptor ${count}: '${name}'`, UnitTestStatus.Info);
+                count++;
+            }
+            if (count != expectedOptions)
+                throw new Error (`Expecting ${expectedOptions} options, got ${count}`);
+        });
+}));
+
+tests.push (new UnitTest(`Reset and read health counters`, async function() {
+
+    const address = 0x1c0;
+    const count = 15;
+    const urlReset = `setRegister?id=${connectedDevice}&address=${address}&value=0`;
+    const urlRead  = `getRegisters?id=${connectedDevice}&address=${address}&count=${count}`;
+
+    return this.fetchJson (urlReset)
+        .then (() => this.fetchJson (urlRead))
+        .then ((jsonRead) => {
+            this.log (`Counters: ${jsonRead.values}`, UnitTestStatus.Info);
+            if (jsonRead.values.length != count)
+                throw new Error (`Was expecting ${count} counters but found ${jsonRead.values.length}`);
+            // Only the read request itself is counted since the reset
+            if (jsonRead.values [0] != 1)
+                throw new Error (`Was expecting 1 frame received but found ${jsonRead.values [0]}`);
+        });
+}));
+
+tests.push (new UnitTest(`Read the frame trace`, async function() {
+
+    const entrySize = 12;
+    const urlSnapshot = `getRegister?id=${connectedDevice}&address=${0xb0}`;
+
+    return this.fetchJson (urlSnapshot)
+        .then ((jsonSnapshot) => {
+            const size = jsonSnapshot.values [0];
+            this.log (`Trace of ${size / entrySize} frames`, UnitTestStatus.Info);
+            if (size == 0 || size % entrySize != 0)
+                throw new Error (`Unexpected trace size ${size}`);
+            return this.fetchJson (`readMemory?id=${connectedDevice}&address=0&size=${size}`);
+        })
+        .then ((jsonRead) => {
+            // Last entry: the last frame processed before the snapshot
+            const last = jsonRead.values.slice (-entrySize);
+            this.log (`Last frame: outcome ${last [10]}, command ${last [11]}`, UnitTestStatus.Info);
+        });
+}));
+
+tests.push (new UnitTest(`Read the firmware update status`, async function() {
+
+    const urlStatus = `getRegisters?id=${connectedDevice}&address=${0xc2}&count=4`;
+    const urlBitmap = `getRegisters?id=${connectedDevice}&address=${0xc8}&count=8`;
+
+    return this.fetchJson (urlStatus)
+        .then ((jsonStatus) => {
+            const [state, blocks, missing, crc] = jsonStatus.values;
+            this.log (`State ${state}, ${blocks} blocks, ${missing} missing, image CRC ${crc}`, UnitTestStatus.Info);
+            if (state > 3 || missing > blocks)
+                throw new Error (`Unexpected update status ${jsonStatus.values}`);
+            return this.fetchJson (urlBitmap);
+        });
+}));
+
 tests.push (new UnitTest(`Read / write in memory`, async function() {
 
     let data = new Uint8Array (128);
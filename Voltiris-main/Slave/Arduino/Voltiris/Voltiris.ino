@@ -18,18 +18,9 @@
 
   void loop() {
 
-    while (1)
-    {
-      switch (voltiris::processIncomingSerialData (sp))
-      {
-        case voltiris::SERIAL_BUFFER_OVERFLOW: // Junk data in buffer
-        case 0: // No data available
-          delay (10);
-          break;
-        default: // Some characters have been processed
-          break;
-      }
-    }
+    // Sleep until a character is received (or a RTU frame ends)
+    // and process incoming data
+    voltiris::processSerialEvents (sp);
   }
 
 #endif
@@ -5,6 +5,9 @@
     #include "vltFirmware.hpp"
 
     #include <Arduino.h>
+    #ifdef __AVR__
+        #include <avr/eeprom.h>
+    #endif
 
     long random(long);
 
@@ -51,6 +54,15 @@
             return serial;
         }
 
+        // -------------------------------------------------
+        // Get a monotonic time in microseconds
+        // -------------------------------------------------
+
+        uint32 getMicroseconds ()
+        {
+            return (uint32) ::micros ();
+        }
+
         // -------------------------------------------------
         // Get a random number between 0 and 0xff
         // -------------------------------------------------
@@ -60,28 +72,86 @@
             return (uint8) ::random (0xff);
         }
 
+        // -------------------------------------------------
+        // Firmware update staging
+        // -------------------------------------------------
+
+        // The test board has no staging area (the application cannot program its
+        // own flash on an Arduino UNO): every update ends in UPDATE_FAILED.
+        // A product stages the image in an external flash and lets its
+        // bootloader install it on activateUpdate ()
+
+        bool beginUpdateStaging (uint32 imageSize)
+        {
+            return false;
+        }
+
+        bool writeUpdateStaging (uint32 offset, const uint8* data, uint16 size)
+        {
+            return false;
+        }
+
+        bool readUpdateStaging (uint32 offset, uint8* data, uint16 size)
+        {
+            return false;
+        }
+
+        void activateUpdate (uint32 imageSize)
+        {
+        }
+
+        // -------------------------------------------------
+        // Option storage in the EEPROM
+        // -------------------------------------------------
+
+    #ifdef __AVR__
+
+        // A byte takes about 3.4ms to program: writeStorage () starts it and
+        // returns, the next byte waits for the end of the write
+
+        uint16 getStorageSize ()
+        {
+            return E2END + 1;
+        }
+
+        void readStorage (uint16 offset, uint8* data, uint16 size)
+        {
+            eeprom_read_block (data, (const void*) offset, size);
+        }
+
+        bool writeStorage (uint16 offset, uint8 value)
+        {
+            if (!eeprom_is_ready ())
+                return false;
+            eeprom_update_byte ((uint8*) offset, value);
+            return true;
+        }
+
+    #else
+
+        // No storage on other boards: options are not persisted
+
+        uint16 getStorageSize ()
+        {
+            return 0;
+        }
+
+        void readStorage (uint16 offset, uint8* data, uint16 size)
+        {
+            memset (data, 0xff, size);
+        }
+
+        bool writeStorage (uint16 offset, uint8 value)
+        {
+            return true;
+        }
+
+    #endif
+
         // ---------------
         // Options section
         // ---------------
     
-        static Option optPosition_b1;
-        static Option optPosition_b2;
-        static Option optSpeed_Levels_b1;
-        static Option optSpeed_Levels_b2;
-        static Option optVthresh_b1;
-        static Option optVthresh_b2;
-        static Option optRescale_b1;
-        static Option optRescale_b2;
-        
-        static Option::Value valPositionsB1 [2];
-        static Option::Value valPositionsB2 [2];
-        static Option::Value valSpeedLevelsB1 [4];
-        static Option::Value valSpeedLevelsB2 [4];
-        static Option::Value valVthreshB1 [4];
-        static Option::Value valVthreshB2 [4];
-        static Option::Value valRescaleB1 [2];
-        static Option::Value valRescaleB2 [2];
-
         static inline void setUint16ValueWithChecks (const Option& option, const Option::Value in, Option::Value& out)
         {
             if (in.UINT_16 < option.min.UINT_16)
@@ -123,14 +193,14 @@
             }
         }
 
-        static Option::Value get (Option& option, uint16 index)
+        static Option::Value get (const Option& option, uint16 index)
         {
             assert (option.userData != NULL);
             Option::Value* values = (Option::Value*) option.userData;
             return values [index];
         }
 
-        static bool set (Option& option, uint16 index, Option::Value value)
+        static bool set (const Option& option, uint16 index, Option::Value value)
         {
             assert (option.userData != NULL);
             Option::Value* values = (Option::Value*) option.userData;
@@ -138,46 +208,98 @@
             return true;
         }
 
-        Option::Value getPosition (Option& option, uint16 index)
+        Option::Value getPosition (const Option& option, uint16 index)
         {
             return get (option, index);
         }
 
-        bool setPosition (Option& option, uint16 index, Option::Value value)
+        bool setPosition (const Option& option, uint16 index, Option::Value value)
         {
             return set (option, index, value);
         }
 
-        Option::Value getSpeed (Option& option, uint16 index)
+        Option::Value getSpeed (const Option& option, uint16 index)
         {
             return get (option, index);
         }
 
-        bool setSpeed (Option& option, uint16 index, Option::Value value)
+        bool setSpeed (const Option& option, uint16 index, Option::Value value)
         {
             return set (option, index, value);
         } 
 
-        Option::Value getVThresh (Option& option, uint16 index)
+        Option::Value getVThresh (const Option& option, uint16 index)
         {
             return get (option, index);
         }
 
-        bool setVThresh (Option& option, uint16 index, Option::Value value)
+        bool setVThresh (const Option& option, uint16 index, Option::Value value)
         {
             return set (option, index, value);
         }
 
-        Option::Value getRescale (Option& option, uint16 index)
+        Option::Value getRescale (const Option& option, uint16 index)
         {
             return get (option, index);
         }
 
-        bool setRescale (Option& option, uint16 index, Option::Value value)
+        bool setRescale (const Option& option, uint16 index, Option::Value value)
         {
             return set (option, index, value);
         } 
 
+        // Effective values of the options (initialized to min)
+        static Option::Value valPositionsB1 [2] = {(uint16) 0, (uint16) 0};
+        static Option::Value valPositionsB2 [2] = {(uint16) 0, (uint16) 0};
+        static Option::Value valSpeedLevelsB1 [4] = {(uint16) 0, (uint16) 0, (uint16) 0, (uint16) 0};
+        static Option::Value valSpeedLevelsB2 [4] = {(uint16) 0, (uint16) 0, (uint16) 0, (uint16) 0};
+        static Option::Value valVthreshB1 [4] = {(int16) -250, (int16) -250, (int16) -250, (int16) -250};
+        static Option::Value valVthreshB2 [4] = {(int16) -250, (int16) -250, (int16) -250, (int16) -250};
+        static Option::Value valRescaleB1 [2] = {(uint16) 0, (uint16) 0};
+        static Option::Value valRescaleB2 [2] = {(uint16) 0, (uint16) 0};
+
+        // Option descriptors, computed at compile time and stored in flash
+
+        static constexpr char namePosition_b1 [] VOLTIRIS_PROGMEM = "Position_b1";
+        static constexpr char namePosition_b2 [] VOLTIRIS_PROGMEM = "Position_b2";
+        static constexpr char nameSpeed_Levels_b1 [] VOLTIRIS_PROGMEM = "Speed_Levels_b1";
+        static constexpr char nameSpeed_Levels_b2 [] VOLTIRIS_PROGMEM = "Speed_Levels_b2";
+        static constexpr char nameVthresh_b1 [] VOLTIRIS_PROGMEM = "Vthresh_b1";
+        static constexpr char nameVthresh_b2 [] VOLTIRIS_PROGMEM = "Vthresh_b2";
+        static constexpr char nameRescale_b1 [] VOLTIRIS_PROGMEM = "Rescale_b1";
+        static constexpr char nameRescale_b2 [] VOLTIRIS_PROGMEM = "Rescale_b2";
+
+        typedef TypedOption<uint16, Option::DIM_2, Option::MILLIMETERS> PositionOption;
+        typedef TypedOption<uint16, Option::DIM_4, Option::MM_PER_SEC> SpeedOption;
+        typedef TypedOption<int16, Option::DIM_4, Option::VOLTS> VThreshOption;
+        typedef TypedOption<uint16, Option::DIM_2, Option::NO_UNIT> RescaleOption;
+
+        static constexpr Option optPosition_b1 VOLTIRIS_PROGMEM = PositionOption::make (
+            namePosition_b1, 0, 6000, 10, false, getPosition, setPosition, valPositionsB1, OPTIONS_ADDRESS_START);
+        static constexpr Option optPosition_b2 VOLTIRIS_PROGMEM = PositionOption::make (
+            namePosition_b2, 0, 6000, 10, false, getPosition, setPosition, valPositionsB2, nextOptionAddress (optPosition_b1));
+        static constexpr Option optSpeed_Levels_b1 VOLTIRIS_PROGMEM = SpeedOption::make (
+            nameSpeed_Levels_b1, 0, 990, 10, true, getSpeed, setSpeed, valSpeedLevelsB1, nextOptionAddress (optPosition_b2));
+        static constexpr Option optSpeed_Levels_b2 VOLTIRIS_PROGMEM = SpeedOption::make (
+            nameSpeed_Levels_b2, 0, 990, 10, true, getSpeed, setSpeed, valSpeedLevelsB2, nextOptionAddress (optSpeed_Levels_b1));
+        static constexpr Option optVthresh_b1 VOLTIRIS_PROGMEM = VThreshOption::make (
+            nameVthresh_b1, -250, 250, 10, true, getVThresh, setVThresh, valVthreshB1, nextOptionAddress (optSpeed_Levels_b2));
+        static constexpr Option optVthresh_b2 VOLTIRIS_PROGMEM = VThreshOption::make (
+            nameVthresh_b2, -250, 250, 10, true, getVThresh, setVThresh, valVthreshB2, nextOptionAddress (optVthresh_b1));
+        static constexpr Option optRescale_b1 VOLTIRIS_PROGMEM = RescaleOption::make (
+            nameRescale_b1, 0, 1000, 100, true, getRescale, setRescale, valRescaleB1, nextOptionAddress (optVthresh_b2));
+        static constexpr Option optRescale_b2 VOLTIRIS_PROGMEM = RescaleOption::make (
+            nameRescale_b2, 0, 1000, 100, true, getRescale, setRescale, valRescaleB2, nextOptionAddress (optRescale_b1));
+
+        static constexpr const Option* optionTable [] VOLTIRIS_PROGMEM =
+        {
+            &optPosition_b1, &optPosition_b2,
+            &optSpeed_Levels_b1, &optSpeed_Levels_b2,
+            &optVthresh_b1, &optVthresh_b2,
+            &optRescale_b1, &optRescale_b2
+        };
+        static_assert (isOptionTableValid (optionTable), "Options must follow each other (see nextOptionAddress ())");
+
         // -------------------------------------------------
         // Is called during initialization to perform custom setup
         // -------------------------------------------------
@@ -187,79 +309,8 @@
             // Set the slave to one for debug convenience!
             configuration.slaveId = 1;
             
-            // Initialize options
-
-            optPosition_b1.init ("Position_b1", (uint16) 0, (uint16) 6000, (uint16) 10, Option::Dimension::DIM_2, Option::Unit::MILLIMETERS, false);
-            optPosition_b1.setValue = setPosition;
-            optPosition_b1.getValue = getPosition;
-            optPosition_b1.userData = (void*) valPositionsB1;
-            valPositionsB1[0].UINT_16 = optPosition_b1.min.UINT_16;
-            valPositionsB1[1].UINT_16 = optPosition_b1.min.UINT_16;
-            assert (addOption (optPosition_b1));
-
-            optPosition_b2.init ("Position_b2", (uint16) 0, (uint16) 6000, (uint16) 10, Option::Dimension::DIM_2, Option::Unit::MILLIMETERS, false);
-            optPosition_b2.setValue = setPosition;
-            optPosition_b2.getValue = getPosition;
-            optPosition_b2.userData = (void*) valPositionsB2;
-            valPositionsB2[0].UINT_16 = optPosition_b2.min.UINT_16;
-            valPositionsB2[1].UINT_16 = optPosition_b2.min.UINT_16;
-            assert (addOption (optPosition_b2));
-
-            optSpeed_Levels_b1.init ("Speed_Levels_b1", (uint16) 0, (uint16) 990, (uint16) 10, Option::Dimension::DIM_4, Option::Unit::MM_PER_SEC, true);
-            optSpeed_Levels_b1.setValue = setSpeed;
-            optSpeed_Levels_b1.getValue = getSpeed;
-            optSpeed_Levels_b1.userData = (void*) valSpeedLevelsB1;
-            valSpeedLevelsB1[0].UINT_16 = optSpeed_Levels_b1.min.UINT_16;
-            valSpeedLevelsB1[1].UINT_16 = optSpeed_Levels_b1.min.UINT_16;
-            valSpeedLevelsB1[2].UINT_16 = optSpeed_Levels_b1.min.UINT_16;
-            valSpeedLevelsB1[3].UINT_16 = optSpeed_Levels_b1.min.UINT_16;
-            assert (addOption (optSpeed_Levels_b1));
-
-            optSpeed_Levels_b2.init ("Speed_Levels_b2", (uint16) 0, (uint16) 990, (uint16) 10, Option::Dimension::DIM_4, Option::Unit::MM_PER_SEC, true);
-            optSpeed_Levels_b2.setValue = setSpeed;
-            optSpeed_Levels_b2.getValue = getSpeed;
-            optSpeed_Levels_b2.userData = (void*) valSpeedLevelsB2;
-            valSpeedLevelsB2[0].UINT_16 = optSpeed_Levels_b2.min.UINT_16;
-            valSpeedLevelsB2[1].UINT_16 = optSpeed_Levels_b2.min.UINT_16;
-            valSpeedLevelsB2[2].UINT_16 = optSpeed_Levels_b2.min.UINT_16;
-            valSpeedLevelsB2[3].UINT_16 = optSpeed_Levels_b2.min.UINT_16;
-            assert (addOption (optSpeed_Levels_b2));
-
-            optVthresh_b1.init ("Vthresh_b1", (int16) -250, (int16) 250, (int16) 10, Option::Dimension::DIM_4, Option::Unit::VOLTS, true);
-            optVthresh_b1.setValue = setVThresh;
-            optVthresh_b1.getValue = getVThresh;
-            optVthresh_b1.userData = (void*) valVthreshB1;
-            valVthreshB1[0].INT_16 = optVthresh_b1.min.INT_16;
-            valVthreshB1[1].INT_16 = optVthresh_b1.min.INT_16;
-            valVthreshB1[2].INT_16 = optVthresh_b1.min.INT_16;
-            valVthreshB1[3].INT_16 = optVthresh_b1.min.INT_16;
-            assert (addOption (optVthresh_b1));
-
-            optVthresh_b2.init ("Vthresh_b2", (int16) -250, (int16) 250, (int16) 10, Option::Dimension::DIM_4, Option::Unit::VOLTS, true);
-            optVthresh_b2.setValue = setVThresh;
-            optVthresh_b2.getValue = getVThresh;
-            optVthresh_b2.userData = (void*) valVthreshB2;
-            valVthreshB2[0].INT_16 = optVthresh_b2.min.INT_16;
-            valVthreshB2[1].INT_16 = optVthresh_b2.min.INT_16;
-            valVthreshB2[2].INT_16 = optVthresh_b2.min.INT_16;
-            valVthreshB2[3].INT_16 = optVthresh_b2.min.INT_16;
-            assert (addOption (optVthresh_b2));
-
-            optRescale_b1.init ("Rescale_b1", (uint16) 0, (uint16) 1000, (uint16) 100, Option::Dimension::DIM_2, Option::Unit::NO_UNIT, true);
-            optRescale_b1.setValue = setRescale;
-            optRescale_b1.getValue = getRescale;
-            optRescale_b1.userData = (void*) valRescaleB1;
-            valRescaleB1[0].UINT_16 = optRescale_b1.min.UINT_16;
-            valRescaleB1[1].UINT_16 = optRescale_b1.min.UINT_16;
-            assert (addOption (optRescale_b1));
-
-            optRescale_b2.init ("Rescale_b2", (uint16) 0, (uint16) 1000, (uint16) 100, Option::Dimension::DIM_2, Option::Unit::NO_UNIT, true);
-            optRescale_b2.setValue = setRescale;
-            optRescale_b2.getValue = getRescale;
-            optRescale_b2.userData = (void*) valRescaleB2;
-            valRescaleB2[0].UINT_16 = optRescale_b2.min.UINT_16;
-            valRescaleB2[1].UINT_16 = optRescale_b2.min.UINT_16;
-            assert (addOption (optRescale_b2));
+            // Option layout is checked at compile time (see optionTable)
+            assert (setOptions (optionTable));
         }
     }
 
@@ -2,39 +2,240 @@
 
     #include "ardSerial.hpp"
 
-    // Arduino documentation on serial port:
-    // https://www.arduino.cc/reference/en/language/functions/communication/serial/
+    #ifdef __AVR__
 
-    namespace voltiris
-    {
-        static ArduinoSerialPort serial;
+        #include <avr/interrupt.h>
+        #include <avr/sleep.h>
 
-        SerialPort* serialInit ()
+        // Idle sleep until the next interrupt: the USART keeps receiving, a
+        // character (or the timer 0 tick of millis (), every 1.024ms) wakes the CPU.
+        // Interrupts are enabled again right before sleeping so that a
+        // character received after the check still wakes the CPU.
+        #define VOLTIRIS_IDLE(condition) \
+            do { \
+                set_sleep_mode (SLEEP_MODE_IDLE); \
+                cli (); \
+                if (condition) \
+                { \
+                    sleep_enable (); \
+                    sei (); \
+                    sleep_cpu (); \
+                    sleep_disable (); \
+                } \
+                sei (); \
+            } while (0)
+
+    #else
+
+        #define VOLTIRIS_IDLE(condition) yield ()
+
+    #endif
+
+    #if VOLTIRIS_RING_SERIAL
+
+        // Interrupt-driven backend: the USART0 receive interrupt fills rxRing,
+        // the data register empty interrupt sends txRing.
+        // See "USART0" chapter of the ATmega328P / ATmega2560 datasheets.
+
+        namespace voltiris
         {
-            ::Serial.begin(115200);
-            while (!::Serial)
-                delay (10); // wait for serial port to connect. Needed for native USB
+            static RingBuffer<SERIAL_RX_RING_SIZE> rxRing;
+            static RingBuffer<SERIAL_TX_RING_SIZE> txRing;
 
-            return (SerialPort*) &serial; 
+            // Bit i: the character of slot i of rxRing was received after a
+            // silence of RTU_SILENCE_US (written by the interrupt before the push)
+            static volatile uint8 rxSilence [(SERIAL_RX_RING_SIZE + 7) / 8];
+            static volatile uint32 rxLastTime = 0;
+
+            static inline bool isSilenceBefore (uint8 slot)
+            {
+                return (rxSilence [slot >> 3] >> (slot & 7)) & 1;
+            }
         }
 
-        int serialRead (SerialPort* sp)
+        #if defined(USART_RX_vect)
+            #define VOLTIRIS_USART_RX_vect   USART_RX_vect
+            #define VOLTIRIS_USART_UDRE_vect USART_UDRE_vect
+        #else
+            #define VOLTIRIS_USART_RX_vect   USART0_RX_vect
+            #define VOLTIRIS_USART_UDRE_vect USART0_UDRE_vect
+        #endif
+
+        ISR (VOLTIRIS_USART_RX_vect)
         {
-            assert (sp != NULL);
-            return ::Serial.read();
+            uint8_t c = UDR0;
+            uint32_t now = ::micros ();
+            uint8_t slot = voltiris::rxRing.head;
+            uint8_t bit = (uint8_t) (1 << (slot & 7));
+            if (now - voltiris::rxLastTime >= voltiris::RTU_SILENCE_US)
+                voltiris::rxSilence [slot >> 3] |= bit;
+            else
+                voltiris::rxSilence [slot >> 3] &= (uint8_t) ~bit;
+            voltiris::rxLastTime = now;
+            voltiris::rxRing.push (c); // Dropped if the ring is full
         }
 
-        int serialAvailable (SerialPort* sp)
+        ISR (VOLTIRIS_USART_UDRE_vect)
         {
-            assert (sp != NULL);
-            return ::Serial.available();
+            uint8_t c;
+            if (voltiris::txRing.pop (c))
+                UDR0 = c;
+            else
+                UCSR0B &= ~_BV (UDRIE0); // Nothing left to send
+        }
+
+        namespace voltiris
+        {
+            static ArduinoSerialPort serial;
+
+            SerialPort* serialInit ()
+            {
+                // Double speed mode, same baud rate computation as the Arduino core
+                uint16 ubrr = (F_CPU / 4 / SERIAL_BAUD_RATE - 1) / 2;
+                UCSR0A = _BV (U2X0);
+                UBRR0H = (uint8) (ubrr >> 8);
+                UBRR0L = (uint8) (ubrr & 0xff);
+                UCSR0C = _BV (UCSZ01) | _BV (UCSZ00); // 8 data bits, no parity, 1 stop bit
+                UCSR0B = _BV (RXEN0) | _BV (TXEN0) | _BV (RXCIE0);
+
+                return (SerialPort*) &serial; 
+            }
+
+            int serialRead (SerialPort* sp)
+            {
+                assert (sp != NULL);
+                uint8 c;
+                if (!rxRing.pop (c))
+                    return SERIAL_NO_CHARACTER_AVAILABLE;
+                return c;
+            }
+
+            int serialAvailable (SerialPort* sp)
+            {
+                assert (sp != NULL);
+                return (int) rxRing.size ();
+            }
+
+            int serialWait (SerialPort* sp, long timeoutUs)
+            {
+                assert (sp != NULL);
+                uint32 start = ::micros ();
+                while (rxRing.size () == 0)
+                {
+                    if (timeoutUs >= 0 && ::micros () - start >= (uint32) timeoutUs)
+                        return 0;
+                    VOLTIRIS_IDLE (rxRing.size () == 0);
+                }
+                return (int) rxRing.size ();
+            }
+
+            int serialReadBlock (SerialPort* sp, uint8* buffer, uint16 bufferCapacity, bool& silence)
+            {
+                assert (sp != NULL);
+                silence = rxRing.size () != 0 && isSilenceBefore (rxRing.tail);
+                uint16 count = 0;
+                while (count < bufferCapacity && rxRing.size () != 0)
+                {
+                    // Next frame: next block
+                    if (count > 0 && isSilenceBefore (rxRing.tail))
+                        break;
+                    rxRing.pop (buffer [count++]);
+                }
+                return (int) count;
+            }
+
+            int serialWriteNonBlocking (SerialPort* sp, const uint8* buffer, uint16 bufferSizeinBtes)
+            {
+                assert (sp != NULL);
+                uint16 count = 0;
+                while (count < bufferSizeinBtes && txRing.push (buffer [count]))
+                    count++;
+                if (count > 0)
+                    UCSR0B |= _BV (UDRIE0); // Start sending
+                return (int) count;
+            }
+
+            int serialWrite (SerialPort* sp, uint8* buffer, uint16 bufferSizeinBtes)
+            {
+                uint16 written = 0;
+                while (written < bufferSizeinBtes)
+                    written += (uint16) serialWriteNonBlocking (sp, buffer + written, bufferSizeinBtes - written);
+                return (int) written;
+            }
         }
 
-        int serialWrite (SerialPort* sp, uint8* buffer, uint16 bufferSizeinBtes)
+    #else
+
+        // Arduino documentation on serial port:
+        // https://www.arduino.cc/reference/en/language/functions/communication/serial/
+
+        namespace voltiris
         {
-            assert (sp != NULL);
-            return (int) ::Serial.write(buffer, (size_t) bufferSizeinBtes);
+            static ArduinoSerialPort serial;
+
+            SerialPort* serialInit ()
+            {
+                ::Serial.begin(SERIAL_BAUD_RATE);
+                while (!::Serial)
+                    delay (10); // wait for serial port to connect. Needed for native USB
+
+                return (SerialPort*) &serial; 
+            }
+
+            int serialRead (SerialPort* sp)
+            {
+                assert (sp != NULL);
+                return ::Serial.read();
+            }
+
+            int serialAvailable (SerialPort* sp)
+            {
+                assert (sp != NULL);
+                return ::Serial.available();
+            }
+
+            int serialWait (SerialPort* sp, long timeoutUs)
+            {
+                assert (sp != NULL);
+                uint32 start = ::micros ();
+                while (::Serial.available() == 0)
+                {
+                    if (timeoutUs >= 0 && ::micros () - start >= (uint32) timeoutUs)
+                        return 0;
+                    VOLTIRIS_IDLE (::Serial.available() == 0);
+                }
+                return ::Serial.available();
+            }
+
+            int serialReadBlock (SerialPort* sp, uint8* buffer, uint16 bufferCapacity, bool& silence)
+            {
+                assert (sp != NULL);
+                silence = false; // Characters are not timed
+                uint16 count = 0;
+                int c;
+                while (count < bufferCapacity && (c = ::Serial.read()) >= 0)
+                    buffer [count++] = (uint8) c;
+                return (int) count;
+            }
+
+            int serialWrite (SerialPort* sp, uint8* buffer, uint16 bufferSizeinBtes)
+            {
+                assert (sp != NULL);
+                return (int) ::Serial.write(buffer, (size_t) bufferSizeinBtes);
+            }
+
+            int serialWriteNonBlocking (SerialPort* sp, const uint8* buffer, uint16 bufferSizeinBtes)
+            {
+                assert (sp != NULL);
+                int space = ::Serial.availableForWrite();
+                if (space <= 0)
+                    return 0;
+                if (bufferSizeinBtes > (uint16) space)
+                    bufferSizeinBtes = (uint16) space;
+                return (int) ::Serial.write(buffer, (size_t) bufferSizeinBtes);
+            }
         }
-    }
+
+    #endif
 
 #endif
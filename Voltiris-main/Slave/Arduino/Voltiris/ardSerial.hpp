@@ -6,9 +6,22 @@
 
     #include "vltSerial.hpp"
 
+    // Use the interrupt-driven ring buffer backend on USART0 of AVR
+    // boards (UNO, MEGA...). Otherwise, and with native USB boards,
+    // the Arduino Serial object is used.
+    // Note: the ring backend owns the USART0 interrupts,
+    // Serial must not be used by the firmware.
+    #ifndef VOLTIRIS_RING_SERIAL
+        #if defined(__AVR__) && defined(UDR0)
+            #define VOLTIRIS_RING_SERIAL 1
+        #else
+            #define VOLTIRIS_RING_SERIAL 0
+        #endif
+    #endif
+
     namespace voltiris
     {
         struct ArduinoSerialPort: SerialPort {};
     }
 
-#endif
\ No newline at end of file
+#endif
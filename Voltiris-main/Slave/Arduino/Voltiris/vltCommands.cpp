@@ -2,185 +2,319 @@
 #include "vltCommands.hpp"
 #include "vltFirmware.hpp"
 #include "vltOption.hpp"
+#include "vltFraming.hpp"
+#include "vltPersist.hpp"
+#include "vltProfile.hpp"
+#include "vltTrace.hpp"
+#include "vltUpdate.hpp"
 
 
 namespace voltiris
 {
-    // Buffer containing the incoming and outcoming ASCII packets
-    static Buffer<SERIAL_BUFFER_SIZE> bufferAscii;
+    // Largest command (write of the whole memory buffer) and largest
+    // response (read of MAX_READ_INPUT_REGISTERS registers)
+    const uint16 MAX_COMMAND_SIZE = PRESET_MULT_REGISTERS_CMD_SIZE + BUFFER_SIZE;
+    const uint16 MAX_RESPONSE_SIZE = 3 + 2 * MAX_READ_INPUT_REGISTERS;
+
+    // Binary buffer of the frame being received, then of its response
+    // while it is sent (+ 2 for the CRC-16 of RTU frames)
+    static Buffer<(MAX_COMMAND_SIZE > MAX_RESPONSE_SIZE ? MAX_COMMAND_SIZE : MAX_RESPONSE_SIZE) + 2> bufferBin;
+
+    // Streaming decoder of the ASCII framing: the hex characters
+    // are decoded into bufferBin as they arrive
+    static struct AsciiDecoder
+    {
+        uint8 high;          // High nibble waiting for the low one
+        bool  hasHigh;       // The high nibble is set
+        bool  carriageReturn; // '\r' received, the packet ends with '\n'
+        uint8 sum;           // Running sum of the decoded bytes (CRC8 included)
 
-    // Binary buffer
-    static Buffer<SERIAL_BUFFER_SIZE/2> bufferBin;
+        void reset ()
+        {
+            hasHigh = false;
+            carriageReturn = false;
+            sum = 0;
+        }
+    } decoder;
     
     // Minimum command size: ":\r\n"
     const uint16 MIN_CMD_SIZE = 3;
 
-    // Size of a read input register command
-    const uint8 READ_INPUT_REGISTERS_CMD_SIZE = 7;
+    // Get a byte in the binary buffer
+    // and increment index accordingly
+    static inline uint8 get8 (uint16& index)
+    {
+        return bufferBin.data [index++];
+    }
 
-    // Code of the read input registers command
-    const uint8 READ_INPUT_REGISTERS_CMD = 0x04;
+    // Get a uint16 in the binary buffer
+    // and increment index accordingly
+    static inline uint16 get16 (uint16& index)
+    {
+        uint16 hi  = (uint16) get8 (index);
+        uint16 low = (uint16) get8 (index);
+        return (hi << 8) | low;
+    }
 
-    // Code of the preset multiple registers command
-    const uint8 PRESET_MULT_REGISTERS_CMD = 0x10;
+    // Get raw data in the binary buffer
+    // and increment index accordingly
+    static inline uint8* getX (uint16& index, const uint16 size)
+    {
+        uint8* ret = &bufferBin.data [index];
+        index += size;
+        return ret;
+    }
+
+    static_assert (PROFILE_ADDRESS_END < HEALTH_ADDRESS_START, "Profile registers overlap the health registers");
 
+    // Health counters (see HEALTH_FRAMES_RECEIVED...) and last discard reason
+    static uint16 healthCounters [HEALTH_REGISTERS];
+    static DiscardReason lastDiscardReason = DISCARD_NONE;
 
-    // Convert and ASCII character (eg: 'F') to binary (eg 0xf)
-    static inline uint8 toByte (const char c, bool& error)
+    // Increment a health counter, saturated to 0xffff
+    static inline void countHealth (uint16 counter)
     {
-        if (c >= '0' && c <= '9')
-            return (uint8) (c - '0');
-        if (c >= 'a' && c <= 'f')
-            return (uint8) (c - 'a' + 10);
-        if (c >= 'A' && c <= 'F')
-            return (uint8) (c - 'A' + 10);
-        error = true;
-        return 0;
+        if (healthCounters [counter] != 0xffff)
+            healthCounters [counter]++;
     }
 
-    // Convert ASCII buffer to binary
-    // Return the status of conversion
-    static inline bool convertAsciiToBinary ()
+    DiscardReason getLastDiscardReason ()
     {
-        bufferBin.reset ();
-        if (bufferAscii.size % 2 != 0)
-            return false;
-        bool error = false;
-        for (uint16 i = 0; i < bufferAscii.size;)
-        {
-            uint8 hi  = toByte(bufferAscii.data[i++], error);
-            uint8 low = toByte(bufferAscii.data[i++], error);
-            bufferBin.add ((hi << 4) | low);
-        }
-        return !error;
+        return lastDiscardReason;
     }
 
-    // Convert a value from 0 to 0xf to a character
-    static inline char toChar (uint8 in)
+    uint16 getHealthRegister (uint16 index)
     {
-        if (in <= 9)
-            return in + '0';
-        in -= 10;
-        return in + 'A';
+        if (index == HEALTH_LAST_DISCARD_REASON)
+            return lastDiscardReason;
+        return healthCounters [index];
     }
 
-    // Convert a byte to 2 characters representing the number in hex
-    static inline void toChar (uint8 in, char& hi, char& low)
+    void resetHealthCounters ()
     {
-        hi  = toChar (in >> 4);
-        low = toChar (in & 0xf);
+        for (uint16 i = 0; i < HEALTH_REGISTERS; i++)
+            healthCounters [i] = 0;
+        lastDiscardReason = DISCARD_NONE;
     }
 
-    // Convert binary buffer to ASCII
-    static inline void convertBinaryToAscii ()
+    // Frame being processed by processPacket (), recorded in the trace
+    static TraceEntry traceEntry;
+
+    #if VOLTIRIS_TRACE_SIZE > 0
+        static bool tracing = false; // processPacket () is running
+    #endif
+
+    // Command and address of the frame in bufferBin (as far as received)
+    static inline void traceHeader (TraceEntry& entry)
+    {
+        entry.command = bufferBin.size >= 2 ? bufferBin.data [1] : 0;
+        entry.address = bufferBin.size >= 4 ?
+            (uint16) ((bufferBin.data [2] << 8) | bufferBin.data [3]) : 0;
+    }
+
+    // Record why the frame being received is dropped
+    static inline void discardFrame (DiscardReason reason)
     {
-        bufferAscii.reset ();
-        bufferAscii.add (':');
+        lastDiscardReason = reason;
+        countHealth (HEALTH_DISCARDED + reason - 1);
+
+        #if VOLTIRIS_TRACE_SIZE > 0
 
-        for (uint16 i = 0; i < bufferBin.size; i++)
+            if (tracing)
+            {
+                traceEntry.outcome = reason;
+                return;
+            }
+
+            // Dropped while receiving
+            TraceEntry entry;
+            entry.time = getMicroseconds ();
+            entry.processingTime = 0;
+            entry.responseSize = 0;
+            entry.outcome = reason;
+            traceHeader (entry);
+            traceRecord (entry);
+
+        #endif
+    }
+
+    // Record that an error response is sent
+    static inline void countErrorResponse ()
+    {
+        countHealth (HEALTH_ERROR_RESPONSES);
+        traceEntry.outcome = TRACE_ERROR_RESPONSE;
+    }
+
+    // Resumable encoder of the responses: bytes are added to the checksum and
+    // stored in bufferBin (commands read the frame before beginResponse ()).
+    // The characters of the response (hex encoded for ASCII) are then queued
+    // with serialWriteNonBlocking () as the serial port accepts them: a long
+    // response is sent by processIncomingSerialData () calls, the loop never
+    // waits for it (see sendPendingResponse ())
+    static struct ResponseWriter
+    {
+        SerialPort* sp;
+        bool   rtu;
+        uint8  crc8;
+        uint16 crc16;
+        uint16 position; // Next character to queue
+        uint16 length;   // Characters of the response
+
+        // Character index of the response on the line
+        uint8 character (uint16 index) const
         {
+            if (rtu)
+                return bufferBin.data [index];
+            if (index == 0)
+                return ':';
+            if (index >= length - 2)
+                return index == length - 2 ? '\r' : '\n';
+
             char hi, low;
-            toChar (bufferBin.data [i], hi, low);
-            bufferAscii.add (hi);
-            bufferAscii.add (low);
+            toChar (bufferBin.data [(index - 1) >> 1], hi, low);
+            return (uint8) ((index & 1) != 0 ? hi : low);
         }
-        bufferAscii.add ('\r');
-        bufferAscii.add ('\n');
-    }
+    } writer;
 
-    // Get a byte in the binary buffer
-    // and increment index accordingly
-    static inline uint8 get8 (uint16& index)
+    static inline bool isResponsePending ()
     {
-        return bufferBin.data [index++];
+        return writer.position < writer.length;
     }
 
-    // Get a uint16 in the binary buffer
-    // and increment index accordingly
-    static inline uint16 get16 (uint16& index)
+    // Queue the characters of the pending response: as many as the serial
+    // port accepts, or all of them waiting for the port (wait).
+    // Return true once the whole response is queued
+    static bool sendPendingResponse (bool wait)
     {
-        uint16 hi  = (uint16) get8 (index);
-        uint16 low = (uint16) get8 (index);
-        return (hi << 8) | low;
+        if (!isResponsePending ())
+            return true;
+
+        ProfileScope scope (PROFILE_SERIAL_WRITE);
+        uint8 chunk [SERIAL_WRITE_CHUNK_SIZE];
+        do
+        {
+            uint16 count = 0;
+            while (count < sizeof (chunk) && writer.position + count < writer.length)
+            {
+                chunk [count] = writer.character (writer.position + count);
+                count++;
+            }
+
+            int queued = wait ? serialWrite (writer.sp, chunk, count) :
+                                serialWriteNonBlocking (writer.sp, chunk, count);
+            if (wait && queued < (int) count)
+            {
+                writer.position = writer.length; // Line is gone
+                break;
+            }
+            if (queued <= 0)
+                break; // Transmit queue is full
+            writer.position += (uint16) queued;
+        }
+        while (isResponsePending ());
+        return !isResponsePending ();
     }
 
-    // Get raw data in the binary buffer
-    // and increment index accordingly
-    static inline uint8* getX (uint16& index, const uint16 size)
+    // Start receiving a frame in bufferBin. The pending response is sent
+    // first (waiting for it only if the Master talks over the response)
+    static inline void beginFrame ()
     {
-        uint8* ret = &bufferBin.data [index];
-        index += size;
-        return ret;
+        sendPendingResponse (true);
+        bufferBin.reset ();
     }
 
-    // Set a byte in the binary buffer
+    // Add a byte to the response
     static inline void add8 (const uint8 value)
     {
+        if (writer.rtu)
+            writer.crc16 = updateCRC16 (writer.crc16, value);
+        else
+            writer.crc8 += value;
         bufferBin.add (value);
     }
 
-    // Set a uint16 in the binary buffer
+    // Add a uint16 to the response
     static inline void add16 (const uint16 value)
     {
         add8 ((uint8) (value >> 8));
         add8 ((uint8) (value & 0xff));
     }
 
-    static inline void addX (uint8* address, const uint16 size)
+    // Add raw data to the response
+    static inline void addX (const uint8* address, const uint16 size)
     {
         for (uint16 i = 0; i < size; i++)
             add8 (*address++);
     }
 
-    // Compute the CRC8 of data in the bufferBin
-    // until crcIndex position
-    static inline uint8 computeCRC8 (const uint16 crcIndex)
+    // Start a response: slave id and command
+    // (the encoding is measured until sendResponse ())
+    static inline void beginResponse (SerialPort& sp, const uint8 cmd,
+                                      const uint8 slaveId = configuration.slaveId)
     {
-        uint8 crc8 = 0;
-        for (uint16 i = 0; i < crcIndex; i++)
-            crc8 += bufferBin.data [i];
-        return crc8;
+        profileEnter (PROFILE_ENCODE);
+        writer.sp = &sp;
+        writer.rtu = configuration.framing == FRAMING_RTU;
+        writer.crc8 = 0;
+        writer.crc16 = 0xffff;
+        writer.position = 0;
+        writer.length = 0;
+        bufferBin.reset ();
+
+        add8 (slaveId);
+        add8 (cmd);
+    }
+
+    // Add the checksum, then queue as much of
+    // the response as the serial port accepts
+    static inline void sendResponse ()
+    {
+        if (writer.rtu)
+        {
+            uint16 crc16 = writer.crc16;
+            bufferBin.add ((uint8) (crc16 & 0xff)); // CRC-16 is sent low byte first
+            bufferBin.add ((uint8) (crc16 >> 8));
+            writer.length = bufferBin.size;
+        }
+        else
+        {
+            bufferBin.add (writer.crc8);
+            writer.length = 1 + 2 * bufferBin.size + 2; // ':', hex characters, "\r\n"
+        }
+        countHealth (HEALTH_RESPONSES_SENT);
+        traceEntry.responseSize += writer.length;
+        if (traceEntry.outcome == TRACE_NO_RESPONSE)
+            traceEntry.outcome = TRACE_RESPONSE;
+        profileLeave ();
+
+        sendPendingResponse (false);
     }
 
     static inline void readError (SerialPort& sp)
     {
         // Send error
-        bufferBin.reset ();
-        add8 (configuration.slaveId);
-        add8 (READ_INPUT_REGISTERS_CMD);
+        countErrorResponse ();
+        beginResponse (sp, READ_INPUT_REGISTERS_CMD);
         add8 (0);
-        add8 (computeCRC8(bufferBin.size));
-        convertBinaryToAscii ();
-        serialWrite (&sp, bufferAscii.data, bufferAscii.size);
-        bufferAscii.reset ();
+        sendResponse ();
     }
 
 
     static inline void sendReadInputRegisterPacket (SerialPort& sp, const uint16 value)
     {
-        bufferBin.reset ();
-        add8 (configuration.slaveId);
-        add8 (READ_INPUT_REGISTERS_CMD);
+        beginResponse (sp, READ_INPUT_REGISTERS_CMD);
         add8 (sizeof(uint16));
         add16 (value);
-        add8 (computeCRC8(bufferBin.size));
-        convertBinaryToAscii ();
-        serialWrite (&sp, bufferAscii.data, bufferAscii.size);
-        bufferAscii.reset ();
+        sendResponse ();
     }
 
-    static inline void slaveIdentification (SerialPort& sp)
+    static inline void slaveIdentification (SerialPort& sp, const uint8 slaveId = configuration.slaveId)
     {
-        bufferBin.reset ();
-        add8 (configuration.slaveId);
-        add8 (READ_INPUT_REGISTERS_CMD);
-        add8 (8);
+        beginResponse (sp, READ_INPUT_REGISTERS_CMD, slaveId);
+        add8 (SERIAL_NUMBER_SIZE);
         uint8* data = getSerialNumber ();
-        addX (data, 8);
-        add8 (computeCRC8(bufferBin.size));
-        convertBinaryToAscii ();
-        serialWrite (&sp, bufferAscii.data, bufferAscii.size);
-        bufferAscii.reset ();
+        addX (data, SERIAL_NUMBER_SIZE);
+        sendResponse ();
     }
 
     static inline void getOptionInfo (SerialPort& sp, const uint16 address, const Option& opt)
@@ -193,28 +327,143 @@ namespace voltiris
         }
         buffer.size = bufferSize;
         
-        bufferBin.reset ();
-        add8 (configuration.slaveId);
-        add8 (READ_INPUT_REGISTERS_CMD);
+        beginResponse (sp, READ_INPUT_REGISTERS_CMD);
         add8 (2);
         add16 (bufferSize);
-        add8 (computeCRC8(bufferBin.size));
-        convertBinaryToAscii ();
-        serialWrite (&sp, bufferAscii.data, bufferAscii.size);
-        bufferAscii.reset ();
+        sendResponse ();
+    }
+
+    // Send the binary descriptor of an option,
+    // padded with 0 to the requested number of registers
+    static inline void getOptionDescriptor (SerialPort& sp, const Option& opt, uint16 numberOfUint16)
+    {
+        uint8 descriptor [MAX_OPTION_DESCRIPTOR_SIZE];
+        uint16 size = sizeof (descriptor);
+        if (!opt.convertToBinary (descriptor, size) || size > 2 * numberOfUint16)
+        {
+            readError (sp);
+            return;
+        }
+
+        beginResponse (sp, READ_INPUT_REGISTERS_CMD);
+        add8 ((uint8) (2 * numberOfUint16));
+        addX (descriptor, size);
+        for (uint16 i = size; i < 2 * numberOfUint16; i++)
+            add8 (0);
+        sendResponse ();
+    }
+
+    // Pack the binary descriptors of all options one after the other and
+    // copy page (BUFFER_SIZE bytes) of the result in the memory buffer.
+    // Send the total size of the descriptors
+    static inline void dumpOptionDescriptors (SerialPort& sp, uint16 page)
+    {
+        uint16 start = page * BUFFER_SIZE;
+        uint16 offset = 0;
+        uint8 descriptor [MAX_OPTION_DESCRIPTOR_SIZE];
+        Option opt;
+
+        buffer.reset ();
+        for (uint16 i = 0; getOption (i, opt); i++)
+        {
+            uint16 size = sizeof (descriptor);
+            if (!opt.convertToBinary (descriptor, size))
+            {
+                readError (sp);
+                return;
+            }
+            for (uint16 j = 0; j < size; j++, offset++)
+            {
+                if (offset >= start)
+                    buffer.add (descriptor [j]); // Ignored once the page is full
+            }
+        }
+
+        if (page > 0 && start >= offset)
+        {
+            readError (sp);
+            return;
+        }
+        
+        beginResponse (sp, READ_INPUT_REGISTERS_CMD);
+        add8 (2);
+        add16 (offset);
+        sendResponse ();
     }
 
     static inline void readMemory (SerialPort& sp, uint16 index, uint16 size)
     {
-        bufferBin.reset ();
-        add8 (configuration.slaveId);
-        add8 (READ_INPUT_REGISTERS_CMD);
+        beginResponse (sp, READ_INPUT_REGISTERS_CMD);
         add8 (size);
         addX (buffer.data + index, size);
-        add8 (computeCRC8(bufferBin.size));
-        convertBinaryToAscii ();
-        serialWrite (&sp, bufferAscii.data, bufferAscii.size);
-        bufferAscii.reset ();
+        sendResponse ();
+    }
+
+    #if VOLTIRIS_PROFILE
+
+        // Read consecutive timing profile registers
+        static inline void readProfile (SerialPort& sp, uint16 index, uint16 numberOfUint16)
+        {
+            beginResponse (sp, READ_INPUT_REGISTERS_CMD);
+            add8 ((uint8) (2 * numberOfUint16));
+            for (uint16 i = 0; i < numberOfUint16; i++)
+                add16 (getProfileRegister (index + i));
+            sendResponse ();
+        }
+
+    #endif
+
+    // Copy the trace in the memory buffer and send its size
+    static inline void snapshotTrace (SerialPort& sp)
+    {
+        buffer.size = traceSnapshot (buffer.data);
+
+        beginResponse (sp, READ_INPUT_REGISTERS_CMD);
+        add8 (2);
+        add16 (buffer.size);
+        sendResponse ();
+    }
+
+    // Read consecutive health counter registers
+    static inline void readHealth (SerialPort& sp, uint16 index, uint16 numberOfUint16)
+    {
+        beginResponse (sp, READ_INPUT_REGISTERS_CMD);
+        add8 ((uint8) (2 * numberOfUint16));
+        for (uint16 i = 0; i < numberOfUint16; i++)
+            add16 (getHealthRegister (index + i));
+        sendResponse ();
+    }
+
+    // Read the firmware update status registers
+    static inline void readUpdateStatus (SerialPort& sp)
+    {
+        beginResponse (sp, READ_INPUT_REGISTERS_CMD);
+        add8 ((uint8) (2 * UPDATE_REGISTERS));
+        for (uint16 i = 0; i < UPDATE_REGISTERS; i++)
+            add16 (getUpdateRegister (i));
+        sendResponse ();
+    }
+
+    // Read consecutive option registers, possibly across options (each
+    // option is looked up once). Registers must have been checked with
+    // isOptionRangeReadable ()
+    static inline void readOptions (SerialPort& sp, uint16 address, uint16 numberOfUint16)
+    {
+        beginResponse (sp, READ_INPUT_REGISTERS_CMD);
+        add8 ((uint8) (2 * numberOfUint16));
+        Option opt;
+        uint16 index = 0;
+        for (uint16 i = 0; i < numberOfUint16; i++)
+        {
+            if (i == 0 || ++index == (uint16) opt.dimension)
+                getOptionAtAddress (address, opt, index);
+
+            uint16 value = 0;
+            getOptionValue (opt, index, value);
+            add16 (value);
+            address += 2;
+        }
+        sendResponse ();
     }
 
     // Process a Read Input Register Packet
@@ -227,29 +476,56 @@ namespace voltiris
         uint8  cmd            = get8(index);
         uint16 address        = get16(index);
         uint16 numberOfUint16 = get16(index);
-        uint8  crc8           = get8(index);
 
         // Check that packet has the correct size
         if (bufferBin.size < READ_INPUT_REGISTERS_CMD_SIZE)
+        {
+            discardFrame (DISCARD_WRONG_SIZE);
             return;
-
-        // Verify the packet CRC
-        if (crc8 != computeCRC8 (index-1))
-            return;
+        }
 
         // Verify that the packet is addressed to this slave
         if (slaveAddress != configuration.slaveId)
+        {
+            discardFrame (DISCARD_OTHER_SLAVE);
             return;
+        }
 
         // Check if address is a getOptionInfo () cmd
         if (address >= CMD_GET_OPT_INFO_START && // 0x20
             address <= CMD_GET_OPT_INFO_END) // 0x50
         {
-            Option* opt = getOption (address - CMD_GET_OPT_INFO_START);
-            if (numberOfUint16 != 1 || opt == NULL)
+            ProfileScope scope (PROFILE_READ_OPTION_INFO);
+            Option opt;
+            if (numberOfUint16 != 1 || !getOption (address - CMD_GET_OPT_INFO_START, opt))
+                readError (sp);
+            else
+                getOptionInfo (sp, address, opt);
+            return;
+        }
+
+        // Check if address is a getOptionDescriptor () cmd
+        if (address >= CMD_GET_OPT_DESC_START && // 0x60
+            address <= CMD_GET_OPT_DESC_END) // 0x90
+        {
+            ProfileScope scope (PROFILE_READ_DESCRIPTORS);
+            Option opt;
+            if (numberOfUint16 > MAX_READ_INPUT_REGISTERS || !getOption (address - CMD_GET_OPT_DESC_START, opt))
                 readError (sp);
             else
-                getOptionInfo (sp, address, *opt);
+                getOptionDescriptor (sp, opt, numberOfUint16);
+            return;
+        }
+
+        // Check if address is a dumpOptionDescriptors () cmd
+        if (address >= CMD_DUMP_OPT_DESC_START && // 0xa0
+            address <= CMD_DUMP_OPT_DESC_END) // 0xaf
+        {
+            ProfileScope scope (PROFILE_READ_DESCRIPTORS);
+            if (numberOfUint16 != 1)
+                readError (sp);
+            else
+                dumpOptionDescriptors (sp, address - CMD_DUMP_OPT_DESC_START);
             return;
         }
 
@@ -257,6 +533,7 @@ namespace voltiris
         if (address >= BUFFER_ADDRESS_START && // 0x200
             address <= BUFFER_ADDRESS_END) // 0x2fe
         {
+            ProfileScope scope (PROFILE_READ_MEMORY);
             uint16 index = address - BUFFER_ADDRESS_START;
             uint16 size = 2 * numberOfUint16;
 
@@ -271,13 +548,67 @@ namespace voltiris
         if (address >= OPTIONS_ADDRESS_START && // 0x300
             address <= OPTIONS_ADDRESS_END) // dynamic
         {
-            uint16 value;
-            uint16 size = 2 * numberOfUint16;
+            ProfileScope scope (PROFILE_READ_OPTIONS);
+            if (numberOfUint16 == 0 ||
+                numberOfUint16 > MAX_READ_INPUT_REGISTERS ||
+                !isOptionRangeReadable (address, numberOfUint16))
+                readError (sp);
+            else
+                readOptions (sp, address, numberOfUint16);
+            return;
+        }
+
+        #if VOLTIRIS_PROFILE
 
-            if (numberOfUint16 != 1 || !getOptionValueAtAddress (address, value))
+            // Check if address is in the timing profile
+            if (address >= PROFILE_ADDRESS_START && // 0x102
+                address <= PROFILE_ADDRESS_END)
+            {
+                ProfileScope scope (PROFILE_READ_SYSTEM);
+                uint16 index = (address - PROFILE_ADDRESS_START) / 2;
+                if ((address & 1) != 0 ||
+                    numberOfUint16 == 0 ||
+                    index + numberOfUint16 > PROFILE_REGISTERS)
+                    readError (sp);
+                else
+                    readProfile (sp, index, numberOfUint16);
+                return;
+            }
+
+        #endif
+
+        ProfileScope scope (PROFILE_READ_SYSTEM);
+
+        // Check if address is in the health counters
+        if (address >= HEALTH_ADDRESS_START && // 0x1c0
+            address <= HEALTH_ADDRESS_END)
+        {
+            uint16 index = (address - HEALTH_ADDRESS_START) / 2;
+            if ((address & 1) != 0 ||
+                numberOfUint16 == 0 ||
+                index + numberOfUint16 > HEALTH_REGISTERS)
                 readError (sp);
             else
-                sendReadInputRegisterPacket (sp, value);
+                readHealth (sp, index, numberOfUint16);
+            return;
+        }
+
+        // Check if address is in the missing-block bitmap pages
+        if (address >= CMD_UPDATE_MISSING_START && // 0xc8
+            address <= CMD_UPDATE_MISSING_END)
+        {
+            uint16 offset = (address - CMD_UPDATE_MISSING_START) * UPDATE_BITMAP_PAGE_SIZE;
+            if (numberOfUint16 == 0 ||
+                2 * numberOfUint16 > UPDATE_BITMAP_PAGE_SIZE ||
+                offset + 2 * numberOfUint16 > MAX_UPDATE_BLOCKS / 8)
+            {
+                readError (sp);
+                return;
+            }
+            beginResponse (sp, READ_INPUT_REGISTERS_CMD);
+            add8 ((uint8) (2 * numberOfUint16));
+            addX (getUpdateMissingBitmap () + offset, 2 * numberOfUint16);
+            sendResponse ();
             return;
         }
 
@@ -298,12 +629,26 @@ namespace voltiris
                 else   
                     sendReadInputRegisterPacket (sp, MEMORY_VERSION);
                 return;
+
+            case CMD_SNAPSHOT_TRACE: // 0xb0
+
+                if (numberOfUint16 != 1)
+                    readError (sp);
+                else
+                    snapshotTrace (sp);
+                return;
+
+            case CMD_UPDATE_STATUS: // 0xc2
+
+                if (numberOfUint16 != UPDATE_REGISTERS)
+                    readError (sp);
+                else
+                    readUpdateStatus (sp);
+                return;
         }
 
-        // GMA !!!
-        char data [128];
-        sprintf (data, "cmd: %d %d %d\n", (int) index, (int) crc8, (int) computeCRC8 (index-1)); //":deadbeaf\r\n";
-        serialWrite (&sp, data, strlen(data));
+        // Unknown address
+        readError (sp);
     }
 
     static inline void checkSlaveId (const uint8* mask32bits)
@@ -359,18 +704,139 @@ namespace voltiris
 
     static inline void writeResponse (SerialPort& sp, uint16 address, uint16 nbRegisters = 0)
     {
-        // Send error
-        bufferBin.reset ();
-        add8 (configuration.slaveId);
-        add8 (PRESET_MULT_REGISTERS_CMD);
+        if (nbRegisters == 0) // Error
+            countErrorResponse ();
+        beginResponse (sp, PRESET_MULT_REGISTERS_CMD);
         add16 (address);
         add16 (nbRegisters);
-        add8 (computeCRC8(bufferBin.size));
-        convertBinaryToAscii ();
-        serialWrite (&sp, bufferAscii.data, bufferAscii.size);
-        bufferAscii.reset ();
+        sendResponse ();
+    }
+
+    // Cleared by CMD_DISCOVERY_START, set once the Master assigned
+    // an id: only undiscovered slaves answer the discovery probes
+    static bool discovered = false;
+
+    // Check that the serial number starts with the bitCount
+    // first bits (most significant first) of prefix
+    static inline bool matchSerialNumber (const uint8* prefix, uint16 bitCount)
+    {
+        const uint8* serial = getSerialNumber ();
+        uint16 i = 0;
+        for (; bitCount >= 8; bitCount -= 8, i++)
+            if (serial [i] != prefix [i])
+                return false;
+        if (bitCount == 0)
+            return true;
+        uint8 mask = (uint8) (0xff00 >> bitCount);
+        return ((serial [i] ^ prefix [i]) & mask) == 0;
     }
 
+    // Process a packet sent to DISCOVERY_SLAVE_ID (tree walk over the serial numbers):
+    // - start: every slave becomes undiscovered, no response,
+    // - probe: undiscovered slaves matching the prefix answer with their serial number
+    //   (several slaves answer together: the Master sees a collision and splits the prefix),
+    // - assign: the slave with the serial number takes the id and answers from it.
+    static inline void processDiscoveryPacket (SerialPort& sp, uint16 address, uint16 numberOfUint16,
+                                               uint16 byteCount, const uint8* data)
+    {
+        if (address == CMD_DISCOVERY_START)
+        {
+            discovered = false;
+            return;
+        }
+
+        if (address != CMD_DISCOVERY_PROBE && address != CMD_DISCOVERY_ASSIGN)
+        {
+            discardFrame (DISCARD_UNKNOWN_COMMAND);
+            return;
+        }
+
+        if (numberOfUint16 != DISCOVERY_REGISTERS || byteCount != 2 * DISCOVERY_REGISTERS)
+        {
+            discardFrame (DISCARD_WRONG_SIZE);
+            return;
+        }
+
+        if (address == CMD_DISCOVERY_PROBE)
+        {
+            uint16 bitCount = ((uint16) data [0] << 8) | (uint16) data [1];
+            if (discovered || bitCount > 8 * SERIAL_NUMBER_SIZE || !matchSerialNumber (data + 2, bitCount))
+            {
+                discardFrame (DISCARD_OTHER_SLAVE);
+                return;
+            }
+            slaveIdentification (sp, DISCOVERY_SLAVE_ID);
+            return;
+        }
+
+        // Assign
+        if (!matchSerialNumber (data, 8 * SERIAL_NUMBER_SIZE))
+        {
+            discardFrame (DISCARD_OTHER_SLAVE);
+            return;
+        }
+        uint16 id = ((uint16) data [8] << 8) | (uint16) data [9];
+        if (id == BROADCAST_SLAVE_ID || id > MAX_SLAVE_ID)
+        {
+            writeResponse (sp, address); // Error
+            return;
+        }
+        configuration.slaveId = (uint8) id;
+        discovered = true;
+        writeResponse (sp, address, DISCOVERY_REGISTERS);
+    }
+
+    // Process a firmware update packet (see vltUpdate.hpp), normally broadcasted:
+    // - start: image size (32 bits), CRC-16 of the image,
+    // - block: block index, data, CRC-16 of the data,
+    // - verify: CRC-16 of the image, the staged image is read back,
+    // - activate: CRC-16 of the image, broadcast only as the slaves restart.
+    // The response of a unicast packet tells if it was accepted
+    static inline void processUpdatePacket (SerialPort& sp, bool broadcast, uint16 address,
+                                            uint16 numberOfUint16, uint16 byteCount, const uint8* data)
+    {
+        uint16 accepted = 0;
+        switch (address)
+        {
+            case CMD_UPDATE_START: // 0xc0
+
+                if (numberOfUint16 != 3 || byteCount != 6)
+                    break;
+                updateStart (((uint32) data [0] << 24) | ((uint32) data [1] << 16) |
+                             ((uint32) data [2] << 8) | (uint32) data [3],
+                             ((uint16) data [4] << 8) | (uint16) data [5]);
+                if (getUpdateRegister (UPDATE_STATE) != UPDATE_FAILED)
+                    accepted = numberOfUint16;
+                break;
+
+            case CMD_UPDATE_BLOCK: // 0xc1
+
+                if (byteCount < 4 || byteCount > 4 + UPDATE_BLOCK_SIZE)
+                    break;
+                if (updateBlock (((uint16) data [0] << 8) | (uint16) data [1], data + 2, byteCount - 4,
+                                 ((uint16) data [byteCount - 2] << 8) | (uint16) data [byteCount - 1]))
+                    accepted = numberOfUint16;
+                break;
+
+            case CMD_UPDATE_VERIFY: // 0xc3
+
+                if (numberOfUint16 != 1 || byteCount != 2)
+                    break;
+                updateVerify (((uint16) data [0] << 8) | (uint16) data [1]);
+                if (getUpdateRegister (UPDATE_STATE) == UPDATE_VERIFIED)
+                    accepted = numberOfUint16;
+                break;
+
+            case CMD_UPDATE_ACTIVATE: // 0xc4
+
+                if (broadcast && numberOfUint16 == 1 && byteCount == 2)
+                    updateActivate (((uint16) data [0] << 8) | (uint16) data [1]);
+                break;
+        }
+
+        if (!broadcast)
+            writeResponse (sp, address, accepted);
+    }
 
     static inline void processPresetMultipleRegistersPacket (SerialPort& sp)
     {
@@ -383,20 +849,35 @@ namespace voltiris
         uint16 numberOfUint16 = get16 (index);
         uint16 byteCount      = (uint16) get8 (index);
         uint8* data           = getX  (index, (uint16) byteCount);
-        uint8  crc8           = get8  (index);
 
         // Check that packet has the correct size
-        if (bufferAscii.size != 2 * (8 + byteCount))
+        if (bufferBin.size != PRESET_MULT_REGISTERS_CMD_SIZE + byteCount)
+        {
+            discardFrame (DISCARD_WRONG_SIZE);
             return;
+        }
 
-        // Verify the packet CRC
-        if (crc8 != computeCRC8 (index-1))
+        if (slaveAddress == DISCOVERY_SLAVE_ID)
+        {
+            ProfileScope scope (PROFILE_WRITE_SYSTEM);
+            processDiscoveryPacket (sp, address, numberOfUint16, byteCount, data);
             return;
+        }
+
+        // Verify that the packet is addressed to this slave or to all slaves.
+        // No response is sent to a broadcasted packet.
+        bool broadcast = slaveAddress == BROADCAST_SLAVE_ID;
+        if (slaveAddress != configuration.slaveId && !broadcast)
+        {
+            discardFrame (DISCARD_OTHER_SLAVE);
+            return;
+        }
 
         // Check validity of byteCount
         if (byteCount > numberOfUint16 * 2)
         {
-            writeResponse (sp, address);
+            if (!broadcast)
+                writeResponse (sp, address);
             return;
         }
             
@@ -404,6 +885,10 @@ namespace voltiris
         if (address >= BUFFER_ADDRESS_START && // 0x200
             address <= BUFFER_ADDRESS_END) // 0x2fe
         {
+            if (broadcast)
+                return; // Memory cannot be broadcasted
+
+            ProfileScope scope (PROFILE_WRITE_MEMORY);
             uint16 index = address - BUFFER_ADDRESS_START;
             uint16 writeCount = 0;
             if ((index + byteCount) <= BUFFER_SIZE)
@@ -420,51 +905,121 @@ namespace voltiris
         if (address >= OPTIONS_ADDRESS_START && // 0x300
             address <= OPTIONS_ADDRESS_END) // dynamic
         {
-            if (byteCount != 2)
+            ProfileScope scope (PROFILE_WRITE_OPTIONS);
+
+            // Every register must be writeable (and broadcastable if
+            // the packet is broadcasted) before applying any of them
+            if (numberOfUint16 == 0 ||
+                byteCount != 2 * numberOfUint16 ||
+                !(broadcast ? isOptionRangeBroadcastable (address, numberOfUint16) :
+                              isOptionRangeWriteable (address, numberOfUint16)))
             {
-                writeResponse (sp, address); // Error
+                if (!broadcast)
+                    writeResponse (sp, address); // Error
                 return;
             }
-                
-            uint16 value = ((uint16) data[0] << 8) | (uint16) data[1];
 
-            writeResponse (sp, address, 
-                setOptionValueAtAddress (address, value) ? 1: 0);
+            // Each option is looked up once
+            uint16 accepted = 0;
+            Option opt;
+            uint16 index = 0;
+            for (uint16 i = 0; i < numberOfUint16; i++)
+            {
+                if (i == 0 || ++index == (uint16) opt.dimension)
+                    getOptionAtAddress (address + 2 * i, opt, index);
+
+                uint16 value = ((uint16) data[0] << 8) | (uint16) data[1];
+                if (setOptionValue (opt, index, value))
+                    accepted++;
+                data += 2;
+            }
+
+            if (!broadcast)
+                writeResponse (sp, address, accepted);
+            return;
+        }
 
+        ProfileScope scope (PROFILE_WRITE_SYSTEM);
+
+        // Check if address is a firmware update command
+        if (address >= CMD_UPDATE_START && // 0xc0
+            address <= CMD_UPDATE_ACTIVATE) // 0xc4
+        {
+            processUpdatePacket (sp, broadcast, address, numberOfUint16, byteCount, data);
             return;
         }
 
         switch (address)
         {
             case CMD_HARD_RESET:
-                if ((slaveAddress == configuration.slaveId ||
-                     slaveAddress == 0) && byteCount == 0)
+                if (byteCount == 0)
                     hardReset ();
                 return;
                 
             case CMD_RESET_SLAVE_ID:
-                if ((slaveAddress == configuration.slaveId ||
-                    slaveAddress == 0) && byteCount == 4)
+                if (byteCount == 4)
                     checkSlaveId (data);
                 return;
+
+            case HEALTH_ADDRESS_START: // 0x1c0
+                if (numberOfUint16 != 1 || byteCount != 2)
+                {
+                    if (!broadcast)
+                        writeResponse (sp, address); // Error
+                    return;
+                }
+                resetHealthCounters ();
+                if (!broadcast)
+                    writeResponse (sp, address, 1);
+                return;
         }
         
         // Unknown command
-        writeResponse (sp, address);
-
-        //char string [64]; // !!!
-        //sprintf (string, "cmd: %d %d %d\n", (int) index, (int) crc8, (int) computeCRC8 (index-1)); //":deadbeaf\r\n";
-        //serialWrite (&sp, string, strlen(string));
+        if (!broadcast)
+            writeResponse (sp, address);
     }
 
-    // Process packet given header and footer are removed
-    static inline void processPacket (SerialPort& sp)
+    // Verify the checksum at the end of the packet in bufferBin
+    // (CRC8 for ASCII, CRC-16 for RTU) and remove it.
+    // Return false if the checksum is incorrect
+    static inline bool checkAndRemoveChecksum ()
     {
-        if (!convertAsciiToBinary ())
-            return; // Packet structure incorrect
+        if (configuration.framing == FRAMING_RTU)
+        {
+            if (bufferBin.size < MIN_CMD_SIZE + 1)
+                return false;
+            uint16 crcIndex = bufferBin.size - 2;
+            uint16 crc16 = (uint16) bufferBin.data [crcIndex] |
+                           ((uint16) bufferBin.data [crcIndex + 1] << 8);
+            if (crc16 != computeCRC16 (bufferBin.data, crcIndex))
+                return false;
+            bufferBin.size = crcIndex;
+            return true;
+        }
 
+        // CRC8 is the sum of the previous bytes, decoder.sum includes it
+        uint16 crcIndex = bufferBin.size - 1;
+        uint8 crc8 = bufferBin.data [crcIndex];
+        if ((uint8) (decoder.sum - crc8) != crc8)
+            return false;
+        bufferBin.size = crcIndex;
+        return true;
+    }
+
+    // Verify the checksum of the packet in bufferBin and run its command
+    static inline void dispatchPacket (SerialPort& sp)
+    {
         if (bufferBin.size < MIN_CMD_SIZE)
-            return; // Packet size too small
+        {
+            discardFrame (DISCARD_TOO_SHORT);
+            return;
+        }
+
+        if (!checkAndRemoveChecksum ())
+        {
+            discardFrame (DISCARD_CHECKSUM);
+            return;
+        }
 
         switch (bufferBin.data [1]) // Check command
         {
@@ -476,14 +1031,39 @@ namespace voltiris
                 break;
 
             default:
-                // GMA !!!
-                char data [64];
-                sprintf (data, "command: %d\n", (int) bufferBin.data [1]); //":deadbeaf\r\n";
-                serialWrite (&sp, data, strlen(data));
+                discardFrame (DISCARD_UNKNOWN_COMMAND);
                 break;
         }
     }
 
+    // Process packet once "\r\n" is received (ASCII)
+    // or the end of frame silence is detected (RTU)
+    static inline void processPacket (SerialPort& sp)
+    {
+        countHealth (HEALTH_FRAMES_RECEIVED);
+
+        #if VOLTIRIS_TRACE_SIZE > 0
+
+            traceEntry.time = getMicroseconds ();
+            traceEntry.responseSize = 0;
+            traceEntry.outcome = TRACE_NO_RESPONSE;
+            traceHeader (traceEntry);
+            tracing = true;
+
+            dispatchPacket (sp);
+
+            tracing = false;
+            uint32 processingTime = getMicroseconds () - traceEntry.time;
+            traceEntry.processingTime = processingTime > 0xffff ? 0xffff : (uint16) processingTime;
+            traceRecord (traceEntry);
+
+        #else
+
+            dispatchPacket (sp);
+
+        #endif
+    }
+
     // State machine used to cature the correct
     // formatting of the packet
     enum StateMachine
@@ -494,62 +1074,253 @@ namespace voltiris
         END    // Packet footer is detected
     } state = TRASH;
 
-    // Read ongoing serial data and process packet if they are correctly composed.
-    // Return the number of characters read on the serial line.
-    // In case of error (e.g. SERIAL_BUFFER_OVERFLOW) return a negative number.
-    // Insert this function in a loop
-    int processIncomingSerialData (SerialPort* sp)
+    // Time of the last character received
+    static uint32 lastCharacterTime = 0;
+
+    // Time of the ':' starting the ASCII frame
+    static uint32 frameStartTime = 0;
+
+    // Time left before a timeout started at since expires (0 if expired)
+    static inline long remainingTime (uint32 now, uint32 since, uint32 timeoutUs)
     {
-        assert (sp != NULL);
+        uint32 elapsed = now - since;
+        return elapsed >= timeoutUs ? 0 : (long) (timeoutUs - elapsed);
+    }
 
-        int processed = 0;
-        while (serialAvailable (sp) > 0)
+    // Time left before the pending frame must be processed (RTU) or
+    // discarded (ASCII timeouts), -1 if no frame is pending
+    static long pendingFrameTimeout (uint32 now)
+    {
+        if (configuration.framing == FRAMING_RTU)
+            return state == DATA ? remainingTime (now, lastCharacterTime, RTU_SILENCE_US) : -1;
+
+        if (state != INIT && state != DATA)
+            return -1;
+
+        long timeout = -1;
+        if (configuration.interCharacterTimeoutUs != 0)
+            timeout = remainingTime (now, lastCharacterTime, configuration.interCharacterTimeoutUs);
+        if (configuration.frameTimeoutUs != 0)
         {
-            int raw = serialRead (sp);
-            
-            if (raw == SERIAL_NO_CHARACTER_AVAILABLE)
-                return processed;
-            processed++;
+            long frameTimeout = remainingTime (now, frameStartTime, configuration.frameTimeoutUs);
+            if (timeout < 0 || frameTimeout < timeout)
+                timeout = frameTimeout;
+        }
+        return timeout;
+    }
 
-            char data = (char) raw;
+    // Discard the pending ASCII frame if one of its timeouts expired at time now
+    static inline void checkAsciiTimeouts (uint32 now)
+    {
+        if (state != INIT && state != DATA)
+            return;
 
-            switch (data)
-            {
-                case ':':
-                    bufferAscii.reset ();
-                    state = INIT;
-                    break;
+        if (configuration.interCharacterTimeoutUs != 0 &&
+            now - lastCharacterTime >= configuration.interCharacterTimeoutUs)
+            discardFrame (DISCARD_INTER_CHARACTER_TIMEOUT);
+        else if (configuration.frameTimeoutUs != 0 &&
+                 now - frameStartTime >= configuration.frameTimeoutUs)
+            discardFrame (DISCARD_FRAME_TIMEOUT);
+        else
+            return;
 
-                case '\n':
-                    if (bufferAscii.size > 1 &&
-                        bufferAscii.data[bufferAscii.size - 1] == '\r')
-                    {
-                        bufferAscii.size--;
+        state = TRASH; // Wait for next ':'
+    }
+
+    // Process a RTU character received at time now. A frame is complete
+    // when the line stays silent during RTU_SILENCE_US after its last character
+    // (silence: the serial backend saw it before c, see serialReadBlock ()).
+    // Return false in case of a buffer overflow
+    static inline bool processRtuCharacter (SerialPort* sp, uint8 c, uint32 now, bool silence)
+    {
+        if (silence || now - lastCharacterTime >= RTU_SILENCE_US)
+        {
+            // Silence before this character: previous frame is complete
+            if (state == DATA)
+                processPacket (*sp);
+            beginFrame ();
+            state = INIT;
+        }
+        lastCharacterTime = now;
+
+        if (state == TRASH)
+            return true; // Wait for the silence ending the frame
+
+        state = DATA;
+        if (!bufferBin.add (c))
+        {
+            discardFrame (DISCARD_OVERFLOW);
+            state = TRASH;
+            return false;
+        }
+        return true;
+    }
+
+    // Process an ASCII character received at time now,
+    // the packet is processed on "\r\n"
+    // Return false in case of a buffer overflow
+    static inline bool processAsciiCharacter (SerialPort* sp, char data, uint32 now)
+    {
+        checkAsciiTimeouts (now);
+        lastCharacterTime = now;
+
+        switch (data)
+        {
+            case ':':
+                if (state == INIT || state == DATA)
+                    discardFrame (DISCARD_INCOMPLETE);
+                decoder.reset ();
+                beginFrame ();
+                state = INIT;
+                frameStartTime = now;
+                break;
+
+            case '\r':
+                if (state == DATA)
+                    decoder.carriageReturn = true;
+                break;
+
+            case '\n':
+                if (state == DATA && decoder.carriageReturn)
+                {
+                    if (!decoder.hasHigh)
                         processPacket (*sp);
-                        bufferAscii.reset ();
-                        state = END;
-                        return processed;
-                    }
-                    break;
-                  
-                default:
+                    else
+                        discardFrame (DISCARD_ODD_LENGTH);
+                    decoder.reset ();
+                    state = END;
+                }
+                break;
+              
+            default:
+                {
+                    switch (state)
                     {
-                        switch (state)
+                        case INIT:
+                        case DATA:
                         {
-                            case INIT:
-                                state = DATA;
-                            case DATA:
-                                if (bufferAscii.add (data))
-                                    break;
+                            bool error = decoder.carriageReturn; // Data after '\r'
+                            uint8 nibble = toByte (data, error);
+                            if (error)
+                            {
+                                // Packet structure incorrect, wait for next ':'
+                                discardFrame (DISCARD_INVALID_CHARACTER);
                                 state = TRASH;
-                                return SERIAL_BUFFER_OVERFLOW;
-                            default:
-                                // Do nothing
                                 break;
+                            }
+
+                            state = DATA;
+                            if (!decoder.hasHigh)
+                            {
+                                decoder.high = nibble;
+                                decoder.hasHigh = true;
+                                break;
+                            }
+
+                            uint8 value = (decoder.high << 4) | nibble;
+                            decoder.hasHigh = false;
+                            if (bufferBin.add (value))
+                            {
+                                decoder.sum += value;
+                                break;
+                            }
+                            discardFrame (DISCARD_OVERFLOW);
+                            state = TRASH;
+                            return false;
                         }
+                        default:
+                            // Do nothing
+                            break;
                     }
-                    break;
+                }
+                break;
+        }
+        return true;
+    }
+
+    // Read ongoing serial data (by blocks of SERIAL_READ_CHUNK_SIZE characters)
+    // and process packet if they are correctly composed.
+    // Return the number of characters read on the serial line.
+    // In case of error (e.g. SERIAL_BUFFER_OVERFLOW) return a negative number.
+    // Insert this function in a loop
+    int processIncomingSerialData (SerialPort* sp)
+    {
+        assert (sp != NULL);
+
+        bool rtu = configuration.framing == FRAMING_RTU;
+        bool overflow = false;
+        int processed = 0;
+
+        // Continue the response being sent
+        sendPendingResponse (false);
+
+        // A block never spans two frames when the backend times the
+        // characters: a single time is enough for the whole block
+        uint8 chunk [SERIAL_READ_CHUNK_SIZE];
+        int count;
+        bool silence;
+        while (true)
+        {
+            profileEnter (PROFILE_RECEIVE);
+            count = serialReadBlock (sp, chunk, sizeof (chunk), silence);
+            profileLeave ();
+            if (count <= 0)
+                break;
+            processed += count;
+
+            ProfileScope scope (PROFILE_DECODE);
+            uint32 now = getMicroseconds ();
+            for (int i = 0; i < count; i++)
+            {
+                if (!(rtu ? processRtuCharacter (sp, chunk [i], now, silence && i == 0) :
+                            processAsciiCharacter (sp, (char) chunk [i], now)))
+                    overflow = true;
             }
         }
+
+        // No more data: end of the RTU frame or ASCII timeouts
+        uint32 now = getMicroseconds ();
+        if (!rtu)
+            checkAsciiTimeouts (now);
+        else if (state == DATA && now - lastCharacterTime >= RTU_SILENCE_US)
+        {
+            ProfileScope scope (PROFILE_DECODE);
+            processPacket (*sp);
+            state = END;
+        }
+
+        return overflow ? SERIAL_BUFFER_OVERFLOW : processed;
+    }
+
+    int processSerialEvents (SerialPort* sp, long timeoutUs)
+    {
+        assert (sp != NULL);
+
+        // Wake up in time to end the RTU frame or discard the ASCII frame
+        uint32 now = getMicroseconds ();
+        long frameTimeout = pendingFrameTimeout (now);
+        if (frameTimeout >= 0 && (timeoutUs < 0 || frameTimeout < timeoutUs))
+            timeoutUs = frameTimeout;
+
+        // Wake up in time to queue the rest of the response being sent
+        if (isResponsePending () && (timeoutUs < 0 || RESPONSE_POLL_US < timeoutUs))
+            timeoutUs = RESPONSE_POLL_US;
+
+        // Between frames, wake up in time to store the option values
+        long persistWait = frameTimeout < 0 ? persistTimeout (now) : -1;
+        if (persistWait >= 0 && (timeoutUs < 0 || persistWait < timeoutUs))
+            timeoutUs = persistWait;
+
+        profileIdleBegin ();
+        int waitResult = serialWait (sp, timeoutUs);
+        profileIdleEnd ();
+        if (waitResult < 0)
+            return SERIAL_DISCONNECTED;
+        int processed = processIncomingSerialData (sp);
+
+        // Never delays a frame: the response is already sent
+        if (pendingFrameTimeout (getMicroseconds ()) < 0 && serialAvailable (sp) == 0)
+            persistOptions ();
+        return processed;
     }
 }
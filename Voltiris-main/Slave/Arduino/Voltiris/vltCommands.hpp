@@ -5,11 +5,67 @@
 
 namespace voltiris
 {
+    // Reason why the receiver discarded a frame
+    enum DiscardReason: uint8
+    {
+        DISCARD_NONE,                    // No frame discarded
+        DISCARD_INVALID_CHARACTER,       // Not an hex character (ASCII)
+        DISCARD_ODD_LENGTH,              // Odd number of hex characters (ASCII)
+        DISCARD_INCOMPLETE,              // ':' received before "\r\n" (ASCII)
+        DISCARD_INTER_CHARACTER_TIMEOUT, // Line silent within the frame (ASCII)
+        DISCARD_FRAME_TIMEOUT,           // Frame not complete in time (ASCII)
+        DISCARD_OVERFLOW,                // Frame larger than the receive buffer
+        DISCARD_TOO_SHORT,               // Frame shorter than a command
+        DISCARD_CHECKSUM,                // CRC8 (ASCII) or CRC-16 (RTU) mismatch
+        DISCARD_WRONG_SIZE,              // Size does not match the command
+        DISCARD_OTHER_SLAVE,             // Addressed to another slave
+        DISCARD_UNKNOWN_COMMAND,         // Neither 0x04 nor 0x10
+        DISCARD_REASON_COUNT
+    };
+
+    // Get the reason of the last discarded frame
+    DiscardReason getLastDiscardReason ();
+
+    // Health counter registers, read from HEALTH_ADDRESS_START with a 2 bytes
+    // step. Counters saturate at 0xffff, writing HEALTH_ADDRESS_START (any value,
+    // broadcast allowed) resets them:
+    // - HEALTH_FRAMES_RECEIVED: complete frames (before checksum verification)
+    // - HEALTH_RESPONSES_SENT: responses, including errors
+    // - HEALTH_ERROR_RESPONSES: error responses
+    // - HEALTH_LAST_DISCARD_REASON: getLastDiscardReason ()
+    // - HEALTH_DISCARDED + reason - 1: frames discarded for each DiscardReason
+    const uint16 HEALTH_FRAMES_RECEIVED = 0;
+    const uint16 HEALTH_RESPONSES_SENT = 1;
+    const uint16 HEALTH_ERROR_RESPONSES = 2;
+    const uint16 HEALTH_LAST_DISCARD_REASON = 3;
+    const uint16 HEALTH_DISCARDED = 4;
+    const uint16 HEALTH_REGISTERS = HEALTH_DISCARDED + DISCARD_REASON_COUNT - 1;
+    const uint16 HEALTH_ADDRESS_END = HEALTH_ADDRESS_START + 2 * (HEALTH_REGISTERS - 1);
+
+    static_assert (HEALTH_ADDRESS_END < BUFFER_ADDRESS_START, "Health registers overlap the memory buffer");
+
+    // Get the health counter register at index (0 to HEALTH_REGISTERS - 1)
+    uint16 getHealthRegister (uint16 index);
+
+    // Reset the health counters
+    void resetHealthCounters ();
+
     // Process incoming data coming from the serial port
     // Should be placed in a loop and called regularily
-    // Function return after processing incoming data or
-    // if no serial data is available.
+    // Function return once every available character is processed.
     // Return value is the number of processed characters or
     // SERIAL_BUFFER_OVERFLOW (-1)
+    // With FRAMING_RTU, a frame is processed once the line is silent:
+    // the function should also be called when no data is available.
+    // Responses are queued as the serial port accepts them: the
+    // function also continues the response being sent.
     int processIncomingSerialData (SerialPort* sp);
+
+    // Event-driven replacement of processIncomingSerialData () in the main loop:
+    // wait (sleeping with serialWait ()) until a character is received,
+    // a RTU frame ends, the rest of a response can be queued (RESPONSE_POLL_US),
+    // option values are due to be stored (see vltPersist.hpp) or timeoutUs
+    // expires (negative: no timeout), then process incoming data.
+    // Return as processIncomingSerialData () or SERIAL_DISCONNECTED
+    int processSerialEvents (SerialPort* sp, long timeoutUs = -1);
 }
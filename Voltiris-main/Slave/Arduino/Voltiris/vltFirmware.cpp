@@ -1,4 +1,5 @@
 #include "vltFirmware.hpp"
+#include "vltPersist.hpp"
 
 namespace voltiris
 {
@@ -8,6 +9,12 @@ namespace voltiris
     {
         buffer.reset ();
         configuration.slaveId = (randomByte () % MAX_SLAVE_ID) + 1;
+        configuration.framing = FRAMING_ASCII;
+        configuration.interCharacterTimeoutUs = DEFAULT_INTER_CHARACTER_TIMEOUT_US;
+        configuration.frameTimeoutUs = DEFAULT_FRAME_TIMEOUT_US;
+        configuration.persistDelayUs = DEFAULT_PERSIST_DELAY_US;
+        configuration.persistMaxDelayUs = DEFAULT_PERSIST_MAX_DELAY_US;
         customSetup ();
+        restoreOptions ();
     }
 }
\ No newline at end of file
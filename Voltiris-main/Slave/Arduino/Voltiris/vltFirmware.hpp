@@ -21,6 +21,10 @@ namespace voltiris
     // IMPLEMENTATION SPECIFIC
     uint8* getSerialNumber ();
 
+    // Get a monotonic time in microseconds (may wrap around)
+    // IMPLEMENTATION SPECIFIC
+    uint32 getMicroseconds ();
+
     // Perform a hard reset
     // IMPLEMENTATION SPECIFIC
     void hardReset ();
@@ -29,16 +33,67 @@ namespace voltiris
     // IMPLEMENTATION SPECIFIC
     void customSetup ();
 
+    // Prepare the staging area of a firmware update of imageSize bytes (eg: erase it).
+    // Return false if the image does not fit or if the slave cannot be updated
+    // IMPLEMENTATION SPECIFIC
+    bool beginUpdateStaging (uint32 imageSize);
+
+    // Write size bytes of the firmware update image at offset in the staging area
+    // IMPLEMENTATION SPECIFIC
+    bool writeUpdateStaging (uint32 offset, const uint8* data, uint16 size);
+
+    // Read size bytes of the staged image at offset
+    // IMPLEMENTATION SPECIFIC
+    bool readUpdateStaging (uint32 offset, uint8* data, uint16 size);
+
+    // Install the verified staged image and restart on it (eg: flag it for the
+    // bootloader and reset). Should not return
+    // IMPLEMENTATION SPECIFIC
+    void activateUpdate (uint32 imageSize);
+
+    // Size of the non-volatile storage of the option values in bytes (eg: EEPROM),
+    // 0 disables the persistence of the options
+    // IMPLEMENTATION SPECIFIC
+    uint16 getStorageSize ();
+
+    // Read size bytes of the storage at offset (called by initialize ())
+    // IMPLEMENTATION SPECIFIC
+    void readStorage (uint16 offset, uint8* data, uint16 size);
+
+    // Start writing a byte of the storage at offset, without waiting for the end of the write.
+    // Return false if the storage is still busy with the previous write (nothing written)
+    // IMPLEMENTATION SPECIFIC
+    bool writeStorage (uint16 offset, uint8 value);
+
     // --------------------------
     // Initialization and globals
     // --------------------------
 
     struct Configuration {
         uint8 slaveId;
+
+        // Framing used on the serial line (default: FRAMING_ASCII)
+        // May be changed in customSetup ()
+        Framing framing;
+
+        // An ASCII frame is discarded when the line is silent during
+        // interCharacterTimeoutUs or when it is not complete after frameTimeoutUs
+        // (defaults: DEFAULT_INTER_CHARACTER_TIMEOUT_US, DEFAULT_FRAME_TIMEOUT_US,
+        // 0 disables the timeout). May be changed in customSetup ()
+        uint32 interCharacterTimeoutUs;
+        uint32 frameTimeoutUs;
+
+        // Option values are stored once no option changed during persistDelayUs,
+        // at the latest persistMaxDelayUs after the first change (defaults:
+        // DEFAULT_PERSIST_DELAY_US, DEFAULT_PERSIST_MAX_DELAY_US, 0 disables the
+        // latest delay). May be changed in customSetup ()
+        uint32 persistDelayUs;
+        uint32 persistMaxDelayUs;
     };
 
     extern Configuration configuration;
 
     // Should be called once to initialize library
+    // (option values are restored after customSetup ())
     void initialize ();    
 }
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "vltHelpers.hpp"
+
+// Framing and checksums of the packets, shared by the Slave
+// framework and the Master library ('../../../Master/Native')
+
+namespace voltiris
+{
+    // Size of a read input registers command (without checksum)
+    const uint8 READ_INPUT_REGISTERS_CMD_SIZE = 6;
+
+    // Size of a preset multiple registers command (without checksum and data)
+    const uint8 PRESET_MULT_REGISTERS_CMD_SIZE = 7;
+
+    // Maximum number of registers in a read input registers
+    // response (byte count is a uint8)
+    const uint16 MAX_READ_INPUT_REGISTERS = 127;
+
+    // Code of the read input registers command
+    const uint8 READ_INPUT_REGISTERS_CMD = 0x04;
+
+    // Code of the preset multiple registers command
+    const uint8 PRESET_MULT_REGISTERS_CMD = 0x10;
+
+
+    // Convert and ASCII character (eg: 'F') to binary (eg 0xf)
+    static inline uint8 toByte (const char c, bool& error)
+    {
+        if (c >= '0' && c <= '9')
+            return (uint8) (c - '0');
+        if (c >= 'a' && c <= 'f')
+            return (uint8) (c - 'a' + 10);
+        if (c >= 'A' && c <= 'F')
+            return (uint8) (c - 'A' + 10);
+        error = true;
+        return 0;
+    }
+
+    // Convert a value from 0 to 0xf to a character
+    static inline char toChar (uint8 in)
+    {
+        if (in <= 9)
+            return in + '0';
+        in -= 10;
+        return in + 'A';
+    }
+
+    // Convert a byte to 2 characters representing the number in hex
+    static inline void toChar (uint8 in, char& hi, char& low)
+    {
+        hi  = toChar (in >> 4);
+        low = toChar (in & 0xf);
+    }
+
+    // Update a CRC-16 (Modbus RTU) with a byte
+    static inline uint16 updateCRC16 (uint16 crc16, const uint8 value)
+    {
+        crc16 ^= value;
+        for (uint8 bit = 0; bit < 8; bit++)
+            crc16 = (crc16 & 1) ? (crc16 >> 1) ^ 0xa001 : crc16 >> 1;
+        return crc16;
+    }
+
+    // Compute the CRC-16 (Modbus RTU) of size bytes
+    static inline uint16 computeCRC16 (const uint8* data, const uint16 size)
+    {
+        uint16 crc16 = 0xffff;
+        for (uint16 i = 0; i < size; i++)
+            crc16 = updateCRC16 (crc16, data [i]);
+        return crc16;
+    }
+
+    // Compute the CRC8 (ASCII, sum of the bytes) of size bytes
+    static inline uint8 computeCRC8 (const uint8* data, const uint16 size)
+    {
+        uint8 crc8 = 0;
+        for (uint16 i = 0; i < size; i++)
+            crc8 += data [i];
+        return crc8;
+    }
+}
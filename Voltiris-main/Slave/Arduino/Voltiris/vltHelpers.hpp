@@ -1,5 +1,14 @@
 #pragma once
 
+#ifndef ARDUINO
+
+    #include <stdint.h>
+    #include <stdarg.h>
+    #include <stdio.h>
+    #include <string.h>
+
+#endif
+
 namespace voltiris
 {
     #ifdef ARDUINO
@@ -9,43 +18,185 @@ namespace voltiris
         typedef uint8_t  uint8;
         typedef uint16_t uint16;
         typedef int16_t  int16;
+        typedef uint32_t uint32;
         
         void assert (bool condition);
 
+        // Place constant data (option descriptors) in program memory
+        #define VOLTIRIS_PROGMEM PROGMEM
+
+        // Copy size bytes from program memory
+        inline void readProgmem (void* destination, const void* source, uint16 size)
+        {
+            memcpy_P (destination, source, size);
+        }
+
+        // Copy a string from program memory (truncated to capacity - 1 characters)
+        inline void readProgmemString (char* destination, const char* source, uint16 capacity)
+        {
+            strncpy_P (destination, source, capacity - 1);
+            destination [capacity - 1] = 0;
+        }
+
     #else
+
+        typedef uint8_t  uint8;
+        typedef uint16_t uint16;
+        typedef int16_t  int16;
+        typedef uint32_t uint32;
     
         // Write custom assert if needed
         inline void assert (bool condition) {}
 
+        // No separate program memory
+        #define VOLTIRIS_PROGMEM
+
+        inline void readProgmem (void* destination, const void* source, uint16 size)
+        {
+            memcpy (destination, source, size);
+        }
+
+        inline void readProgmemString (char* destination, const char* source, uint16 capacity)
+        {
+            strncpy (destination, source, capacity - 1);
+            destination [capacity - 1] = 0;
+        }
+
     #endif
 
 
+    // --------------
+    // Memory profile
+    // --------------
+
+    // Presets of VOLTIRIS_MEMORY_PROFILE
+    #define VOLTIRIS_MEMORY_SMALL   0 // Smaller MCU: 160 bytes memory buffer, 8 options with short names
+    #define VOLTIRIS_MEMORY_DEFAULT 1
+    #define VOLTIRIS_MEMORY_LARGE   2 // More options, frames and responses queued without waiting
+
+    #ifndef VOLTIRIS_MEMORY_PROFILE
+        #define VOLTIRIS_MEMORY_PROFILE VOLTIRIS_MEMORY_DEFAULT
+    #endif
+
+    // Sizes fixing the static RAM of the framework, checked below
+    struct MemoryProfile
+    {
+        uint16 bufferSize;        // Memory buffer (BUFFER_ADDRESS_START), largest memory read / write
+        uint8  maxOptions;        // Options given to setOptions ()
+        uint8  maxOptionNameSize; // Option name with the terminating 0
+        uint16 rxRingSize;        // Receive ring of interrupt-driven serial backends
+        uint16 txRingSize;        // Transmit ring of interrupt-driven serial backends
+        uint8  maxSlaveId;        // Slaves on the bus (same value on the Master)
+        uint16 maxUpdateBlocks;   // Blocks of a firmware update image (one bit each)
+    };
+
+    constexpr MemoryProfile MEMORY_PROFILES [] =
+    {
+        {160, 8,  16, 32,  64,  33, 256},  // VOLTIRIS_MEMORY_SMALL:   32KB images
+        {254, 16, 32, 64,  128, 33, 512},  // VOLTIRIS_MEMORY_DEFAULT: 64KB images
+        {254, 48, 32, 256, 256, 33, 2048}  // VOLTIRIS_MEMORY_LARGE:   256KB images
+    };
+
+    static_assert (VOLTIRIS_MEMORY_PROFILE >= 0 && VOLTIRIS_MEMORY_PROFILE < sizeof (MEMORY_PROFILES) / sizeof (MemoryProfile),
+                   "Unknown VOLTIRIS_MEMORY_PROFILE");
+
+    constexpr MemoryProfile MEMORY_PROFILE = MEMORY_PROFILES [VOLTIRIS_MEMORY_PROFILE];
+
+
     // --------------------
     // Serial configuration
     // --------------------
     
+    // Baud rate of the serial line (8 data bits, no parity, 1 stop bit)
+    const uint32 SERIAL_BAUD_RATE = 115200;
+
+    // Framing of the packets on the serial line
+    enum Framing: uint8
+    {
+        FRAMING_ASCII, // ':' + hex characters + CRC8 + "\r\n"
+        FRAMING_RTU    // Binary, CRC-16 and delimited by 3.5 characters of silence
+    };
+
+    // Silence delimiting RTU frames at baudRate (in microseconds).
+    // 3.5 characters, fixed to 1750us above 19200 bauds (Modbus over serial line)
+    constexpr uint32 rtuSilenceUs (uint32 baudRate)
+    {
+        return baudRate > 19200 ? 1750 : (35 * 1000000 / baudRate);
+    }
+
+    // Silence delimiting RTU frames on the serial line (in microseconds)
+    const uint32 RTU_SILENCE_US = rtuSilenceUs (SERIAL_BAUD_RATE);
+
     // Messages from the serial interface
     const int SERIAL_NO_DATA = 0;
     const int SERIAL_NO_CHARACTER_AVAILABLE = -1;
 
-    // Size of the buffer when receiving commands
-    // Maximum buffer size is 0xff + header (':') + end ('\r\n');
-    const int SERIAL_BUFFER_SIZE = 2 * 256 + 3;
+    // Size of the longest ASCII frame: header (':'), write of the whole
+    // memory buffer (7 bytes + data) and CRC8 in hex, end ('\r\n')
+    const int SERIAL_BUFFER_SIZE = 1 + 2 * (7 + MEMORY_PROFILE.bufferSize + 1) + 2;
+
+    // Default maximum silence between two characters of an ASCII frame (in microseconds)
+    const uint32 DEFAULT_INTER_CHARACTER_TIMEOUT_US = 10000;
+
+    // Default maximum duration of an ASCII frame, from ':' to '\n' (in microseconds):
+    // twice the time needed to send the longest frame (about 90ms at 115200 bauds)
+    const uint32 DEFAULT_FRAME_TIMEOUT_US = 2 * 10 * 1000000 / SERIAL_BAUD_RATE * SERIAL_BUFFER_SIZE;
 
     // Buffer overflow error when processIncomingSerialData ()
     const int SERIAL_BUFFER_OVERFLOW = -1;
 
+    // The serial line is gone (processSerialEvents ())
+    const int SERIAL_DISCONNECTED = -2;
+
+    // Size of the chunks read with serialReadBlock () when receiving commands
+    const int SERIAL_READ_CHUNK_SIZE = 32;
+
+    // Size of the chunks given to serialWriteNonBlocking () when sending a response
+    const int SERIAL_WRITE_CHUNK_SIZE = 32;
+
+    // Size of the receive and transmit ring buffers of interrupt-driven
+    // serial backends (power of 2, at most 256).
+    // Longer responses are queued as the transmit ring empties
+    const uint16 SERIAL_RX_RING_SIZE = MEMORY_PROFILE.rxRingSize;
+    const uint16 SERIAL_TX_RING_SIZE = MEMORY_PROFILE.txRingSize;
+
+    // Wait of processSerialEvents () between two calls to serialWriteNonBlocking ()
+    // while a response is sent (in microseconds): half of the transmit ring
+    const long RESPONSE_POLL_US = (long) (10 * 1000000 / SERIAL_BAUD_RATE * (SERIAL_TX_RING_SIZE / 2));
+
     // ---------------------
     // Options configuration
     // ---------------------
     
     // Maximim number of options
-    const int MAX_OPTIONS = 16; // To change !!!
+    const int MAX_OPTIONS = MEMORY_PROFILE.maxOptions;
+
+    // Maximum number of option registers (sum of the option dimensions)
+    const int MAX_OPTION_REGISTERS = 4 * MAX_OPTIONS;
+
+    // Maximum size of an option name (with the terminating 0)
+    const int MAX_OPTION_NAME_SIZE = MEMORY_PROFILE.maxOptionNameSize;
+
+    // Size of a binary option descriptor without the name characters
+    // (see Option::convertToBinary ())
+    const uint16 OPTION_DESCRIPTOR_HEADER_SIZE = 13;
+
+    // Maximum size of a binary option descriptor
+    const uint16 MAX_OPTION_DESCRIPTOR_SIZE = OPTION_DESCRIPTOR_HEADER_SIZE + MAX_OPTION_NAME_SIZE - 1;
+
+    // Maximum size of the JSON description of an option
+    // (see Option::convertToJson (), written in the memory buffer)
+    const uint16 MAX_OPTION_JSON_SIZE = 140 + MAX_OPTION_NAME_SIZE - 1;
+
+    // Default quiet time after an option change before the option values are
+    // stored (see vltPersist.hpp), and longest delay while options keep changing
+    const uint32 DEFAULT_PERSIST_DELAY_US = 1000000;
+    const uint32 DEFAULT_PERSIST_MAX_DELAY_US = 10000000;
 
     // Address where the option addresses are stored
     const uint16 OPTIONS_ADDRESS_START = 0x300;
 
-    // Computed dynamically
+    // Computed by setOptions ()
     extern uint16 OPTIONS_ADDRESS_END;
     
 
@@ -59,19 +210,40 @@ namespace voltiris
     // Address where the memory version is stored
     const uint16 MEMORY_VERSION_ADDRESS = 0x100;
 
+    // Address of the timing profile registers (see vltProfile.hpp)
+    const uint16 PROFILE_ADDRESS_START = 0x102;
+
+    // Address of the health counter registers (see vltCommands.hpp)
+    const uint16 HEALTH_ADDRESS_START = 0x1c0;
+
     // Address of the different memory access
     const uint16 CMD_HARD_RESET         = 0x00;
     const uint16 CMD_RESET_SLAVE_ID     = 0x01;
     const uint16 CMD_SLAVE_INDENT       = 0x02;
+    const uint16 CMD_DISCOVERY_START    = 0x03;
+    const uint16 CMD_DISCOVERY_PROBE    = 0x04;
+    const uint16 CMD_DISCOVERY_ASSIGN   = 0x05;
     const uint16 CMD_GET_OPT_INFO_START = 0x20;
     const uint16 CMD_GET_OPT_INFO_END   = 0x50;
+    const uint16 CMD_GET_OPT_DESC_START = 0x60;
+    const uint16 CMD_GET_OPT_DESC_END   = 0x90;
+    const uint16 CMD_DUMP_OPT_DESC_START = 0xa0;
+    const uint16 CMD_DUMP_OPT_DESC_END   = 0xaf;
+    const uint16 CMD_SNAPSHOT_TRACE      = 0xb0;
+    const uint16 CMD_UPDATE_START        = 0xc0;
+    const uint16 CMD_UPDATE_BLOCK        = 0xc1;
+    const uint16 CMD_UPDATE_STATUS       = 0xc2;
+    const uint16 CMD_UPDATE_VERIFY       = 0xc3;
+    const uint16 CMD_UPDATE_ACTIVATE     = 0xc4;
+    const uint16 CMD_UPDATE_MISSING_START = 0xc8;
+    const uint16 CMD_UPDATE_MISSING_END   = 0xcf;
     
+    // Size of the memory buffer
+    const uint16 BUFFER_SIZE = MEMORY_PROFILE.bufferSize;
+
     // Address where the memory buffer is stored
     const uint16 BUFFER_ADDRESS_START   = 0x200;
-    const uint16 BUFFER_ADDRESS_END     = 0x2fe;
-    
-    // Size of the memory buffer
-    const uint16 BUFFER_SIZE = BUFFER_ADDRESS_END - BUFFER_ADDRESS_START;
+    const uint16 BUFFER_ADDRESS_END     = BUFFER_ADDRESS_START + BUFFER_SIZE;
     
 
     // -------------------
@@ -79,7 +251,67 @@ namespace voltiris
     // -------------------
 
     // Maximum ID of slave
-    const uint8 MAX_SLAVE_ID = 33;
+    const uint8 MAX_SLAVE_ID = MEMORY_PROFILE.maxSlaveId;
+
+    // Slave address of the packets sent to all slaves
+    const uint8 BROADCAST_SLAVE_ID = 0;
+
+    // Slave address of the discovery packets (CMD_DISCOVERY_*), processed by
+    // all slaves whatever their id (first address reserved by Modbus)
+    const uint8 DISCOVERY_SLAVE_ID = 248;
+
+    // Registers of a discovery probe (prefix length in bits, 64 bits prefix)
+    // or assignment (64 bits serial number, id)
+    const uint16 DISCOVERY_REGISTERS = 5;
+
+    // Size of the serial number returned by getSerialNumber ()
+    const uint8 SERIAL_NUMBER_SIZE = 8;
+
+    // Firmware update (see vltUpdate.hpp): image bytes per block (the last
+    // block may be shorter), blocks of an image and bytes of a missing-block
+    // bitmap page (CMD_UPDATE_MISSING_START + page)
+    const uint16 UPDATE_BLOCK_SIZE = 128;
+    const uint16 MAX_UPDATE_BLOCKS = MEMORY_PROFILE.maxUpdateBlocks;
+    const uint16 UPDATE_BITMAP_PAGE_SIZE = 128;
+
+    // Per-stage timing profile of the hot path (see vltProfile.hpp),
+    // 0 compiles it out
+    #ifndef VOLTIRIS_PROFILE
+        #define VOLTIRIS_PROFILE 0
+    #endif
+
+    // Number of frames kept by the trace (see vltTrace.hpp),
+    // 0 compiles it out
+    #ifndef VOLTIRIS_TRACE_SIZE
+        #if VOLTIRIS_MEMORY_PROFILE == VOLTIRIS_MEMORY_SMALL
+            #define VOLTIRIS_TRACE_SIZE 4
+        #elif VOLTIRIS_MEMORY_PROFILE == VOLTIRIS_MEMORY_LARGE
+            #define VOLTIRIS_TRACE_SIZE 21
+        #else
+            #define VOLTIRIS_TRACE_SIZE 16
+        #endif
+    #endif
+
+    // Memory profile checks
+    static_assert (BUFFER_SIZE >= 2 && BUFFER_SIZE % 2 == 0 && BUFFER_SIZE <= 254,
+                   "Memory buffer: whole registers, at most 254 bytes (byte count of a frame)");
+    static_assert (BUFFER_ADDRESS_END < OPTIONS_ADDRESS_START, "Memory buffer overlaps the options");
+    static_assert (MAX_OPTIONS >= 1 && MAX_OPTIONS <= CMD_GET_OPT_INFO_END - CMD_GET_OPT_INFO_START + 1 &&
+                   MAX_OPTIONS <= CMD_GET_OPT_DESC_END - CMD_GET_OPT_DESC_START + 1,
+                   "Every option must have an info and a descriptor address");
+    static_assert (MAX_OPTION_NAME_SIZE >= 2 && MAX_OPTION_DESCRIPTOR_SIZE <= BUFFER_SIZE,
+                   "Option descriptor does not fit in the memory buffer");
+    static_assert (MAX_OPTION_JSON_SIZE + 2 <= BUFFER_SIZE, // Formatting needs a safe byte for '\0'
+                   "JSON description of an option does not fit in the memory buffer");
+    static_assert (SERIAL_RX_RING_SIZE >= 2 && SERIAL_RX_RING_SIZE <= 256 && (SERIAL_RX_RING_SIZE & (SERIAL_RX_RING_SIZE - 1)) == 0 &&
+                   SERIAL_TX_RING_SIZE >= 2 && SERIAL_TX_RING_SIZE <= 256 && (SERIAL_TX_RING_SIZE & (SERIAL_TX_RING_SIZE - 1)) == 0,
+                   "Serial ring sizes must be powers of 2 (at most 256)");
+    static_assert (MAX_SLAVE_ID >= 1 && MAX_SLAVE_ID < DISCOVERY_SLAVE_ID, "Slave ids are 1 to MAX_SLAVE_ID");
+    static_assert (UPDATE_BLOCK_SIZE + 4 <= BUFFER_SIZE, // Block index and CRC-16 around the data
+                   "Firmware update block frame does not fit in the receive buffer");
+    static_assert (MAX_UPDATE_BLOCKS >= 16 && MAX_UPDATE_BLOCKS % 16 == 0 &&
+                   MAX_UPDATE_BLOCKS <= 8 * UPDATE_BITMAP_PAGE_SIZE * (CMD_UPDATE_MISSING_END - CMD_UPDATE_MISSING_START + 1),
+                   "Missing-block bitmap: whole registers, within the bitmap pages");
 
     // --------------------
     // Helper class
@@ -108,6 +340,42 @@ namespace voltiris
         }
     };
 
+    // Ring buffer with a single producer and a single consumer
+    // (eg: an interrupt and the main loop). Indices are 8 bits wide so that
+    // they are read and written atomically on 8 bits MCU.
+    // Capacity must be a power of 2 (at most 256), capacity - 1 bytes can be stored
+    template<uint16 _capacity> struct RingBuffer
+    {
+        static_assert (_capacity >= 2 && _capacity <= 256 && (_capacity & (_capacity - 1)) == 0,
+                       "Ring buffer capacity must be a power of 2 (at most 256)");
+
+        volatile uint8 data [_capacity];
+        volatile uint8 head = 0; // Next slot written by the producer
+        volatile uint8 tail = 0; // Next slot read by the consumer
+
+        uint16 size () const { return (uint8) (head - tail) & (_capacity - 1); }
+        uint16 space () const { return _capacity - 1 - size (); }
+
+        bool push (const uint8 val)
+        {
+            uint8 next = (head + 1) & (_capacity - 1);
+            if (next == tail)
+                return false;
+            data [head] = val;
+            head = next;
+            return true;
+        }
+
+        bool pop (uint8& val)
+        {
+            if (tail == head)
+                return false;
+            val = data [tail];
+            tail = (tail + 1) & (_capacity - 1);
+            return true;
+        }
+    };
+
     // R/W buffer used for memory operations (0x200)
     extern Buffer<BUFFER_SIZE> buffer;
 }
@@ -1,62 +1,104 @@
 #include "vltHelpers.hpp"
 #include "vltOption.hpp"
+#include "vltPersist.hpp"
+#include "vltProfile.hpp"
 
 namespace voltiris
 {
-    static Option* options [MAX_OPTIONS];
+    // Table of option descriptors (in program memory)
+    static const Option* const* options = NULL;
     static uint16 optionsCount = 0;
 
+    // Index of the option registers: entry i describes the register at
+    // address OPTIONS_ADDRESS_START + 2 * i, packed as
+    // (option index << 2) | element index (dimension is at most 4)
+    static uint8 registers [MAX_OPTION_REGISTERS];
+    static_assert (MAX_OPTIONS <= 64, "Option index must fit on 6 bits");
+
     uint16 OPTIONS_ADDRESS_END = OPTIONS_ADDRESS_START;
 
-    bool addOption (Option& option)
+    // Copy the descriptor of option index of table from program memory
+    static inline void loadOption (const Option* const* table, uint16 index, Option& option)
+    {
+        const Option* opt;
+        readProgmem (&opt, table + index, sizeof (opt));
+        readProgmem (&option, opt, sizeof (Option));
+    }
+
+    static inline void loadOption (uint16 index, Option& option)
+    {
+        loadOption (options, index, option);
+    }
+
+    bool setOptions (const Option* const* table, uint16 count)
     {
-        if (optionsCount + 1 >= MAX_OPTIONS)
+        // No option is served until the whole table is checked
+        options = NULL;
+        optionsCount = 0;
+        OPTIONS_ADDRESS_END = OPTIONS_ADDRESS_START;
+
+        if (count > MAX_OPTIONS)
             return false;
 
-        // Initialize address (no shuffle)
-        if (optionsCount == 0)
-            option.address = OPTIONS_ADDRESS_START;
-        else
-            option.address = OPTIONS_ADDRESS_END;
-        OPTIONS_ADDRESS_END = option.address + option.getTypeSize () * (uint16) option.dimension;
-            
-        options [optionsCount++] = &option;
+        // Addresses are computed at compile time, only check them
+        Option option;
+        uint16 end = OPTIONS_ADDRESS_START;
+        for (uint16 i = 0; i < count; i++)
+        {
+            loadOption (table, i, option);
+
+            uint16 firstRegister = (end - OPTIONS_ADDRESS_START) / option.getTypeSize ();
+            if (option.address != end ||
+                firstRegister + (uint16) option.dimension > MAX_OPTION_REGISTERS)
+                return false;
+            end = nextOptionAddress (option);
+        }
+
+        for (uint16 i = 0; i < count; i++)
+        {
+            loadOption (table, i, option);
+            uint16 firstRegister = (option.address - OPTIONS_ADDRESS_START) / option.getTypeSize ();
+            for (uint16 j = 0; j < (uint16) option.dimension; j++)
+                registers [firstRegister + j] = (uint8) ((i << 2) | j);
+        }
+
+        options = table;
+        optionsCount = count;
+        OPTIONS_ADDRESS_END = end;
         return true;
     }
 
-    Option* getOption (uint16 index)
+    bool getOption (uint16 index, Option& option)
     {
         if (index >= optionsCount)
-            return NULL;
-        return options [index];
+            return false;
+        loadOption (index, option);
+        return true;
     }
 
-    static Option* getOptionAtAddress (const uint16 address, uint16& index)
+    bool getOptionAtAddress (const uint16 address, Option& option, uint16& index)
     {
-        for (uint16 i = 0; i < optionsCount; i++)
-        {
-            Option* opt = options [i];
-            uint16 end = opt->address + opt->getTypeSize () * (uint16) opt->dimension;
-            if (address >= opt->address && address < end)
-            {
-                if ((address - opt->address) % opt->getTypeSize () != 0)
-                    return NULL;
-                index = (address - opt->address) / opt->getTypeSize ();
-                return opt;
-            }
-        }
-        return NULL;
+        if (address < OPTIONS_ADDRESS_START || address >= OPTIONS_ADDRESS_END)
+            return false;
+
+        uint16 offset = address - OPTIONS_ADDRESS_START;
+        if ((offset & 1) != 0)
+            return false;
+
+        uint8 entry = registers [offset >> 1];
+        index = entry & 0x3;
+        loadOption (entry >> 2, option);
+        return true;
     }
 
-    bool getOptionValueAtAddress (uint16 address, uint16& out)
+    bool getOptionValue (const Option& option, uint16 index, uint16& out)
     {
-        uint16 index;
-        Option* opt = getOptionAtAddress (address, index);
-        if (opt == NULL || opt->getValue == NULL)
+        if (option.getValue == NULL)
             return false;
 
-        Option::Value val = opt->getValue (*opt, index);
-        switch (opt->type)
+        ProfileScope scope (PROFILE_GET_VALUE);
+        Option::Value val = option.getValue (option, index);
+        switch (option.type)
         {
             case Option::INT_16: // Implicit typecast!
             case Option::UINT_16:
@@ -69,17 +111,79 @@ namespace voltiris
         return true;
     }
 
-    bool setOptionValueAtAddress (uint16 address, uint16 value)
+    bool getOptionValueAtAddress (uint16 address, uint16& out)
     {
         uint16 index;
-        Option* opt = getOptionAtAddress (address, index);
-        if (opt == NULL || opt->setValue == NULL)
+        Option opt;
+        if (!getOptionAtAddress (address, opt, index))
+            return false;
+        return getOptionValue (opt, index, out);
+    }
+
+    // Check that every register of the range belongs to an option
+    // with a getValue () (read) or a setValue () (write) callback,
+    // and optionally flagged as broadcast. Each option is loaded
+    // once for all its registers in the range
+    static bool isOptionRangeAccessible (uint16 address, uint16 numberOfUint16,
+                                         bool write, bool broadcast)
+    {
+        uint16 index;
+        Option opt;
+        while (numberOfUint16 > 0)
+        {
+            if (!getOptionAtAddress (address, opt, index))
+                return false;
+            if (write ? opt.setValue == NULL : opt.getValue == NULL)
+                return false;
+            if (broadcast && !opt.broadcast)
+                return false;
+
+            uint16 count = (uint16) opt.dimension - index;
+            if (count > numberOfUint16)
+                count = numberOfUint16;
+            numberOfUint16 -= count;
+            address += count * opt.getTypeSize ();
+        }
+        return true;
+    }
+
+    bool isOptionRangeReadable (uint16 address, uint16 numberOfUint16)
+    {
+        return isOptionRangeAccessible (address, numberOfUint16, false, false);
+    }
+
+    bool isOptionRangeWriteable (uint16 address, uint16 numberOfUint16)
+    {
+        return isOptionRangeAccessible (address, numberOfUint16, true, false);
+    }
+
+    bool isOptionRangeBroadcastable (uint16 address, uint16 numberOfUint16)
+    {
+        return isOptionRangeAccessible (address, numberOfUint16, true, true);
+    }
+
+    bool setOptionValue (const Option& option, uint16 index, uint16 value)
+    {
+        if (option.setValue == NULL)
             return false;
 
         Option::Value val;
         val.UINT_16 = value; // Implicit typecast!
     
-        return opt->setValue (*opt, index, val);
+        ProfileScope scope (PROFILE_SET_VALUE);
+        if (!option.setValue (option, index, val))
+            return false;
+        markOptionsDirty ();
+        return true;
+    }
+
+    bool setOptionValueAtAddress (uint16 address, uint16 value)
+    {
+        uint16 index;
+        Option opt;
+        if (!getOptionAtAddress (address, opt, index))
+            return false;
+        return setOptionValue (opt, index, value);
     }
 
     // Inspired by https://stackoverflow.com/questions/3919995/determining-sprintf-buffer-size-whats-the-standard
@@ -88,7 +192,7 @@ namespace voltiris
     {
         va_list args;
         va_start(args, format);
-            int count = vsnprintf (buffer + bufferIndex, bufferCapacity - bufferIndex, format, args);
+            int count = vsnprintf ((char*) buffer + bufferIndex, bufferCapacity - bufferIndex, format, args);
         va_end(args);
 
         if (count < 0 || bufferIndex + count + 1 /* safe byte for \0 */ >= bufferCapacity)
@@ -105,8 +209,11 @@ namespace voltiris
 
         uint16 bufferCapacity = bufferSize;
         bufferSize = 0;
+
+        char nameString [MAX_OPTION_NAME_SIZE];
+        readProgmemString (nameString, name, sizeof (nameString));
         
-        if (!addToBuffer (buffer, bufferCapacity, bufferSize, "{\"name\":\"%s\",", name)) return false;
+        if (!addToBuffer (buffer, bufferCapacity, bufferSize, "{\"name\":\"%s\",", nameString)) return false;
         switch (type)
         {
             case UINT_16:
@@ -179,4 +286,40 @@ namespace voltiris
         return true;
     }
 
+    static inline void put16 (uint8* buffer, uint16 value)
+    {
+        buffer [0] = (uint8) (value >> 8);
+        buffer [1] = (uint8) (value & 0xff);
+    }
+
+    bool Option::convertToBinary (uint8* buffer, uint16& bufferSize) const
+    {
+        char nameString [MAX_OPTION_NAME_SIZE];
+        readProgmemString (nameString, name, sizeof (nameString));
+        uint16 nameLength = (uint16) strlen (nameString);
+
+        if (bufferSize < OPTION_DESCRIPTOR_HEADER_SIZE + nameLength)
+            return false;
+        bufferSize = OPTION_DESCRIPTOR_HEADER_SIZE + nameLength;
+
+        uint8 access = 0;
+        if (getValue != NULL)
+            access |= READABLE;
+        if (setValue != NULL)
+            access |= WRITEABLE;
+        if (broadcast)
+            access |= BROADCAST;
+
+        buffer [0] = (uint8) type;
+        buffer [1] = access;
+        buffer [2] = (uint8) dimension;
+        buffer [3] = (uint8) unit;
+        put16 (buffer + 4, address);
+        put16 (buffer + 6, min.UINT_16); // Implicit typecast!
+        put16 (buffer + 8, max.UINT_16);
+        put16 (buffer + 10, scale.UINT_16);
+        buffer [12] = (uint8) nameLength;
+        memcpy (buffer + OPTION_DESCRIPTOR_HEADER_SIZE, nameString, nameLength);
+        return true;
+    }
 }
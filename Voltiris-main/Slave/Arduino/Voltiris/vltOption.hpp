@@ -5,39 +5,39 @@
 namespace voltiris
 {
     // Provide an option descriptor
-    // as well as get(), set() functions
+    // as well as get(), set() functions.
+    // Descriptors are constant: declare them at compile time with
+    // TypedOption::make () and place them in program memory (VOLTIRIS_PROGMEM)
     struct Option
     {
-        // Unique name of the option
-        char* name = NULL;
-
         // Type of the option
         enum Type: uint8
         {
             UINT_16,
             INT_16
-        } type;
-
-        // Check code if you change this value !
-        inline uint16 getTypeSize () {return 2; }
+        };
 
-        // Min, max and scale value of the option
+        // Value of the option
         union Value
         {
             uint16 UINT_16;
             int16 INT_16;
-        } min, max, scale;
+
+            Value () = default;
+            constexpr Value (uint16 value): UINT_16 (value) {}
+            constexpr Value (int16 value): INT_16 (value) {}
+        };
 
         // Get the value of this option for a specific dimension (index)
         // and alternatively set the option as Readable.
         // Return the effective value of the option.
-        Value (*getValue) (Option& option, uint16 index) = NULL;
+        typedef Value (*GetValue) (const Option& option, uint16 index);
 
         // Set the value of this option for a specific dimension (index)
         // and alternatively set the option as Writeable.
         // You need to check that value is within the defined min and max.
         // Return false if the option cannot be set.
-        bool  (*setValue) (Option& option, uint16 index, Value value) = NULL;
+        typedef bool (*SetValue) (const Option& option, uint16 index, Value value);
 
         // Dimension of the option
         enum Dimension: uint8 
@@ -45,7 +45,7 @@ namespace voltiris
             DIM_1 = 1,
             DIM_2 = 2,
             DIM_4 = 4
-        } dimension;
+        };
 
         // Unit of the option
         enum Unit: uint8 
@@ -54,63 +54,180 @@ namespace voltiris
             MILLIMETERS,
             MM_PER_SEC,
             VOLTS
-        } unit;
+        };
+
+        // Access flags of the binary descriptor
+        enum Access: uint8
+        {
+            READABLE  = 1,
+            WRITEABLE = 2,
+            BROADCAST = 4
+        };
+
+        // Unique name of the option (in program memory)
+        const char* name;
+
+        Type type;
+
+        // Min, max and scale value of the option
+        Value min, max, scale;
+
+        GetValue getValue;
+        SetValue setValue;
+
+        Dimension dimension;
+
+        Unit unit;
         
-        // Address will automatically be assigned when adding the option via addOption ()
-        uint16 address = 0;
+        // Address of the first register, see nextOptionAddress ()
+        uint16 address;
         
         // Set your own data (effective value or custom object)
-        void* userData = NULL;
+        void* userData;
 
         // Can option be broadcasted
         bool broadcast;
 
-        // Initialzation method for uint16 values
-        inline void init (const char* name,
-                          uint16 min, uint16 max, uint16 scale,
-                          Dimension dimension, Unit unit, bool broadcast)
-        {
-            this->name = name;
-            this->type = UINT_16;
-            this->min.UINT_16 = min,
-            this->max.UINT_16 = max,
-            this->scale.UINT_16 = scale,
-            this->dimension = dimension;
-            this->unit = unit;
-            this->broadcast = broadcast;
-        }
+        Option () = default;
 
-        // Initialzation method for int16 values
-        inline void init (const char* name,
-                          int16 min, int16 max, int16 scale,
-                          Dimension dimension, Unit unit, bool broadcast)
-        {
-            this->name = name;
-            this->type = INT_16;
-            this->min.INT_16 = min,
-            this->max.INT_16 = max,
-            this->scale.INT_16 = scale,
-            this->dimension = dimension;
-            this->unit = unit;
-            this->broadcast = broadcast;
-        }
+        constexpr Option (const char* name, Type type, Value min, Value max, Value scale,
+                          GetValue getValue, SetValue setValue, Dimension dimension, Unit unit,
+                          uint16 address, void* userData, bool broadcast)
+            : name (name), type (type), min (min), max (max), scale (scale),
+              getValue (getValue), setValue (setValue), dimension (dimension), unit (unit),
+              address (address), userData (userData), broadcast (broadcast) {}
+
+        // Check code if you change this value !
+        constexpr uint16 getTypeSize () const {return 2; }
 
         // Convert the option into a json representation
         // Return false if buffer is too small
         bool convertToJson (uint8* buffer, uint16& bufferSize) const;
+
+        // Convert the option into a compact binary descriptor
+        // (16 bits values are big endian, as registers):
+        //   0: type         1: access flags   2: dimension   3: unit
+        //   4: address      6: min            8: max        10: scale
+        //  12: name length 13: name (without terminating 0)
+        // Return false if buffer is too small
+        bool convertToBinary (uint8* buffer, uint16& bufferSize) const;
     };
 
+    // ------------------------------
+    // Compile-time option declaration
+    // ------------------------------
+
+    // Address following the registers of an option: address of the next option
+    constexpr uint16 nextOptionAddress (const Option& option)
+    {
+        return option.address + option.getTypeSize () * (uint16) option.dimension;
+    }
+
+    // Declaration mistakes detected by TypedOption::make ().
+    // These functions are not constexpr: reaching one of them while
+    // computing a constexpr option is a compilation error naming the mistake.
+    inline Option optionWithoutName () { assert (false); return Option (); }
+    inline Option optionNameTooLong () { assert (false); return Option (); }
+    inline Option optionValueOutOfRange () { assert (false); return Option (); }
+    inline Option optionMinGreaterThanMax () { assert (false); return Option (); }
+    inline Option optionWithoutAccess () { assert (false); return Option (); }
+    inline Option optionAddressInvalid () { assert (false); return Option (); }
+
+    // C++ type of the option values
+    template<typename T> struct OptionType;
+
+    template<> struct OptionType<uint16>
+    {
+        static constexpr Option::Type type = Option::UINT_16;
+        static constexpr long lowest = 0;
+        static constexpr long highest = 0xffff;
+    };
+
+    template<> struct OptionType<int16>
+    {
+        static constexpr Option::Type type = Option::INT_16;
+        static constexpr long lowest = -0x8000;
+        static constexpr long highest = 0x7fff;
+    };
+
+    constexpr uint16 optionNameLength (const char* name)
+    {
+        return *name == 0 ? 0 : 1 + optionNameLength (name + 1);
+    }
+
+    // Typed option of type T (uint16 or int16), dimension D and unit U
+    template<typename T, Option::Dimension D, Option::Unit U> struct TypedOption
+    {
+        // Build the descriptor of an option, to be used as:
+        //   static constexpr char nameX [] VOLTIRIS_PROGMEM = "X";
+        //   static Option::Value valX [D];
+        //   static constexpr Option optX VOLTIRIS_PROGMEM =
+        //       TypedOption<T, D, U>::make (nameX, min, max, scale, broadcast,
+        //                                   getX, setX, valX, address);
+        // address is OPTIONS_ADDRESS_START for the first option,
+        // nextOptionAddress (previous option) for the others
+        static constexpr Option make (const char* name, long min, long max, long scale, bool broadcast,
+                                      Option::GetValue getValue, Option::SetValue setValue,
+                                      Option::Value (&values) [D], uint16 address)
+        {
+            return name == NULL ? optionWithoutName () :
+                   optionNameLength (name) >= MAX_OPTION_NAME_SIZE ? optionNameTooLong () :
+                   !isInRange (min) || !isInRange (max) || !isInRange (scale) ? optionValueOutOfRange () :
+                   min > max ? optionMinGreaterThanMax () :
+                   getValue == NULL && setValue == NULL ? optionWithoutAccess () :
+                   address < OPTIONS_ADDRESS_START || (address & 1) != 0 ? optionAddressInvalid () :
+                   Option (name, OptionType<T>::type, (T) min, (T) max, (T) scale,
+                           getValue, setValue, D, U, address, values, broadcast);
+        }
+
+    private:
+
+        static constexpr bool isInRange (long value)
+        {
+            return value >= OptionType<T>::lowest && value <= OptionType<T>::highest;
+        }
+    };
+
+    // Check that the options of table follow each other from OPTIONS_ADDRESS_START
+    // and fit in MAX_OPTION_REGISTERS
+    constexpr bool isOptionLayoutValid (const Option* const* table, uint16 count, uint16 address)
+    {
+        return count == 0 ? address <= OPTIONS_ADDRESS_START + 2 * MAX_OPTION_REGISTERS :
+               table [0]->address == address &&
+               isOptionLayoutValid (table + 1, count - 1, nextOptionAddress (*table [0]));
+    }
+
+    // Compile-time check of an option table, ex:
+    //   static constexpr const Option* optionTable [] VOLTIRIS_PROGMEM = {&optX, &optY};
+    //   static_assert (isOptionTableValid (optionTable), "Invalid option table");
+    template<uint16 N> constexpr bool isOptionTableValid (const Option* const (&table) [N])
+    {
+        return N <= MAX_OPTIONS && isOptionLayoutValid (table, N, OPTIONS_ADDRESS_START);
+    }
+
     // -----------------
     // Options functions
     // -----------------
 
-    // Add an option to the option pool.
-    // Return false in case of an overflow (increase MAX_OPTIONS)
-    bool addOption (Option& option);
+    // Set the options of the slave: table of option descriptors,
+    // table and descriptors in program memory (see isOptionTableValid ()).
+    // Return false if the table is invalid (the slave then has no option)
+    bool setOptions (const Option* const* table, uint16 count);
+
+    template<uint16 N> inline bool setOptions (const Option* const (&table) [N])
+    {
+        static_assert (N <= MAX_OPTIONS, "Too many options (increase MAX_OPTIONS)");
+        return setOptions (table, N);
+    }
+
+    // Copy the descriptor of an option given its index.
+    // Return false in case index is out of bounds
+    bool getOption (uint16 index, Option& option);
 
-    // Get an option given its index.
-    // Return NULL in case index is out of bounds
-    Option* getOption (uint16 index);
+    // Constant time lookup of the option and element index at address
+    // (in option memory). Return false if no option starts a register there
+    // Note: assume that option size is 2!
+    bool getOptionAtAddress (const uint16 address, Option& option, uint16& index);
 
     // Get operation at address (in option memory)
     // Will retrieve the option that has a specified 
@@ -119,10 +236,33 @@ namespace voltiris
     // Note: assume that option size is 2!
     bool getOptionValueAtAddress (uint16 address, uint16& out);
 
+    // Same as getOptionValueAtAddress () for element index of an option
+    // found by getOptionAtAddress (): consecutive registers of an option
+    // are read without looking the option up again
+    bool getOptionValue (const Option& option, uint16 index, uint16& out);
+
+    // Check that numberOfUint16 consecutive registers starting at address
+    // (in option memory) can be read with getOptionValueAtAddress ().
+    // The range may cross several options.
+    bool isOptionRangeReadable (uint16 address, uint16 numberOfUint16);
+
+    // Check that numberOfUint16 consecutive registers starting at address
+    // (in option memory) can be set with setOptionValueAtAddress ().
+    // The range may cross several options.
+    bool isOptionRangeWriteable (uint16 address, uint16 numberOfUint16);
+
+    // Same as isOptionRangeWriteable (), every option of the range
+    // must also be flagged as broadcast
+    bool isOptionRangeBroadcastable (uint16 address, uint16 numberOfUint16);
+
     // Set option at address (in option memory)
     // Will retrieve the option that has a specified 
     // address and call attached callback (setValue())
     // Return false in case of an error
     // Note: assume that option size is 2!
     bool setOptionValueAtAddress (uint16 address, uint16 value);
+
+    // Same as setOptionValueAtAddress () for element index of an option
+    // found by getOptionAtAddress ()
+    bool setOptionValue (const Option& option, uint16 index, uint16 value);
 }
@@ -0,0 +1,266 @@
+#include "vltPersist.hpp"
+#include "vltFirmware.hpp"
+#include "vltFraming.hpp"
+#include "vltOption.hpp"
+
+namespace voltiris
+{
+    static bool changed = false;  // Set by markOptionsDirty (), timed by persistOptions ()
+    static bool dirty = false;    // Values changed since the last record
+    static uint32 firstChange = 0;
+    static uint32 lastChange = 0;
+
+    // Slots of the storage (no slot: no persistence)
+    static uint16 recordSize = 0;
+    static uint16 slotCount = 0;
+    static uint16 layoutCrc = 0;
+
+    // Slot and sequence number of the next record
+    static uint16 slot = 0;
+    static uint16 sequence = 0;
+    static bool stored = false;     // A record holds storedValuesCrc
+    static uint16 storedValuesCrc = 0;
+
+    // Record being written
+    static bool writing = false;
+    static uint16 writeIndex = 0;
+    static uint16 writeCrc = 0;
+    static uint16 writeValuesCrc = 0;
+    static uint16 writeValue = 0;   // Both bytes of a register come from the same getValue ()
+
+    static inline uint16 registerCount ()
+    {
+        return (OPTIONS_ADDRESS_END - OPTIONS_ADDRESS_START) / 2;
+    }
+
+    // Value stored for register index, 0 if it cannot be read. The callbacks are
+    // called directly: background work is not Master time in the timing profile
+    static inline uint16 registerValue (uint16 index)
+    {
+        Option option;
+        uint16 element;
+        if (!getOptionAtAddress (OPTIONS_ADDRESS_START + 2 * index, option, element) || option.getValue == NULL)
+            return 0;
+        return option.getValue (option, element).UINT_16; // Implicit typecast!
+    }
+
+    static inline uint16 updateCRC16 (uint16 crc16, uint16 value)
+    {
+        return voltiris::updateCRC16 (voltiris::updateCRC16 (crc16, (uint8) (value >> 8)), (uint8) (value & 0xff));
+    }
+
+    // Name, type and dimension of every option: a record of another
+    // option table is not restored
+    static uint16 computeLayoutCrc ()
+    {
+        uint16 crc16 = 0xffff;
+        Option option;
+        char name [MAX_OPTION_NAME_SIZE];
+        for (uint16 i = 0; getOption (i, option); i++)
+        {
+            readProgmemString (name, option.name, sizeof (name));
+            for (const char* c = name; *c != 0; c++)
+                crc16 = voltiris::updateCRC16 (crc16, (uint8) *c);
+            crc16 = voltiris::updateCRC16 (crc16, option.type);
+            crc16 = voltiris::updateCRC16 (crc16, option.dimension);
+        }
+        return crc16;
+    }
+
+    // CRC-16 of the current values
+    static uint16 computeValuesCrc ()
+    {
+        uint16 crc16 = 0xffff;
+        for (uint16 i = 0; i < registerCount (); i++)
+            crc16 = updateCRC16 (crc16, registerValue (i));
+        return crc16;
+    }
+
+    static inline uint16 readStorage16 (uint16 offset)
+    {
+        uint8 data [2];
+        readStorage (offset, data, 2);
+        return ((uint16) data [0] << 8) | (uint16) data [1];
+    }
+
+    // Check the record of a slot (a write interrupted by a power cut fails the CRC-16)
+    static bool readRecord (uint16 recordSlot, uint16& recordSequence, uint16& valuesCrc)
+    {
+        uint16 offset = recordSlot * recordSize;
+        uint8 header [PERSIST_HEADER_SIZE];
+        readStorage (offset, header, PERSIST_HEADER_SIZE);
+        if (header [0] != PERSIST_MAGIC ||
+            (((uint16) header [3] << 8) | (uint16) header [4]) != layoutCrc ||
+            header [5] != registerCount ())
+            return false;
+
+        uint16 crc16 = computeCRC16 (header, PERSIST_HEADER_SIZE);
+        valuesCrc = 0xffff;
+        for (uint16 i = 0; i < registerCount (); i++)
+        {
+            uint16 value = readStorage16 (offset + PERSIST_HEADER_SIZE + 2 * i);
+            crc16 = updateCRC16 (crc16, value);
+            valuesCrc = updateCRC16 (valuesCrc, value);
+        }
+        if (readStorage16 (offset + recordSize - 2) != crc16)
+            return false;
+
+        recordSequence = ((uint16) header [1] << 8) | (uint16) header [2];
+        return true;
+    }
+
+    void restoreOptions ()
+    {
+        recordSize = PERSIST_HEADER_SIZE + 2 * registerCount () + 2;
+        slotCount = registerCount () == 0 ? 0 : getStorageSize () / recordSize;
+        layoutCrc = computeLayoutCrc ();
+
+        // Sequence numbers wrap around: the last record is
+        // the one no other record follows
+        bool found = false;
+        uint16 last = 0;
+        for (uint16 s = 0; s < slotCount; s++)
+        {
+            uint16 recordSequence, valuesCrc;
+            if (!readRecord (s, recordSequence, valuesCrc))
+                continue;
+            if (found && (int16) (recordSequence - sequence) <= 0)
+                continue;
+            found = true;
+            last = s;
+            sequence = recordSequence;
+            storedValuesCrc = valuesCrc;
+        }
+        if (!found)
+            return;
+
+        // setValue () checks the stored values as the ones of the Master
+        // (restored values are not changes)
+        uint16 offset = last * recordSize + PERSIST_HEADER_SIZE;
+        for (uint16 i = 0; i < registerCount (); i++)
+        {
+            Option option;
+            uint16 element;
+            if (!getOptionAtAddress (OPTIONS_ADDRESS_START + 2 * i, option, element) ||
+                option.getValue == NULL || option.setValue == NULL)
+                continue;
+            Option::Value value;
+            value.UINT_16 = readStorage16 (offset + 2 * i); // Implicit typecast!
+            option.setValue (option, element, value);
+        }
+
+        stored = true;
+        slot = last + 1 == slotCount ? 0 : last + 1;
+        sequence++;
+    }
+
+    void markOptionsDirty ()
+    {
+        changed = true;
+    }
+
+    long persistTimeout (uint32 now)
+    {
+        if (slotCount == 0)
+            return -1;
+        if (writing)
+            return PERSIST_POLL_US;
+        if (changed)
+            return configuration.persistDelayUs; // Timed by the next persistOptions ()
+        if (!dirty)
+            return -1;
+
+        uint32 elapsed = now - lastChange;
+        long timeout = elapsed >= configuration.persistDelayUs ? 0 : (long) (configuration.persistDelayUs - elapsed);
+        if (configuration.persistMaxDelayUs != 0)
+        {
+            elapsed = now - firstChange;
+            long maxTimeout = elapsed >= configuration.persistMaxDelayUs ? 0 : (long) (configuration.persistMaxDelayUs - elapsed);
+            if (maxTimeout < timeout)
+                timeout = maxTimeout;
+        }
+        return timeout;
+    }
+
+    // Byte of the record being written
+    static uint8 recordByte (uint16 index)
+    {
+        switch (index)
+        {
+            case 0: return PERSIST_MAGIC;
+            case 1: return (uint8) (sequence >> 8);
+            case 2: return (uint8) (sequence & 0xff);
+            case 3: return (uint8) (layoutCrc >> 8);
+            case 4: return (uint8) (layoutCrc & 0xff);
+            case 5: return (uint8) registerCount ();
+        }
+
+        // CRC-16 of the previous bytes
+        if (index >= recordSize - 2)
+            return index == recordSize - 2 ? (uint8) (writeCrc >> 8) : (uint8) (writeCrc & 0xff);
+
+        uint16 i = index - PERSIST_HEADER_SIZE;
+        if ((i & 1) == 0)
+        {
+            writeValue = registerValue (i >> 1);
+            return (uint8) (writeValue >> 8);
+        }
+        return (uint8) (writeValue & 0xff);
+    }
+
+    void persistOptions ()
+    {
+        if (slotCount == 0)
+            return;
+
+        uint32 now = getMicroseconds ();
+        if (changed)
+        {
+            changed = false;
+            if (!dirty)
+                firstChange = now;
+            lastChange = now;
+            dirty = true;
+        }
+
+        if (!writing)
+        {
+            if (!dirty || persistTimeout (now) != 0)
+                return;
+            dirty = false;
+
+            // Same values as the last record
+            if (stored && computeValuesCrc () == storedValuesCrc)
+                return;
+
+            writing = true;
+            writeIndex = 0;
+            writeCrc = 0xffff;
+            writeValuesCrc = 0xffff;
+        }
+
+        // A value changed during the write is in the next record
+        uint16 offset = slot * recordSize;
+        for (uint16 n = 0; n < PERSIST_STEP_SIZE; n++)
+        {
+            uint8 value = recordByte (writeIndex);
+            if (!writeStorage (offset + writeIndex, value))
+                return; // Busy with the previous byte
+
+            if (writeIndex < recordSize - 2)
+                writeCrc = voltiris::updateCRC16 (writeCrc, value);
+            if (writeIndex >= PERSIST_HEADER_SIZE && writeIndex < recordSize - 2)
+                writeValuesCrc = voltiris::updateCRC16 (writeValuesCrc, value);
+
+            if (++writeIndex == recordSize)
+            {
+                writing = false;
+                stored = true;
+                storedValuesCrc = writeValuesCrc;
+                slot = slot + 1 == slotCount ? 0 : slot + 1;
+                sequence++;
+                return;
+            }
+        }
+    }
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "vltHelpers.hpp"
+
+namespace voltiris
+{
+    // Non-volatile storage of the option values (see getStorageSize ()).
+    // setOptionValueAtAddress () marks the values dirty, the record of every option
+    // register is written once the options stop changing (configuration.persistDelayUs):
+    // a burst of changes costs a single write, identical values are not written again.
+    // The storage is divided in slots written in turn (wear leveling), initialize ()
+    // restores the complete record with the highest sequence number.
+    //
+    // Record (16 bits values big endian):
+    //   0: PERSIST_MAGIC     1: sequence number       3: CRC-16 of the option layout
+    //   5: register count    6: register values       6 + 2 * count: CRC-16 of the record
+    // Registers without getValue () are stored as 0 and not restored
+
+    const uint8 PERSIST_MAGIC = 0x56;
+    const uint16 PERSIST_HEADER_SIZE = 6;
+
+    // Bytes written by a call to persistOptions ()
+    const uint16 PERSIST_STEP_SIZE = 16;
+
+    // Wait between two persistOptions () while a record is written (in microseconds)
+    const long PERSIST_POLL_US = 1000;
+
+    static_assert (MAX_OPTION_REGISTERS <= 0xff, "Register count of a record is 8 bits");
+
+    // Find the last record and restore its values (called by initialize ())
+    void restoreOptions ();
+
+    // Option values changed (called by setOptionValueAtAddress ())
+    void markOptionsDirty ();
+
+    // Write the pending option values, a few bytes at a time without waiting for the
+    // storage. Called by processSerialEvents () when no frame is pending: firmware
+    // calling processIncomingSerialData () should call it between frames
+    void persistOptions ();
+
+    // Time left before persistOptions () has something to write at time now
+    // (in microseconds), -1 if the option values are stored
+    long persistTimeout (uint32 now);
+}
@@ -0,0 +1,136 @@
+#include "vltProfile.hpp"
+#include "vltFirmware.hpp"
+
+#if VOLTIRIS_PROFILE
+
+namespace voltiris
+{
+    // Maximum number of nested stages
+    const uint8 PROFILE_MAX_DEPTH = 8;
+
+    // Statistics of a stage
+    static struct ProfileStatistics
+    {
+        uint32 count;
+        uint32 sum;
+        uint16 min;
+        uint16 max;
+    } statistics [PROFILE_STAGE_COUNT];
+
+    // Stages being measured, the last one is running and the
+    // others are paused. elapsed is the time they already ran
+    static ProfileStage stack [PROFILE_MAX_DEPTH];
+    static uint32 elapsed [PROFILE_MAX_DEPTH];
+    static uint8 depth = 0;
+    static uint8 ignoredDepth = 0; // Stages nested deeper than PROFILE_MAX_DEPTH
+    static uint32 segmentStart = 0;
+
+    // Idle time and CPU utilization
+    static uint32 idleStart = 0;
+    static uint32 idleTotal = 0;
+    static uint32 windowStart = 0;
+    static uint32 windowIdle = 0;
+    static uint16 utilization = 0;
+
+    static inline void record (ProfileStage stage, uint32 time)
+    {
+        ProfileStatistics& s = statistics [stage];
+        uint16 time16 = time > 0xffff ? 0xffff : (uint16) time;
+        if (s.count == 0 || time16 < s.min)
+            s.min = time16;
+        if (time16 > s.max)
+            s.max = time16;
+        s.count++;
+        s.sum += time;
+    }
+
+    void profileEnter (ProfileStage stage)
+    {
+        if (depth >= PROFILE_MAX_DEPTH)
+        {
+            ignoredDepth++;
+            return;
+        }
+
+        uint32 now = getMicroseconds ();
+        if (depth > 0)
+            elapsed [depth - 1] += now - segmentStart;
+        stack [depth] = stage;
+        elapsed [depth] = 0;
+        depth++;
+        segmentStart = now;
+    }
+
+    void profileLeave ()
+    {
+        if (ignoredDepth > 0)
+        {
+            ignoredDepth--;
+            return;
+        }
+        if (depth == 0)
+            return;
+
+        uint32 now = getMicroseconds ();
+        depth--;
+        record (stack [depth], elapsed [depth] + now - segmentStart);
+        segmentStart = now;
+    }
+
+    void profileIdleBegin ()
+    {
+        idleStart = getMicroseconds ();
+    }
+
+    void profileIdleEnd ()
+    {
+        uint32 now = getMicroseconds ();
+        uint32 idle = now - idleStart;
+        idleTotal += idle;
+        windowIdle += idle;
+
+        uint32 window = now - windowStart;
+        if (window >= PROFILE_UTILIZATION_WINDOW_US)
+        {
+            uint32 busy = windowIdle < window ? window - windowIdle : 0;
+            utilization = (uint16) (busy / (window / 10000));
+            windowStart = now;
+            windowIdle = 0;
+        }
+    }
+
+    static inline uint16 high (uint32 value)
+    {
+        return (uint16) (value >> 16);
+    }
+
+    static inline uint16 low (uint32 value)
+    {
+        return (uint16) (value & 0xffff);
+    }
+
+    uint16 getProfileRegister (uint16 index)
+    {
+        switch (index)
+        {
+            case 0: return utilization;
+            case 1: return PROFILE_STAGE_COUNT;
+            case 2: return high (idleTotal);
+            case 3: return low (idleTotal);
+        }
+
+        index -= PROFILE_HEADER_REGISTERS;
+        const ProfileStatistics& s = statistics [index / PROFILE_STAGE_REGISTERS];
+        switch (index % PROFILE_STAGE_REGISTERS)
+        {
+            case 0: return high (s.count);
+            case 1: return low (s.count);
+            case 2: return high (s.sum);
+            case 3: return low (s.sum);
+            case 4: return s.min;
+            default: return s.max;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "vltHelpers.hpp"
+
+namespace voltiris
+{
+    // Stages of the hot path measured by the timing profile.
+    // Times are exclusive: a stage started within another one (eg: getValue ()
+    // while encoding a response) pauses it, so that stages add up to the busy time
+    enum ProfileStage: uint8
+    {
+        PROFILE_RECEIVE,            // serialReadBlock ()
+        PROFILE_DECODE,             // Framing, hex decoding and checksum
+        PROFILE_READ_SYSTEM,        // Read dispatch: identification, version, profile
+        PROFILE_READ_OPTION_INFO,   // Read dispatch: JSON descriptors (0x20 - 0x50)
+        PROFILE_READ_DESCRIPTORS,   // Read dispatch: binary descriptors (0x60 - 0xaf)
+        PROFILE_READ_MEMORY,        // Read dispatch: memory buffer (0x200 - 0x2fe)
+        PROFILE_READ_OPTIONS,       // Read dispatch: option registers (0x300 -)
+        PROFILE_WRITE_SYSTEM,       // Write dispatch: reset, slave id
+        PROFILE_WRITE_MEMORY,       // Write dispatch: memory buffer (0x200 - 0x2fe)
+        PROFILE_WRITE_OPTIONS,      // Write dispatch: option registers (0x300 -)
+        PROFILE_GET_VALUE,          // Option getValue ()
+        PROFILE_SET_VALUE,          // Option setValue ()
+        PROFILE_ENCODE,             // Response bytes, from the header to the checksum
+        PROFILE_SERIAL_WRITE,       // Response framing, serialWriteNonBlocking () / serialWrite ()
+        PROFILE_STAGE_COUNT
+    };
+
+    // Registers of the profile, read from PROFILE_ADDRESS_START with a 2 bytes step
+    // (uint32 values use 2 registers, high word first):
+    // - 0: CPU utilization of the last PROFILE_UTILIZATION_WINDOW_US (in 1/10000)
+    // - 1: PROFILE_STAGE_COUNT
+    // - 2, 3: cumulative idle time (in us, wraps around)
+    // - then 6 registers per stage: count (uint32), cumulative time (uint32, in us,
+    //   wraps around), min and max times (in us, saturated to 0xffff)
+    const uint16 PROFILE_HEADER_REGISTERS = 4;
+    const uint16 PROFILE_STAGE_REGISTERS = 6;
+    const uint16 PROFILE_REGISTERS = PROFILE_HEADER_REGISTERS + PROFILE_STAGE_COUNT * PROFILE_STAGE_REGISTERS;
+    const uint16 PROFILE_ADDRESS_END = PROFILE_ADDRESS_START + 2 * (PROFILE_REGISTERS - 1);
+
+    static_assert (PROFILE_ADDRESS_END < BUFFER_ADDRESS_START, "Profile registers overlap the memory buffer");
+
+    // Window of the CPU utilization figure (in us)
+    const uint32 PROFILE_UTILIZATION_WINDOW_US = 1000000;
+
+    #if VOLTIRIS_PROFILE
+
+        // Start a stage (pausing the current one)
+        void profileEnter (ProfileStage stage);
+
+        // End the last started stage (resuming the previous one)
+        void profileLeave ();
+
+        // Start and end of the idle wait of the main loop (serialWait ())
+        void profileIdleBegin ();
+        void profileIdleEnd ();
+
+        // Get the profile register at index (0 to PROFILE_REGISTERS - 1)
+        uint16 getProfileRegister (uint16 index);
+
+    #else
+
+        // Compiled out: the calls vanish
+        inline void profileEnter (ProfileStage) {}
+        inline void profileLeave () {}
+        inline void profileIdleBegin () {}
+        inline void profileIdleEnd () {}
+
+    #endif
+
+    // Measure a stage during the lifetime of the object
+    struct ProfileScope
+    {
+        ProfileScope (ProfileStage stage) { profileEnter (stage); }
+        ~ProfileScope () { profileLeave (); }
+    };
+}
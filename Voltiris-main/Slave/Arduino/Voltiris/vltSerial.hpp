@@ -21,8 +21,32 @@ namespace voltiris
   // Similar to Serial.available() on Arduino
   int serialAvailable (SerialPort* sp);
 
+  // Wait until characters are available or until timeoutUs (in microseconds)
+  // expires, sleeping if possible. A negative timeout waits forever.
+  // Return the number of available characters or -1 if the line is gone
+  int serialWait (SerialPort* sp, long timeoutUs);
+
+  // Read up to bufferCapacity available characters, never wait.
+  // Backends timing the received characters stop the block before a character
+  // received after a silence of RTU_SILENCE_US (RTU frame boundary): the next
+  // block starts with it and silence is set. Others always clear silence: the
+  // framework then times whole blocks, RTU frames read in the same block are
+  // merged and dropped (CRC-16). With such backends (Serial object, Linux), the
+  // Master must leave the slave time to read a frame before the next one
+  // starts, not only the RTU silence (e.g. no back to back frames to other slaves)
+  // Return the number of characters read (0 if none is available)
+  int serialReadBlock (SerialPort* sp, uint8* buffer, uint16 bufferCapacity, bool& silence);
+
   // Write a buffer to the serial port.
+  // Wait only while the transmit queue is full (used by the
+  // framework only if a frame starts before the response is sent).
   // Return the number of bytes written
   // Similar to Serial.write(buf, len) on Arduino
   int serialWrite (SerialPort* sp, uint8* buffer, uint16 bufferSizeinBtes);
+
+  // Queue as many bytes of buffer as possible for transmission, never wait.
+  // The framework sends the responses with it, the rest of a response is
+  // queued by the next processIncomingSerialData () calls.
+  // Return the number of bytes queued (may be less than bufferSizeinBtes)
+  int serialWriteNonBlocking (SerialPort* sp, const uint8* buffer, uint16 bufferSizeinBtes);
 };
@@ -0,0 +1,46 @@
+#include "vltTrace.hpp"
+
+#if VOLTIRIS_TRACE_SIZE > 0
+
+namespace voltiris
+{
+    // Ring of the last VOLTIRIS_TRACE_SIZE frames
+    static TraceEntry entries [VOLTIRIS_TRACE_SIZE];
+    static uint16 next = 0;  // Index of the next entry to write
+    static uint16 count = 0; // Number of valid entries
+
+    void traceRecord (const TraceEntry& entry)
+    {
+        entries [next] = entry;
+        next = next + 1 == VOLTIRIS_TRACE_SIZE ? 0 : next + 1;
+        if (count < VOLTIRIS_TRACE_SIZE)
+            count++;
+    }
+
+    static inline uint8* put16 (uint8* destination, uint16 value)
+    {
+        *destination++ = (uint8) (value >> 8);
+        *destination++ = (uint8) (value & 0xff);
+        return destination;
+    }
+
+    uint16 traceSnapshot (uint8* destination)
+    {
+        uint16 index = next >= count ? next - count : next + VOLTIRIS_TRACE_SIZE - count;
+        for (uint16 i = 0; i < count; i++)
+        {
+            const TraceEntry& entry = entries [index];
+            destination = put16 (destination, (uint16) (entry.time >> 16));
+            destination = put16 (destination, (uint16) (entry.time & 0xffff));
+            destination = put16 (destination, entry.processingTime);
+            destination = put16 (destination, entry.address);
+            destination = put16 (destination, entry.responseSize);
+            *destination++ = entry.outcome;
+            *destination++ = entry.command;
+            index = index + 1 == VOLTIRIS_TRACE_SIZE ? 0 : index + 1;
+        }
+        return count * TRACE_ENTRY_SIZE;
+    }
+}
+
+#endif
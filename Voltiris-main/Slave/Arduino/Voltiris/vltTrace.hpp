@@ -0,0 +1,48 @@
+#pragma once
+
+#include "vltHelpers.hpp"
+
+namespace voltiris
+{
+    // Outcome of a traced frame: a DiscardReason for a dropped frame, or one of
+    enum TraceOutcome: uint8
+    {
+        TRACE_RESPONSE       = 0x80, // Processed, response sent
+        TRACE_ERROR_RESPONSE = 0x81, // Processed, error response sent
+        TRACE_NO_RESPONSE    = 0x82  // Processed without response (broadcast, reset)
+    };
+
+    // Frame recorded in the trace
+    struct TraceEntry
+    {
+        uint32 time;           // getMicroseconds () when the frame was complete or dropped
+        uint16 processingTime; // From complete frame to the end of the response (in us, saturated)
+        uint16 address;        // Register address of the command (0 if unknown)
+        uint16 responseSize;   // Characters sent on the line
+        uint8  outcome;        // TraceOutcome or DiscardReason
+        uint8  command;        // Command code (0 if unknown)
+    };
+
+    // Size of a trace entry in the memory buffer (see traceSnapshot ())
+    const uint16 TRACE_ENTRY_SIZE = 12;
+
+    static_assert (VOLTIRIS_TRACE_SIZE * TRACE_ENTRY_SIZE <= BUFFER_SIZE, "Trace does not fit in the memory buffer");
+
+    #if VOLTIRIS_TRACE_SIZE > 0
+
+        // Add an entry to the trace, replacing the oldest one when full
+        void traceRecord (const TraceEntry& entry);
+
+        // Copy the entries, oldest first, to destination (TRACE_ENTRY_SIZE bytes
+        // each, 16 and 32 bits values big endian, fields in the TraceEntry order).
+        // Return the number of bytes copied
+        uint16 traceSnapshot (uint8* destination);
+
+    #else
+
+        // Compiled out: the calls vanish
+        inline void traceRecord (const TraceEntry&) {}
+        inline uint16 traceSnapshot (uint8*) { return 0; }
+
+    #endif
+}
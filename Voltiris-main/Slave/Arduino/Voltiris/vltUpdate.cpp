@@ -0,0 +1,127 @@
+#include "vltUpdate.hpp"
+#include "vltFirmware.hpp"
+#include "vltFraming.hpp"
+
+namespace voltiris
+{
+    static UpdateState state = UPDATE_IDLE;
+    static uint32 imageSize = 0;
+    static uint16 imageCrc = 0;
+    static uint16 blockCount = 0;
+    static uint16 missingCount = 0;
+    static uint8 missing [MAX_UPDATE_BLOCKS / 8];
+
+    // Size of the chunks read back from the staging area by updateVerify ()
+    const uint16 UPDATE_VERIFY_CHUNK_SIZE = 32;
+
+    static inline bool isMissing (uint16 block)
+    {
+        return (missing [block >> 3] >> (block & 7)) & 1;
+    }
+
+    // Size of a block, only the last one may be shorter
+    static inline uint16 blockSize (uint16 block)
+    {
+        uint32 left = imageSize - (uint32) block * UPDATE_BLOCK_SIZE;
+        return left < UPDATE_BLOCK_SIZE ? (uint16) left : UPDATE_BLOCK_SIZE;
+    }
+
+    void updateStart (uint32 size, uint16 crc)
+    {
+        // Start repeated for the slaves that missed it
+        if ((state == UPDATE_RECEIVING || state == UPDATE_VERIFIED) &&
+            size == imageSize && crc == imageCrc)
+            return;
+
+        imageSize = size;
+        imageCrc = crc;
+        memset (missing, 0, sizeof (missing));
+        blockCount = 0;
+        missingCount = 0;
+
+        if (size == 0 || size > (uint32) MAX_UPDATE_BLOCKS * UPDATE_BLOCK_SIZE || !beginUpdateStaging (size))
+        {
+            state = UPDATE_FAILED;
+            return;
+        }
+
+        blockCount = (uint16) ((size + UPDATE_BLOCK_SIZE - 1) / UPDATE_BLOCK_SIZE);
+        for (uint16 block = 0; block < blockCount; block++)
+            missing [block >> 3] |= (uint8) (1 << (block & 7));
+        missingCount = blockCount;
+        state = UPDATE_RECEIVING;
+    }
+
+    bool updateBlock (uint16 block, const uint8* data, uint16 size, uint16 crc)
+    {
+        if (state != UPDATE_RECEIVING || block >= blockCount || size != blockSize (block) ||
+            computeCRC16 (data, size) != crc)
+            return false;
+
+        // Retransmitted for another slave
+        if (!isMissing (block))
+            return true;
+
+        if (!writeUpdateStaging ((uint32) block * UPDATE_BLOCK_SIZE, data, size))
+        {
+            state = UPDATE_FAILED;
+            return false;
+        }
+        missing [block >> 3] &= (uint8) ~(1 << (block & 7));
+        missingCount--;
+        return true;
+    }
+
+    void updateVerify (uint16 crc)
+    {
+        // Blocks still missing: the Master sees them in the status
+        if (state != UPDATE_RECEIVING || missingCount != 0)
+            return;
+
+        // Read back what was really staged
+        uint8 chunk [UPDATE_VERIFY_CHUNK_SIZE];
+        uint16 crc16 = 0xffff;
+        for (uint32 offset = 0; offset < imageSize; offset += UPDATE_VERIFY_CHUNK_SIZE)
+        {
+            uint16 size = imageSize - offset < UPDATE_VERIFY_CHUNK_SIZE ?
+                          (uint16) (imageSize - offset) : UPDATE_VERIFY_CHUNK_SIZE;
+            if (!readUpdateStaging (offset, chunk, size))
+            {
+                state = UPDATE_FAILED;
+                return;
+            }
+            for (uint16 i = 0; i < size; i++)
+                crc16 = updateCRC16 (crc16, chunk [i]);
+        }
+
+        state = crc16 == crc && crc == imageCrc ? UPDATE_VERIFIED : UPDATE_FAILED;
+    }
+
+    bool updateActivate (uint16 crc)
+    {
+        if (state != UPDATE_VERIFIED || crc != imageCrc)
+            return false;
+
+        // Idle if the implementation returns (and after the restart)
+        state = UPDATE_IDLE;
+        activateUpdate (imageSize);
+        return true;
+    }
+
+    uint16 getUpdateRegister (uint16 index)
+    {
+        switch (index)
+        {
+            case UPDATE_STATE:         return state;
+            case UPDATE_BLOCK_COUNT:   return blockCount;
+            case UPDATE_MISSING_COUNT: return missingCount;
+            case UPDATE_IMAGE_CRC:     return imageCrc;
+        }
+        return 0;
+    }
+
+    const uint8* getUpdateMissingBitmap ()
+    {
+        return missing;
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "vltHelpers.hpp"
+
+namespace voltiris
+{
+    // Firmware update distributed to every slave at once. The Master broadcasts
+    // the blocks of the image (CMD_UPDATE_BLOCK), reads the missing-block bitmap
+    // of each slave and broadcasts the missing blocks again until every slave
+    // has them all, then broadcasts CMD_UPDATE_VERIFY and CMD_UPDATE_ACTIVATE.
+    // The image is written through the staging hooks of vltFirmware.hpp
+
+    // State of the update (first status register)
+    enum UpdateState: uint8
+    {
+        UPDATE_IDLE,      // No update (or activated)
+        UPDATE_RECEIVING, // Started, blocks are staged as they arrive
+        UPDATE_VERIFIED,  // Every block staged, CRC-16 of the staged image checked
+        UPDATE_FAILED     // Staging refused or failed, or the staged image is wrong
+    };
+
+    // Status registers (CMD_UPDATE_STATUS)
+    enum UpdateRegister: uint8
+    {
+        UPDATE_STATE,         // UpdateState
+        UPDATE_BLOCK_COUNT,   // Blocks of the image
+        UPDATE_MISSING_COUNT, // Blocks not staged yet
+        UPDATE_IMAGE_CRC,     // CRC-16 of the image given to updateStart ()
+        UPDATE_REGISTERS
+    };
+
+    // Start the update of an image of imageSize bytes (CRC-16 imageCrc): every block
+    // is missing. Starting the same image again keeps the blocks already staged
+    void updateStart (uint32 imageSize, uint16 imageCrc);
+
+    // Stage a block (UPDATE_BLOCK_SIZE bytes, less for the last one) whose CRC-16 is crc.
+    // Return false if the block does not belong to the image or is corrupted
+    bool updateBlock (uint16 block, const uint8* data, uint16 size, uint16 crc);
+
+    // Check the staged image once every block is staged:
+    // UPDATE_VERIFIED if its CRC-16 is imageCrc, UPDATE_FAILED otherwise
+    void updateVerify (uint16 imageCrc);
+
+    // Activate the image if it is verified and its CRC-16 is imageCrc (activateUpdate ()).
+    // Return false otherwise (eg: slave not part of this update)
+    bool updateActivate (uint16 imageCrc);
+
+    // Status register (UpdateRegister)
+    uint16 getUpdateRegister (uint16 index);
+
+    // Missing-block bitmap, MAX_UPDATE_BLOCKS / 8 bytes: bit i % 8 (least significant first)
+    // of byte i / 8 is set while block i is missing
+    const uint8* getUpdateMissingBitmap ();
+}
@@ -0,0 +1,456 @@
+#include "vltSerial.hpp"
+#include "vltFirmware.hpp"
+#include "vltCommands.hpp"
+#include "vltFraming.hpp"
+#include "vltOption.hpp"
+
+#include "lnxFirmware.hpp"
+#include "bchSerial.hpp"
+
+#include <getopt.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+// Microbenchmarks of the framework hot path (host build).
+//
+// Frames of a realistic corpus are fed to processIncomingSerialData () through an
+// in-memory serial port, with a virtual clock ending the RTU frames. Framing and
+// option functions are also timed separately. Each benchmark is calibrated to last
+// about --min-time, repeated, and the median is reported. Results are printed as
+// a table or as CSV (--csv), and can be compared to a previous CSV (--baseline).
+
+using namespace voltiris;
+
+struct BenchmarkSettings
+{
+    double minTimeMs   = 100;  // Time of one repetition
+    int    repetitions = 5;    // The median is reported
+    const char* filter = NULL; // Only run the benchmarks containing this string
+    const char* baseline = NULL;
+    double tolerancePercent = 20; // Slowdown reported as a regression
+    bool   csv         = false;
+};
+
+static BenchmarkSettings settings;
+
+// Result of a benchmark: an operation is a frame or a function call
+struct BenchmarkResult
+{
+    std::string name;
+    unsigned long iterations; // Per repetition
+    double nsPerOperation;
+    double bytesPerOperation; // Characters or bytes processed by an operation
+};
+
+static std::vector<BenchmarkResult> results;
+
+// Accumulates computed values so that the compiler keeps the computations
+static volatile uint32 sink;
+
+static double nowNs ()
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+}
+
+template<typename Operation> static double runBatch (Operation& operation, unsigned long iterations)
+{
+    double start = nowNs ();
+    for (unsigned long i = 0; i < iterations; i++)
+        operation ();
+    return nowNs () - start;
+}
+
+// Time operation: the number of iterations is doubled until a batch
+// lasts minTimeMs, then the batch is repeated
+template<typename Operation> static void measure (const std::string& name, double bytesPerOperation, Operation operation)
+{
+    if (settings.filter != NULL && name.find (settings.filter) == std::string::npos)
+        return;
+
+    unsigned long iterations = 1;
+    while (runBatch (operation, iterations) < settings.minTimeMs * 1e6 && iterations < (1ul << 40))
+        iterations *= 2;
+
+    std::vector<double> times;
+    for (int r = 0; r < settings.repetitions; r++)
+        times.push_back (runBatch (operation, iterations) / (double) iterations);
+    std::sort (times.begin (), times.end ());
+
+    results.push_back ({name, iterations, times [times.size () / 2], bytesPerOperation});
+}
+
+// -----------------------------
+// Frame corpus
+// -----------------------------
+
+static uint32 virtualTime = 0;
+
+static uint32 virtualClock ()
+{
+    return virtualTime;
+}
+
+// Frame of the corpus (binary, without checksum) and its expected processing
+struct CorpusFrame
+{
+    const char* name;
+    std::vector<uint8> bin;
+    bool response;        // A response is sent
+    bool errorResponse;   // The response is an error
+    bool badChecksum;     // Checksum corrupted after encoding
+    bool invalidCharacter; // ASCII only: 'G' in the frame
+};
+
+static std::vector<uint8> readRequest (uint8 id, uint16 address, uint16 count)
+{
+    return {id, READ_INPUT_REGISTERS_CMD, (uint8) (address >> 8), (uint8) address, (uint8) (count >> 8), (uint8) count};
+}
+
+static std::vector<uint8> writeRequest (uint8 id, uint16 address, const std::vector<uint8>& data)
+{
+    uint16 count = (uint16) ((data.size () + 1) / 2);
+    std::vector<uint8> bin = {id, PRESET_MULT_REGISTERS_CMD, (uint8) (address >> 8), (uint8) address,
+                              (uint8) (count >> 8), (uint8) count, (uint8) data.size ()};
+    bin.insert (bin.end (), data.begin (), data.end ());
+    return bin;
+}
+
+static std::vector<CorpusFrame> makeCorpus ()
+{
+    std::vector<uint8> memory (BUFFER_SIZE);
+    for (size_t i = 0; i < memory.size (); i++)
+        memory [i] = (uint8) (i * 7);
+
+    return {
+        {"read_register",       readRequest (1, MEMORY_VERSION_ADDRESS, 1),                true,  false, false, false},
+        {"read_options",        readRequest (1, OPTIONS_ADDRESS_START, 24),                true,  false, false, false},
+        {"write_options",       writeRequest (1, OPTIONS_ADDRESS_START, {0, 100, 0, 200}), true,  false, false, false},
+        {"read_memory_buffer",  readRequest (1, BUFFER_ADDRESS_START, BUFFER_SIZE / 2),    true,  false, false, false},
+        {"write_memory_buffer", writeRequest (1, BUFFER_ADDRESS_START, memory),            true,  false, false, false},
+        {"get_option_info",     readRequest (1, CMD_GET_OPT_INFO_START, 1),                true,  false, false, false},
+        {"unknown_address",     readRequest (1, 0x0f00, 1),                                true,  true,  false, false},
+        {"other_slave",         readRequest (2, OPTIONS_ADDRESS_START, 24),                false, false, false, false},
+        {"bad_checksum",        readRequest (1, OPTIONS_ADDRESS_START, 24),                false, false, true,  false},
+        {"invalid_character",   readRequest (1, OPTIONS_ADDRESS_START, 24),                false, false, false, true},
+        {"too_short",           {1},                                                       false, false, false, false},
+    };
+}
+
+// Encode a frame as the Master does
+static std::vector<uint8> encodeFrame (const CorpusFrame& frame, bool rtu)
+{
+    std::vector<uint8> out;
+    if (rtu)
+    {
+        out = frame.bin;
+        uint16 crc16 = computeCRC16 (frame.bin.data (), (uint16) frame.bin.size ());
+        if (frame.badChecksum)
+            crc16 ^= 1;
+        out.push_back ((uint8) (crc16 & 0xff));
+        out.push_back ((uint8) (crc16 >> 8));
+        return out;
+    }
+
+    uint8 crc8 = computeCRC8 (frame.bin.data (), (uint16) frame.bin.size ());
+    if (frame.badChecksum)
+        crc8 ^= 1;
+    out.push_back (':');
+    for (size_t i = 0; i <= frame.bin.size (); i++)
+    {
+        char hi, low;
+        toChar (i < frame.bin.size () ? frame.bin [i] : crc8, hi, low);
+        out.push_back ((uint8) hi);
+        out.push_back ((uint8) low);
+    }
+    if (frame.invalidCharacter)
+        out [3] = 'G';
+    out.push_back ('\r');
+    out.push_back ('\n');
+    return out;
+}
+
+// Give a frame to the framework, then let the line stay silent (end of a RTU frame)
+static void processFrame (SerialPort* sp, const std::vector<uint8>& frame)
+{
+    serialFeed (sp, frame.data (), (uint16) frame.size ());
+    processIncomingSerialData (sp);
+    virtualTime += RTU_SILENCE_US;
+    processIncomingSerialData (sp);
+}
+
+// Check that a frame is processed as expected before timing it
+static bool checkFrame (SerialPort* sp, const CorpusFrame& frame, const std::vector<uint8>& encoded)
+{
+    resetHealthCounters (); // Saturated by the previous benchmarks
+    processFrame (sp, encoded);
+    bool response = serialWritten (sp) > 0;
+    bool errorResponse = getHealthRegister (HEALTH_ERROR_RESPONSES) != 0;
+    return response == frame.response && errorResponse == frame.errorResponse;
+}
+
+static bool benchmarkFrames (SerialPort* sp, Framing framing)
+{
+    bool rtu = framing == FRAMING_RTU;
+    configuration.framing = framing;
+    std::string prefix = rtu ? "frame_rtu_" : "frame_ascii_";
+
+    for (const CorpusFrame& frame : makeCorpus ())
+    {
+        if (rtu && frame.invalidCharacter)
+            continue;
+
+        std::vector<uint8> encoded = encodeFrame (frame, rtu);
+        if (!checkFrame (sp, frame, encoded))
+        {
+            fprintf (stderr, "Unexpected processing of frame '%s%s'\n", prefix.c_str (), frame.name);
+            return false;
+        }
+
+        measure (prefix + frame.name, (double) encoded.size (), [&] ()
+        {
+            processFrame (sp, encoded);
+            sink += serialWritten (sp);
+        });
+    }
+    return true;
+}
+
+// -----------------------------
+// Framing and option functions
+// -----------------------------
+
+static void benchmarkFunctions ()
+{
+    // Largest memory transfer (254 bytes), whatever the memory profile
+    std::vector<uint8> data (254);
+    for (size_t i = 0; i < data.size (); i++)
+        data [i] = (uint8) (i * 13 + 5);
+
+    std::vector<char> hex (2 * data.size ());
+    for (size_t i = 0; i < data.size (); i++)
+        toChar (data [i], hex [2 * i], hex [2 * i + 1]);
+
+    // Hex characters to bytes, as the ASCII receiver (toByte () per character)
+    measure ("ascii_decode_254", (double) hex.size (), [&] ()
+    {
+        bool error = false;
+        uint32 sum = 0;
+        for (size_t i = 0; i < hex.size (); i += 2)
+            sum += (uint8) (toByte (hex [i], error) << 4 | toByte (hex [i + 1], error));
+        sink += sum + error;
+    });
+
+    // Bytes to hex characters, as the ASCII response writer
+    measure ("ascii_encode_254", (double) data.size (), [&] ()
+    {
+        uint32 sum = 0;
+        for (size_t i = 0; i < data.size (); i++)
+        {
+            char hi, low;
+            toChar (data [i], hi, low);
+            sum += (uint8) hi + (uint8) low;
+        }
+        sink += sum;
+    });
+
+    measure ("crc8_254", (double) data.size (), [&] ()
+    {
+        sink += computeCRC8 (data.data (), (uint16) data.size ());
+    });
+
+    measure ("crc16_254", (double) data.size (), [&] ()
+    {
+        sink += computeCRC16 (data.data (), (uint16) data.size ());
+    });
+
+    // Option lookup by address, over every register
+    uint16 registers = (OPTIONS_ADDRESS_END - OPTIONS_ADDRESS_START) / 2;
+    uint16 index = 0;
+    measure ("option_at_address", 2, [&] ()
+    {
+        Option option;
+        uint16 element = 0;
+        sink += getOptionAtAddress (OPTIONS_ADDRESS_START + 2 * index, option, element) + element;
+        index = index + 1 < registers ? index + 1 : 0;
+    });
+
+    // Lookup and getValue ()
+    index = 0;
+    measure ("option_value_at_address", 2, [&] ()
+    {
+        uint16 value = 0;
+        getOptionValueAtAddress (OPTIONS_ADDRESS_START + 2 * index, value);
+        sink += value;
+        index = index + 1 < registers ? index + 1 : 0;
+    });
+
+    std::vector<Option> options;
+    Option opt;
+    while (getOption ((uint16) options.size (), opt))
+        options.push_back (opt);
+
+    // Average size of the outputs
+    uint8 output [BUFFER_SIZE];
+    double jsonSize = 0, binarySize = 0;
+    for (const Option& option : options)
+    {
+        uint16 size = sizeof (output);
+        option.convertToJson (output, size);
+        jsonSize += size;
+        size = sizeof (output);
+        option.convertToBinary (output, size);
+        binarySize += size;
+    }
+
+    index = 0;
+    measure ("option_json", jsonSize / options.size (), [&] ()
+    {
+        uint16 size = sizeof (output);
+        sink += options [index].convertToJson (output, size) + size;
+        index = index + 1u < options.size () ? index + 1 : 0;
+    });
+
+    index = 0;
+    measure ("option_binary", binarySize / options.size (), [&] ()
+    {
+        uint16 size = sizeof (output);
+        sink += options [index].convertToBinary (output, size) + size;
+        index = index + 1u < options.size () ? index + 1 : 0;
+    });
+}
+
+// -----------------------------
+// Report
+// -----------------------------
+
+// Read ns per operation of a previous CSV report
+static bool readBaseline (const char* fileName, std::map<std::string, double>& baseline)
+{
+    FILE* file = fopen (fileName, "r");
+    if (file == NULL)
+        return false;
+
+    char line [256];
+    while (fgets (line, sizeof (line), file) != NULL)
+    {
+        char name [128];
+        unsigned long iterations;
+        double nsPerOperation;
+        if (sscanf (line, "%127[^,],%lu,%lf", name, &iterations, &nsPerOperation) == 3)
+            baseline [name] = nsPerOperation;
+    }
+    fclose (file);
+    return true;
+}
+
+// Print the results, return the number of regressions compared to the baseline
+static int report (const std::map<std::string, double>& baseline)
+{
+    int regressions = 0;
+    if (settings.csv)
+        printf ("name,iterations,ns_per_op,bytes_per_s%s\n", baseline.empty () ? "" : ",baseline_ns_per_op,change_percent");
+    else
+        printf ("%-32s %12s %12s %14s%s\n", "benchmark", "iterations", "ns/op", "bytes/s", baseline.empty () ? "" : "     change");
+
+    for (const BenchmarkResult& result : results)
+    {
+        double bytesPerSecond = result.bytesPerOperation * 1e9 / result.nsPerOperation;
+        if (settings.csv)
+            printf ("%s,%lu,%.2f,%.0f", result.name.c_str (), result.iterations, result.nsPerOperation, bytesPerSecond);
+        else
+            printf ("%-32s %12lu %12.2f %14.0f", result.name.c_str (), result.iterations, result.nsPerOperation, bytesPerSecond);
+
+        auto reference = baseline.find (result.name);
+        if (reference != baseline.end ())
+        {
+            double change = 100.0 * (result.nsPerOperation - reference->second) / reference->second;
+            bool regression = change > settings.tolerancePercent;
+            if (regression)
+                regressions++;
+            if (settings.csv)
+                printf (",%.2f,%.1f", reference->second, change);
+            else
+                printf ("   %+7.1f%%%s", change, regression ? "  REGRESSION" : "");
+        }
+        printf ("\n");
+    }
+    return regressions;
+}
+
+// -----------------------------
+// Main program
+// -----------------------------
+
+static void usage (const char* name)
+{
+    fprintf (stderr, "Usage: %s [options]\n"
+                     "  --min-time MS     time of a repetition in ms (default: 100)\n"
+                     "  --repetitions N   repetitions, the median is reported (default: 5)\n"
+                     "  --filter TEXT     only run the benchmarks containing TEXT\n"
+                     "  --csv             CSV output: name,iterations,ns_per_op,bytes_per_s\n"
+                     "  --baseline FILE   compare to a previous CSV output\n"
+                     "  --tolerance PCT   slowdown reported as a regression (default: 20)\n",
+                     name);
+}
+
+int main (int argc, char** argv)
+{
+    static const struct option longOptions [] =
+    {
+        {"min-time",    required_argument, NULL, 't'},
+        {"repetitions", required_argument, NULL, 'r'},
+        {"filter",      required_argument, NULL, 'f'},
+        {"csv",         no_argument,       NULL, 'c'},
+        {"baseline",    required_argument, NULL, 'b'},
+        {"tolerance",   required_argument, NULL, 'p'},
+        {"help",        no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int c;
+    while ((c = getopt_long (argc, argv, "", longOptions, NULL)) != -1)
+    {
+        switch (c)
+        {
+            case 't': settings.minTimeMs        = atof (optarg); break;
+            case 'r': settings.repetitions      = atoi (optarg); break;
+            case 'f': settings.filter           = optarg; break;
+            case 'c': settings.csv              = true; break;
+            case 'b': settings.baseline         = optarg; break;
+            case 'p': settings.tolerancePercent = atof (optarg); break;
+            default:
+                usage (argv [0]);
+                return c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (settings.minTimeMs <= 0 || settings.repetitions < 1)
+    {
+        usage (argv [0]);
+        return EXIT_FAILURE;
+    }
+
+    std::map<std::string, double> baseline;
+    if (settings.baseline != NULL && !readBaseline (settings.baseline, baseline))
+    {
+        perror (settings.baseline);
+        return EXIT_FAILURE;
+    }
+
+    hostConfiguration.clock = virtualClock;
+    initialize ();
+    SerialPort* sp = serialInit ();
+
+    if (!benchmarkFrames (sp, FRAMING_ASCII) || !benchmarkFrames (sp, FRAMING_RTU))
+        return EXIT_FAILURE;
+    benchmarkFunctions ();
+
+    return report (baseline) == 0 ? EXIT_SUCCESS : 2;
+}
@@ -0,0 +1,80 @@
+#include "bchSerial.hpp"
+
+#include <string.h>
+
+// Serial functions of the benchmark: no system call, so that
+// the measures only include the framework processing.
+
+namespace voltiris
+{
+    static BenchmarkSerialPort serial;
+
+    SerialPort* serialInit ()
+    {
+        return (SerialPort*) &serial;
+    }
+
+    void serialFeed (SerialPort* sp, const uint8* data, uint16 size)
+    {
+        assert (sp != NULL);
+        BenchmarkSerialPort* port = (BenchmarkSerialPort*) sp;
+        port->input = data;
+        port->inputSize = size;
+        port->position = 0;
+        port->written = 0;
+    }
+
+    uint32 serialWritten (SerialPort* sp)
+    {
+        assert (sp != NULL);
+        return ((BenchmarkSerialPort*) sp)->written;
+    }
+
+    int serialRead (SerialPort* sp)
+    {
+        assert (sp != NULL);
+        BenchmarkSerialPort* port = (BenchmarkSerialPort*) sp;
+        if (port->position >= port->inputSize)
+            return SERIAL_NO_CHARACTER_AVAILABLE;
+        return port->input [port->position++];
+    }
+
+    int serialAvailable (SerialPort* sp)
+    {
+        assert (sp != NULL);
+        BenchmarkSerialPort* port = (BenchmarkSerialPort*) sp;
+        return port->inputSize - port->position;
+    }
+
+    int serialWait (SerialPort* sp, long timeoutUs)
+    {
+        (void) timeoutUs;
+        return serialAvailable (sp);
+    }
+
+    int serialReadBlock (SerialPort* sp, uint8* buffer, uint16 bufferCapacity, bool& silence)
+    {
+        assert (sp != NULL);
+        silence = false;
+        BenchmarkSerialPort* port = (BenchmarkSerialPort*) sp;
+        uint16 count = port->inputSize - port->position;
+        if (count > bufferCapacity)
+            count = bufferCapacity;
+        memcpy (buffer, port->input + port->position, count);
+        port->position += count;
+        return count;
+    }
+
+    int serialWrite (SerialPort* sp, uint8* buffer, uint16 bufferSizeinBtes)
+    {
+        assert (sp != NULL);
+        (void) buffer;
+        ((BenchmarkSerialPort*) sp)->written += bufferSizeinBtes;
+        return bufferSizeinBtes;
+    }
+
+    int serialWriteNonBlocking (SerialPort* sp, const uint8* buffer, uint16 bufferSizeinBtes)
+    {
+        return serialWrite (sp, (uint8*) buffer, bufferSizeinBtes);
+    }
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "vltSerial.hpp"
+
+namespace voltiris
+{
+    // In-memory serial port of the benchmark: reads return the characters
+    // given to serialFeed (), written characters are only counted
+    struct BenchmarkSerialPort: SerialPort
+    {
+        const uint8* input = NULL;
+        uint16 inputSize = 0;
+        uint16 position = 0;
+
+        // Characters written since the last serialFeed ()
+        uint32 written = 0;
+    };
+
+    // Make size characters of data available to the next reads
+    void serialFeed (SerialPort* sp, const uint8* data, uint16 size);
+
+    // Get the number of characters written since the last serialFeed ()
+    uint32 serialWritten (SerialPort* sp);
+}
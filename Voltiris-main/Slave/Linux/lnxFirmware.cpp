@@ -0,0 +1,250 @@
+#include "vltHelpers.hpp"
+#include "vltOption.hpp"
+#include "lnxFirmware.hpp"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+// Host stand-in of 'ardFirmware.cpp': same options as the Arduino test
+// implementation, values are kept in RAM.
+
+namespace voltiris
+{
+    HostConfiguration hostConfiguration;
+
+    // -------------------------------------------------
+    // Perform a hard reset
+    // -------------------------------------------------
+
+    void hardReset ()
+    {
+        if (hostConfiguration.hardReset != NULL)
+            hostConfiguration.hardReset ();
+        exit (EXIT_SUCCESS);
+    }
+
+    // -------------------------------------------------
+    // Get 64 bits serial number
+    // -------------------------------------------------
+
+    uint8* getSerialNumber ()
+    {
+        return hostConfiguration.serialNumber;
+    }
+
+    // -------------------------------------------------
+    // Get a monotonic time in microseconds
+    // -------------------------------------------------
+
+    uint32 getMicroseconds ()
+    {
+        if (hostConfiguration.clock != NULL)
+            return hostConfiguration.clock ();
+
+        struct timespec ts;
+        clock_gettime (CLOCK_MONOTONIC, &ts);
+        return (uint32) ((uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000);
+    }
+
+    // -------------------------------------------------
+    // Get a random number between 0 and 0xff
+    // -------------------------------------------------
+
+    uint8 randomByte ()
+    {
+        return (uint8) (rand_r (&hostConfiguration.seed) % 0xff);
+    }
+
+    // -------------------------------------------------
+    // Firmware update staging (in RAM)
+    // -------------------------------------------------
+
+    static uint8* updateImage = NULL;
+
+    bool beginUpdateStaging (uint32 imageSize)
+    {
+        if (imageSize > hostConfiguration.updateCapacity)
+            return false;
+        if (updateImage == NULL)
+            updateImage = (uint8*) malloc (hostConfiguration.updateCapacity);
+        if (updateImage == NULL)
+            return false;
+        memset (updateImage, 0xff, imageSize); // Erased flash
+        return true;
+    }
+
+    bool writeUpdateStaging (uint32 offset, const uint8* data, uint16 size)
+    {
+        if (updateImage == NULL || offset + size > hostConfiguration.updateCapacity)
+            return false;
+        memcpy (updateImage + offset, data, size);
+        return true;
+    }
+
+    bool readUpdateStaging (uint32 offset, uint8* data, uint16 size)
+    {
+        if (updateImage == NULL || offset + size > hostConfiguration.updateCapacity)
+            return false;
+        memcpy (data, updateImage + offset, size);
+        return true;
+    }
+
+    void activateUpdate (uint32 imageSize)
+    {
+        if (hostConfiguration.activateUpdate == NULL)
+            hardReset ();
+        hostConfiguration.activateUpdate (updateImage, imageSize);
+    }
+
+    // -------------------------------------------------
+    // Option storage (in a file or in RAM)
+    // -------------------------------------------------
+
+    static int storageFd = -1;
+    static uint8* storageRam = NULL;
+
+    // Erased bytes (EEPROM), also beyond the end of the file
+    static bool openStorage ()
+    {
+        if (hostConfiguration.storageFile != NULL)
+        {
+            if (storageFd < 0)
+                storageFd = open (hostConfiguration.storageFile, O_RDWR | O_CREAT, 0644);
+            return storageFd >= 0;
+        }
+        if (storageRam == NULL)
+        {
+            storageRam = (uint8*) malloc (hostConfiguration.storageSize);
+            if (storageRam != NULL)
+                memset (storageRam, 0xff, hostConfiguration.storageSize);
+        }
+        return storageRam != NULL;
+    }
+
+    uint16 getStorageSize ()
+    {
+        return openStorage () ? hostConfiguration.storageSize : 0;
+    }
+
+    void readStorage (uint16 offset, uint8* data, uint16 size)
+    {
+        memset (data, 0xff, size);
+        if (!openStorage () || offset + size > hostConfiguration.storageSize)
+            return;
+        if (storageRam != NULL)
+            memcpy (data, storageRam + offset, size);
+        else if (pread (storageFd, data, size, offset) < 0)
+            memset (data, 0xff, size);
+    }
+
+    bool writeStorage (uint16 offset, uint8 value)
+    {
+        if (!openStorage () || offset >= hostConfiguration.storageSize)
+            return true; // Lost as a byte of a broken EEPROM
+        if (storageRam != NULL)
+            storageRam [offset] = value;
+        else
+            (void) pwrite (storageFd, &value, 1, offset);
+        return true;
+    }
+
+    // ---------------
+    // Options section
+    // ---------------
+
+    static Option::Value get (const Option& option, uint16 index)
+    {
+        Option::Value* values = (Option::Value*) option.userData;
+        return values [index];
+    }
+
+    static bool set (const Option& option, uint16 index, Option::Value value)
+    {
+        Option::Value* values = (Option::Value*) option.userData;
+        switch (option.type)
+        {
+            case Option::UINT_16:
+                if (value.UINT_16 < option.min.UINT_16)
+                    value.UINT_16 = option.min.UINT_16;
+                if (value.UINT_16 > option.max.UINT_16)
+                    value.UINT_16 = option.max.UINT_16;
+                break;
+            case Option::INT_16:
+                if (value.INT_16 < option.min.INT_16)
+                    value.INT_16 = option.min.INT_16;
+                if (value.INT_16 > option.max.INT_16)
+                    value.INT_16 = option.max.INT_16;
+                break;
+        }
+        values [index] = value;
+        return true;
+    }
+
+    // Effective values of the options (initialized to min)
+    static Option::Value valPositionsB1 [2] = {(uint16) 0, (uint16) 0};
+    static Option::Value valPositionsB2 [2] = {(uint16) 0, (uint16) 0};
+    static Option::Value valSpeedLevelsB1 [4] = {(uint16) 0, (uint16) 0, (uint16) 0, (uint16) 0};
+    static Option::Value valSpeedLevelsB2 [4] = {(uint16) 0, (uint16) 0, (uint16) 0, (uint16) 0};
+    static Option::Value valVthreshB1 [4] = {(int16) -250, (int16) -250, (int16) -250, (int16) -250};
+    static Option::Value valVthreshB2 [4] = {(int16) -250, (int16) -250, (int16) -250, (int16) -250};
+    static Option::Value valRescaleB1 [2] = {(uint16) 0, (uint16) 0};
+    static Option::Value valRescaleB2 [2] = {(uint16) 0, (uint16) 0};
+
+    // Option descriptors, computed at compile time
+
+    static constexpr char namePosition_b1 [] = "Position_b1";
+    static constexpr char namePosition_b2 [] = "Position_b2";
+    static constexpr char nameSpeed_Levels_b1 [] = "Speed_Levels_b1";
+    static constexpr char nameSpeed_Levels_b2 [] = "Speed_Levels_b2";
+    static constexpr char nameVthresh_b1 [] = "Vthresh_b1";
+    static constexpr char nameVthresh_b2 [] = "Vthresh_b2";
+    static constexpr char nameRescale_b1 [] = "Rescale_b1";
+    static constexpr char nameRescale_b2 [] = "Rescale_b2";
+
+    typedef TypedOption<uint16, Option::DIM_2, Option::MILLIMETERS> PositionOption;
+    typedef TypedOption<uint16, Option::DIM_4, Option::MM_PER_SEC> SpeedOption;
+    typedef TypedOption<int16, Option::DIM_4, Option::VOLTS> VThreshOption;
+    typedef TypedOption<uint16, Option::DIM_2, Option::NO_UNIT> RescaleOption;
+
+    static constexpr Option optPosition_b1 = PositionOption::make (
+        namePosition_b1, 0, 6000, 10, false, get, set, valPositionsB1, OPTIONS_ADDRESS_START);
+    static constexpr Option optPosition_b2 = PositionOption::make (
+        namePosition_b2, 0, 6000, 10, false, get, set, valPositionsB2, nextOptionAddress (optPosition_b1));
+    static constexpr Option optSpeed_Levels_b1 = SpeedOption::make (
+        nameSpeed_Levels_b1, 0, 990, 10, true, get, set, valSpeedLevelsB1, nextOptionAddress (optPosition_b2));
+    static constexpr Option optSpeed_Levels_b2 = SpeedOption::make (
+        nameSpeed_Levels_b2, 0, 990, 10, true, get, set, valSpeedLevelsB2, nextOptionAddress (optSpeed_Levels_b1));
+    static constexpr Option optVthresh_b1 = VThreshOption::make (
+        nameVthresh_b1, -250, 250, 10, true, get, set, valVthreshB1, nextOptionAddress (optSpeed_Levels_b2));
+    static constexpr Option optVthresh_b2 = VThreshOption::make (
+        nameVthresh_b2, -250, 250, 10, true, get, set, valVthreshB2, nextOptionAddress (optVthresh_b1));
+    static constexpr Option optRescale_b1 = RescaleOption::make (
+        nameRescale_b1, 0, 1000, 100, true, get, set, valRescaleB1, nextOptionAddress (optVthresh_b2));
+    static constexpr Option optRescale_b2 = RescaleOption::make (
+        nameRescale_b2, 0, 1000, 100, true, get, set, valRescaleB2, nextOptionAddress (optRescale_b1));
+
+    static constexpr const Option* optionTable [] =
+    {
+        &optPosition_b1, &optPosition_b2,
+        &optSpeed_Levels_b1, &optSpeed_Levels_b2,
+        &optVthresh_b1, &optVthresh_b2,
+        &optRescale_b1, &optRescale_b2
+    };
+    static_assert (isOptionTableValid (optionTable), "Options must follow each other (see nextOptionAddress ())");
+
+    // -------------------------------------------------
+    // Is called during initialization to perform custom setup
+    // -------------------------------------------------
+
+    void customSetup ()
+    {
+        if (hostConfiguration.slaveId != 0)
+            configuration.slaveId = hostConfiguration.slaveId;
+        configuration.framing = hostConfiguration.framing;
+
+        if (!setOptions (optionTable))
+            abort ();
+    }
+}
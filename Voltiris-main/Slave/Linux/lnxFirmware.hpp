@@ -0,0 +1,49 @@
+#pragma once
+
+#include "vltFirmware.hpp"
+
+namespace voltiris
+{
+    // Host specific settings used by the implementation of the firmware
+    // callbacks. Should be filled before calling initialize ().
+    struct HostConfiguration
+    {
+        // Value returned by getSerialNumber ()
+        uint8 serialNumber [8] = {0xde, 0xad, 0xbe, 0xef, 0xc0, 0xfe, 0xba, 0xbe};
+
+        // Slave id forced at the end of customSetup ()
+        // 0 keeps the random id selected by initialize ()
+        uint8 slaveId = 1;
+
+        // Framing selected at the end of customSetup ()
+        Framing framing = FRAMING_ASCII;
+
+        // Seed of randomByte ()
+        unsigned int seed = 1;
+
+        // Called by hardReset (), should not return.
+        // The process exits if not set.
+        void (*hardReset) () = NULL;
+
+        // Time base of getMicroseconds () (eg: a virtual clock).
+        // CLOCK_MONOTONIC if not set.
+        uint32 (*clock) () = NULL;
+
+        // Largest firmware update image staged in RAM by beginUpdateStaging ()
+        uint32 updateCapacity = 256 * 1024;
+
+        // Called by activateUpdate () with the verified staged image (eg: write it
+        // to a file and restart), the slave keeps running if it returns.
+        // hardReset () if not set.
+        void (*activateUpdate) (const uint8* image, uint32 imageSize) = NULL;
+
+        // File holding the option storage (eg: kept across restarts),
+        // storage in RAM if not set
+        const char* storageFile = NULL;
+
+        // Value returned by getStorageSize (), 0 disables the persistence of the options
+        uint16 storageSize = 1024;
+    };
+
+    extern HostConfiguration hostConfiguration;
+}
@@ -0,0 +1,142 @@
+#include "vltSerial.hpp"
+#include "vltFirmware.hpp"
+#include "vltCommands.hpp"
+
+#include "lnxSerial.hpp"
+#include "lnxFirmware.hpp"
+
+#include <getopt.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Linux main program: run a slave as a normal process.
+//
+//   voltiris-slave [--id N] [--serial 0123456789abcdef] [--seed N] [--fd N] [--rtu]
+//                  [--storage FILE]
+//
+// Without --fd, a pseudo-terminal is created and its name is printed
+// on stdout. Give this name to the Master as serial port name.
+// With --storage, option values are kept in FILE across restarts.
+
+using namespace voltiris;
+
+static SerialPort* sp = NULL;
+
+static char** arguments = NULL;
+
+// Restart the process keeping the serial descriptor, so that
+// the Master does not have to reconnect after a hard reset
+static void restart ()
+{
+    static char fdArgument [32];
+    snprintf (fdArgument, sizeof (fdArgument), "--fd=%d", ((LinuxSerialPort*) sp)->fd);
+
+    int argc = 0;
+    while (arguments [argc] != NULL)
+        argc++;
+
+    char** argv = (char**) calloc (argc + 2, sizeof (char*));
+    for (int i = 0; i < argc; i++)
+        argv [i] = arguments [i];
+    argv [argc] = fdArgument; // Last --fd wins
+
+    execv ("/proc/self/exe", argv);
+    perror ("execv");
+    exit (EXIT_FAILURE);
+}
+
+static bool parseSerialNumber (const char* hex, uint8* serial)
+{
+    if (strlen (hex) != 16)
+        return false;
+    for (int i = 0; i < 8; i++)
+    {
+        unsigned int byte;
+        if (sscanf (hex + 2 * i, "%2x", &byte) != 1)
+            return false;
+        serial [i] = (uint8) byte;
+    }
+    return true;
+}
+
+static void usage (const char* name)
+{
+    fprintf (stderr, "Usage: %s [--id N] [--serial HEX16] [--seed N] [--fd N] [--rtu] [--storage FILE]\n"
+                     "  --id N          slave id, 0 for a random id (default: 1)\n"
+                     "  --serial HEX16  64 bits serial number (default: deadbeefc0febabe)\n"
+                     "  --seed N        seed of the random generator\n"
+                     "  --fd N          use an opened descriptor instead of a pseudo-terminal\n"
+                     "  --rtu           binary RTU framing instead of ASCII\n"
+                     "  --storage FILE  keep the option values in FILE (default: in RAM)\n",
+                     name);
+}
+
+int main (int argc, char** argv)
+{
+    static const struct option longOptions [] =
+    {
+        {"id",     required_argument, NULL, 'i'},
+        {"serial", required_argument, NULL, 's'},
+        {"seed",   required_argument, NULL, 'r'},
+        {"fd",     required_argument, NULL, 'f'},
+        {"rtu",    no_argument,       NULL, 'u'},
+        {"storage", required_argument, NULL, 't'},
+        {"help",   no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    arguments = argv;
+    hostConfiguration.seed = (unsigned int) getpid ();
+
+    int c;
+    while ((c = getopt_long (argc, argv, "", longOptions, NULL)) != -1)
+    {
+        switch (c)
+        {
+            case 'i':
+                hostConfiguration.slaveId = (uint8) atoi (optarg);
+                break;
+            case 's':
+                if (!parseSerialNumber (optarg, hostConfiguration.serialNumber))
+                {
+                    usage (argv [0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'r':
+                hostConfiguration.seed = (unsigned int) strtoul (optarg, NULL, 0);
+                break;
+            case 'f':
+                serialUseDescriptor (atoi (optarg));
+                break;
+            case 'u':
+                hostConfiguration.framing = FRAMING_RTU;
+                break;
+            case 't':
+                hostConfiguration.storageFile = optarg;
+                break;
+            default:
+                usage (argv [0]);
+                return c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    hostConfiguration.hardReset = restart;
+
+    initialize ();
+    sp = serialInit ();
+    if (sp == NULL)
+    {
+        perror ("serialInit");
+        return EXIT_FAILURE;
+    }
+
+    if (serialGetName (sp) [0] != 0)
+        printf ("%s\n", serialGetName (sp));
+    fflush (stdout);
+
+    // Sleep until data is received (or a RTU frame ends) and process it
+    while (processSerialEvents (sp) != SERIAL_DISCONNECTED)
+        ;
+    return EXIT_SUCCESS; // Peer closed the connection
+}
@@ -0,0 +1,160 @@
+#include "lnxSerial.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+// POSIX implementation of the serial port.
+// By default a pseudo-terminal is created, its name can be given to the Master
+// (or any serial tool) as if it was a real serial port.
+// The descriptor is non-blocking: the kernel buffers play the role
+// of the receive and transmit ring buffers.
+
+namespace voltiris
+{
+    static LinuxSerialPort serial;
+
+    static int requestedFd = -1;
+
+    void serialUseDescriptor (int fd)
+    {
+        requestedFd = fd;
+    }
+
+    static bool openPseudoTerminal (LinuxSerialPort& port)
+    {
+        int fd = posix_openpt (O_RDWR | O_NOCTTY);
+        if (fd < 0)
+            return false;
+
+        const char* name = NULL;
+        if (grantpt (fd) != 0 || unlockpt (fd) != 0 || (name = ptsname (fd)) == NULL)
+        {
+            close (fd);
+            return false;
+        }
+
+        // Raw mode on the slave side: no echo nor \r\n translation
+        int ptyFd = open (name, O_RDWR | O_NOCTTY);
+        if (ptyFd < 0)
+        {
+            close (fd);
+            return false;
+        }
+        struct termios tio;
+        if (tcgetattr (ptyFd, &tio) == 0)
+        {
+            cfmakeraw (&tio);
+            cfsetspeed (&tio, B115200);
+            tcsetattr (ptyFd, TCSANOW, &tio);
+        }
+
+        port.fd = fd;
+        port.ptyFd = ptyFd;
+        snprintf (port.name, sizeof (port.name), "%s", name);
+        return true;
+    }
+
+    SerialPort* serialInit ()
+    {
+        if (requestedFd >= 0)
+        {
+            serial.fd = requestedFd;
+            serial.name [0] = 0;
+        }
+        else if (!openPseudoTerminal (serial))
+            return NULL;
+
+        int flags = fcntl (serial.fd, F_GETFL);
+        fcntl (serial.fd, F_SETFL, flags | O_NONBLOCK);
+
+        return (SerialPort*) &serial;
+    }
+
+    const char* serialGetName (SerialPort* sp)
+    {
+        assert (sp != NULL);
+        return ((LinuxSerialPort*) sp)->name;
+    }
+
+    int serialRead (SerialPort* sp)
+    {
+        assert (sp != NULL);
+        uint8 c;
+        if (read (((LinuxSerialPort*) sp)->fd, &c, 1) != 1)
+            return SERIAL_NO_CHARACTER_AVAILABLE;
+        return c;
+    }
+
+    int serialReadBlock (SerialPort* sp, uint8* buffer, uint16 bufferCapacity, bool& silence)
+    {
+        assert (sp != NULL);
+        silence = false; // Characters are not timed
+        ssize_t count = read (((LinuxSerialPort*) sp)->fd, buffer, bufferCapacity);
+        return count > 0 ? (int) count : 0;
+    }
+
+    int serialAvailable (SerialPort* sp)
+    {
+        assert (sp != NULL);
+        int count = 0;
+        if (ioctl (((LinuxSerialPort*) sp)->fd, FIONREAD, &count) != 0)
+            return 0;
+        return count;
+    }
+
+    int serialWrite (SerialPort* sp, uint8* buffer, uint16 bufferSizeinBtes)
+    {
+        assert (sp != NULL);
+        int fd = ((LinuxSerialPort*) sp)->fd;
+
+        uint16 written = 0;
+        while (written < bufferSizeinBtes)
+        {
+            ssize_t count = write (fd, buffer + written, bufferSizeinBtes - written);
+            if (count > 0)
+            {
+                written += (uint16) count;
+                continue;
+            }
+            if (count < 0 && (errno == EAGAIN || errno == EINTR))
+            {
+                struct pollfd pfd = {fd, POLLOUT, 0};
+                poll (&pfd, 1, -1);
+                continue;
+            }
+            break; // Peer is gone
+        }
+        return (int) written;
+    }
+
+    int serialWriteNonBlocking (SerialPort* sp, const uint8* buffer, uint16 bufferSizeinBtes)
+    {
+        assert (sp != NULL);
+        ssize_t count = write (((LinuxSerialPort*) sp)->fd, buffer, bufferSizeinBtes);
+        return count > 0 ? (int) count : 0;
+    }
+
+    int serialWait (SerialPort* sp, long timeoutUs)
+    {
+        assert (sp != NULL);
+        int available = serialAvailable (sp);
+        if (available > 0)
+            return available;
+
+        struct timespec timeout = {timeoutUs / 1000000, (timeoutUs % 1000000) * 1000};
+        struct pollfd pfd = {((LinuxSerialPort*) sp)->fd, POLLIN, 0};
+        int ret = ppoll (&pfd, 1, timeoutUs < 0 ? NULL : &timeout, NULL);
+        if (ret < 0)
+            return errno == EINTR ? 0 : -1;
+
+        available = serialAvailable (sp);
+        if (available == 0 && (pfd.revents & (POLLHUP | POLLERR)) != 0)
+            return -1;
+        return available;
+    }
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "vltSerial.hpp"
+
+namespace voltiris
+{
+    struct LinuxSerialPort: SerialPort
+    {
+        // Descriptor used to read / write (pseudo-terminal master or socket)
+        int fd = -1;
+
+        // Pseudo-terminal slave side, kept opened so that the master side
+        // does not report EIO when no client is connected
+        int ptyFd = -1;
+
+        // Name of the pseudo-terminal to connect to (eg: /dev/pts/3)
+        // Empty when the port is bound to an existing descriptor
+        char name [64] = {0};
+    };
+
+    // Use an already opened descriptor (eg: one end of a socketpair)
+    // for the next serialInit () call instead of creating a pseudo-terminal.
+    void serialUseDescriptor (int fd);
+
+    // Get the name of the pseudo-terminal the Master should open
+    // Return an empty string if the port is bound to a descriptor
+    const char* serialGetName (SerialPort* sp);
+}
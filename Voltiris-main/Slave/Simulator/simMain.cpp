@@ -0,0 +1,1146 @@
+#include "vltSerial.hpp"
+#include "vltFirmware.hpp"
+#include "vltCommands.hpp"
+#include "vltFraming.hpp"
+#include "vltPersist.hpp"
+#include "vltUpdate.hpp"
+
+#include "lnxFirmware.hpp"
+#include "simSerial.hpp"
+
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+// Multi-slave RS-485 bus simulator.
+//
+// Each slave is a forked process running the framework (processIncomingSerialData (),
+// processPacket (), option registry) on one end of a socketpair. The parent process
+// plays the Master and the shared half-duplex bus: every request is delivered to all
+// slaves, responses are collected once every slave is idle again, and a virtual clock
+// accounts for the wire time of each character at the selected baud rate. The slaves
+// run on their own virtual clock (see simSerial.hpp): results do not depend on the
+// scheduling of the processes. Noise (bit errors, dropped bytes) is injected
+// independently on each receiver.
+//
+// With --discover, slaves start with random ids and the Master assigns ids 1 to N
+// with the serial number tree walk (CMD_DISCOVERY_*) before polling them.
+//
+// With --update, the Master distributes a firmware image to every slave
+// (CMD_UPDATE_*: broadcasted blocks, missing blocks retransmitted) before polling them.
+//
+// With --power-cut, the slaves keep their options in storage files: the Master
+// changes an option several times, the slaves are killed once the values are stored
+// and restarted, then the Master checks that every slave restored the last values.
+
+using namespace voltiris;
+
+struct SimulatorSettings
+{
+    int    slaves        = MAX_SLAVE_ID;
+    long   baudRate      = 115200;
+    int    cycles        = 10;
+    double bitErrorRate  = 0;       // Probability of a bit flip
+    double dropRate      = 0;       // Probability of a dropped character
+    long   timeoutUs     = 100000;  // Master response timeout (ReadTimeout)
+    long   discoveryTimeoutUs = 10000; // Master response timeout of the discovery requests
+    long   turnaroundUs  = 50;      // Slave processing + line turnaround
+    int    retries       = 2;       // Retries after a failed transaction
+    uint16 address       = MEMORY_VERSION_ADDRESS;
+    uint16 count         = 1;       // Number of uint16 to read
+    Framing framing      = FRAMING_ASCII;
+    unsigned int seed    = 1;
+    bool   discover      = false;   // Assign the ids with the discovery tree walk
+    bool   randomSerials = false;   // Random serial numbers instead of sequential ones
+    long   updateSize    = 0;       // Size of the firmware update image (0: no update)
+    long   verifyWaitUs  = 100000;  // Master wait for the slaves to read back the staged image
+    bool   powerCut      = false;   // Check the option persistence across a power cut
+    long   persistDelayUs = 20000;  // configuration.persistDelayUs of the slaves
+};
+
+static SimulatorSettings settings;
+
+// -----------------------------
+// Slave side (child processes)
+// -----------------------------
+
+static void childHardReset ()
+{
+    _exit (EXIT_SUCCESS);
+}
+
+// Serial number of a slave: 0x56 followed by the slave index,
+// or random (splitmix64 of the seed and the slave index)
+static uint64_t serialNumberOf (uint8 index)
+{
+    if (!settings.randomSerials)
+        return 0x5600000000000000ull | index;
+
+    uint64_t z = ((uint64_t) settings.seed << 8 | index) + 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+// Byte of the firmware update image, same on the Master and the slaves
+static uint8 imageByte (uint32 offset)
+{
+    return (uint8) ((offset * 2654435761u + settings.seed) >> 13);
+}
+
+// The activated image must be the one sent by the Master:
+// a wrong one stops the slave (the Master sees it as not updated)
+static void childActivateUpdate (const uint8* image, uint32 imageSize)
+{
+    if (imageSize != (uint32) settings.updateSize)
+        _exit (EXIT_FAILURE);
+    for (uint32 offset = 0; offset < imageSize; offset++)
+        if (image [offset] != imageByte (offset))
+            _exit (EXIT_FAILURE);
+}
+
+// Directory of the storage files (--power-cut), options in RAM if empty
+static char storageDirectory [64] = "";
+
+static const char* storageFileOf (uint8 index)
+{
+    static char path [96];
+    if (storageDirectory [0] == 0)
+        return NULL;
+    snprintf (path, sizeof (path), "%s/slave-%u", storageDirectory, (unsigned) index);
+    return path;
+}
+
+static void runSlave (int fd, int controlFd, uint8 index)
+{
+    // Id 0: random id chosen by initialize ()
+    hostConfiguration.slaveId = settings.discover ? 0 : index;
+    hostConfiguration.seed = settings.seed + index;
+    hostConfiguration.hardReset = childHardReset;
+    hostConfiguration.activateUpdate = childActivateUpdate;
+    hostConfiguration.framing = settings.framing;
+    hostConfiguration.storageFile = storageFileOf (index);
+    uint64_t serialNumber = serialNumberOf (index);
+    for (int i = 0; i < SERIAL_NUMBER_SIZE; i++)
+        hostConfiguration.serialNumber [i] = (uint8) (serialNumber >> (56 - 8 * i));
+
+    hostConfiguration.clock = serialClock;
+    serialUseDescriptors (fd, controlFd);
+    initialize ();
+    SerialPort* sp = serialInit ();
+    if (sp == NULL)
+        _exit (EXIT_FAILURE);
+    configuration.persistDelayUs = (uint32) settings.persistDelayUs;
+
+    // Sleep until data is received (or a RTU frame ends) and process it
+    while (processSerialEvents (sp) != SERIAL_DISCONNECTED)
+        ;
+    _exit (EXIT_SUCCESS);
+}
+
+struct Slave
+{
+    pid_t pid;
+    int fd;
+    int controlFd; // Idle notifications of the slave
+};
+
+static std::vector<Slave> slaves;
+
+// Longest real time waited for a slave to process a request
+static const int IDLE_TIMEOUT_MS = 10000;
+
+// Wait until the slave processed every received character (and wrote
+// its response). A stopped slave is idle
+static void waitIdle (const Slave& slave)
+{
+    struct pollfd pfd = {slave.controlFd, POLLIN, 0};
+    uint8 idle;
+    if (poll (&pfd, 1, IDLE_TIMEOUT_MS) > 0 && read (slave.controlFd, &idle, 1) < 0)
+        perror ("waitIdle");
+}
+
+static bool spawnSlaves ()
+{
+    for (int i = 0; i < settings.slaves; i++)
+    {
+        int sv [2], control [2];
+        if (socketpair (AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+            return false;
+        if (socketpair (AF_UNIX, SOCK_STREAM, 0, control) != 0)
+        {
+            close (sv [0]);
+            close (sv [1]);
+            return false;
+        }
+
+        pid_t pid = fork ();
+        if (pid < 0)
+            return false;
+        if (pid == 0)
+        {
+            close (sv [0]);
+            close (control [0]);
+            for (size_t s = 0; s < slaves.size (); s++)
+            {
+                close (slaves [s].fd);
+                close (slaves [s].controlFd);
+            }
+            runSlave (sv [1], control [1], (uint8) (i + 1));
+        }
+        close (sv [1]);
+        close (control [1]);
+        slaves.push_back ({pid, sv [0], control [0]});
+    }
+
+    // Slaves ready for the first request
+    for (size_t i = 0; i < slaves.size (); i++)
+        waitIdle (slaves [i]);
+    return true;
+}
+
+static void stopSlaves ()
+{
+    for (size_t i = 0; i < slaves.size (); i++)
+    {
+        close (slaves [i].fd);
+        close (slaves [i].controlFd);
+    }
+    for (size_t i = 0; i < slaves.size (); i++)
+        waitpid (slaves [i].pid, NULL, 0);
+}
+
+// -----------------------------
+// Noise model
+// -----------------------------
+
+static uint32_t randomState = 1;
+
+// xorshift32, deterministic for a given seed
+static double randomUniform ()
+{
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return (double) randomState / 4294967296.0;
+}
+
+struct NoiseStatistics
+{
+    unsigned long corrupted = 0;
+    unsigned long dropped = 0;
+};
+
+static NoiseStatistics noise;
+
+// Apply noise to the characters seen by one receiver.
+// A flip of the start or stop bit is a framing error: the UART discards the character.
+static std::vector<uint8> applyNoise (const std::vector<uint8>& in)
+{
+    std::vector<uint8> out;
+    out.reserve (in.size ());
+    for (size_t i = 0; i < in.size (); i++)
+    {
+        if (settings.dropRate > 0 && randomUniform () < settings.dropRate)
+        {
+            noise.dropped++;
+            continue;
+        }
+
+        uint8 c = in [i];
+        bool framingError = false;
+        if (settings.bitErrorRate > 0)
+        {
+            for (int bit = 0; bit < 10; bit++)
+            {
+                if (randomUniform () >= settings.bitErrorRate)
+                    continue;
+                if (bit == 0 || bit == 9)
+                    framingError = true;
+                else
+                    c ^= (uint8) (1 << (bit - 1));
+            }
+        }
+        if (framingError)
+        {
+            noise.dropped++;
+            continue;
+        }
+        if (c != in [i])
+            noise.corrupted++;
+        out.push_back (c);
+    }
+    return out;
+}
+
+// -----------------------------
+// Master side: ASCII framing
+// -----------------------------
+
+static const char hexDigits [] = "0123456789ABCDEF";
+
+static std::vector<uint8> encodeAscii (const std::vector<uint8>& bin)
+{
+    std::vector<uint8> ascii;
+    uint8 crc8 = 0;
+    ascii.push_back (':');
+    for (size_t i = 0; i <= bin.size (); i++)
+    {
+        uint8 b = i < bin.size () ? bin [i] : crc8;
+        crc8 += b;
+        ascii.push_back (hexDigits [b >> 4]);
+        ascii.push_back (hexDigits [b & 0xf]);
+    }
+    ascii.push_back ('\r');
+    ascii.push_back ('\n');
+    return ascii;
+}
+
+static int hexValue (uint8 c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Return false if the frame is malformed or the CRC is wrong
+static bool decodeAscii (const std::vector<uint8>& ascii, std::vector<uint8>& bin)
+{
+    bin.clear ();
+    size_t n = ascii.size ();
+    if (n < 5 || ascii [0] != ':' || ascii [n - 2] != '\r' || ascii [n - 1] != '\n' || (n - 3) % 2 != 0)
+        return false;
+    for (size_t i = 1; i < n - 2; i += 2)
+    {
+        int hi = hexValue (ascii [i]), low = hexValue (ascii [i + 1]);
+        if (hi < 0 || low < 0)
+            return false;
+        bin.push_back ((uint8) (hi << 4 | low));
+    }
+    uint8 crc8 = 0;
+    for (size_t i = 0; i + 1 < bin.size (); i++)
+        crc8 += bin [i];
+    if (crc8 != bin.back ())
+        return false;
+    bin.pop_back ();
+    return true;
+}
+
+// -----------------------------
+// Master side: RTU framing
+// -----------------------------
+
+static uint16 crc16 (const std::vector<uint8>& data, size_t size)
+{
+    uint16 crc = 0xffff;
+    for (size_t i = 0; i < size; i++)
+    {
+        crc ^= data [i];
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc & 1) ? (crc >> 1) ^ 0xa001 : crc >> 1;
+    }
+    return crc;
+}
+
+static std::vector<uint8> encodeRtu (const std::vector<uint8>& bin)
+{
+    std::vector<uint8> rtu (bin);
+    uint16 crc = crc16 (bin, bin.size ());
+    rtu.push_back ((uint8) (crc & 0xff));
+    rtu.push_back ((uint8) (crc >> 8));
+    return rtu;
+}
+
+// Return false if the frame is too short or the CRC is wrong
+static bool decodeRtu (const std::vector<uint8>& rtu, std::vector<uint8>& bin)
+{
+    bin.clear ();
+    if (rtu.size () < 4)
+        return false;
+    size_t crcIndex = rtu.size () - 2;
+    if (crc16 (rtu, crcIndex) != (uint16) (rtu [crcIndex] | (rtu [crcIndex + 1] << 8)))
+        return false;
+    bin.assign (rtu.begin (), rtu.begin () + crcIndex);
+    return true;
+}
+
+// -----------------------------
+// Virtual bus
+// -----------------------------
+
+struct BusStatistics
+{
+    unsigned long transactions = 0;
+    unsigned long succeeded = 0;
+    unsigned long failed = 0;     // All retries exhausted
+    unsigned long retries = 0;
+    unsigned long timeouts = 0;
+    unsigned long invalid = 0;    // Response received but rejected by the Master
+    unsigned long collisions = 0;
+    unsigned long goodputBytes = 0;
+    double busyUs = 0;            // Time with characters on the wire
+};
+
+static BusStatistics bus;
+
+// Wire time of characters: start bit + 8 data bits + stop bit
+static double wireTimeUs (size_t characters)
+{
+    return (double) characters * 10.0 * 1e6 / (double) settings.baudRate;
+}
+
+static void writeAll (int fd, const std::vector<uint8>& data)
+{
+    size_t written = 0;
+    while (written < data.size ())
+    {
+        ssize_t count = write (fd, data.data () + written, data.size () - written);
+        if (count <= 0)
+            return;
+        written += (size_t) count;
+    }
+}
+
+// Deliver a request to all slaves and collect what they put on the bus.
+// Return the number of slaves that answered.
+static int exchange (const std::vector<uint8>& request, std::vector<uint8>& response)
+{
+    for (size_t i = 0; i < slaves.size (); i++)
+        writeAll (slaves [i].fd, applyNoise (request));
+
+    // Responses are complete once every slave is idle again
+    std::vector<std::vector<uint8>> answers (slaves.size ());
+    for (size_t i = 0; i < slaves.size (); i++)
+    {
+        waitIdle (slaves [i]);
+        uint8 data [512];
+        ssize_t count;
+        while ((count = recv (slaves [i].fd, data, sizeof (data), MSG_DONTWAIT)) > 0)
+            answers [i].insert (answers [i].end (), data, data + count);
+    }
+
+    int responders = 0;
+    response.clear ();
+    for (size_t i = 0; i < answers.size (); i++)
+    {
+        if (answers [i].empty ())
+            continue;
+        if (responders++ == 0)
+        {
+            response = answers [i];
+            continue;
+        }
+        // Collision: drivers fight on the line, the Master gets garbage
+        if (answers [i].size () > response.size ())
+            response.resize (answers [i].size (), 0);
+        for (size_t c = 0; c < answers [i].size (); c++)
+            response [c] |= answers [i][c];
+    }
+    return responders;
+}
+
+// Perform one Master transaction with retries, advance the virtual clock
+// Return the virtual duration in microseconds. responseData: the data of the
+// response, left empty if the transaction failed
+static double transaction (const std::vector<uint8>& requestBin, uint8 expectedDataSize,
+                           BusStatistics& statistics = bus, std::vector<uint8>* responseData = NULL)
+{
+    bool rtu = settings.framing == FRAMING_RTU;
+    std::vector<uint8> request = rtu ? encodeRtu (requestBin) : encodeAscii (requestBin);
+
+    // RTU frames end with a silence, on both directions
+    double frameEndUs = rtu ? RTU_SILENCE_US : 0;
+    double elapsedUs = 0;
+    if (responseData != NULL)
+        responseData->clear ();
+
+    statistics.transactions++;
+    for (int attempt = 0; attempt <= settings.retries; attempt++)
+    {
+        if (attempt > 0)
+            statistics.retries++;
+
+        std::vector<uint8> raw;
+        int responders = exchange (request, raw);
+        elapsedUs += wireTimeUs (request.size ()) + frameEndUs;
+        statistics.busyUs += wireTimeUs (request.size ());
+
+        if (responders > 1)
+            statistics.collisions++;
+
+        // ASCII: ReadLine () waits for '\n'. RTU: any character followed by a silence
+        std::vector<uint8> received = applyNoise (raw);
+        bool complete = rtu ? !received.empty () :
+                              received.size () >= 2 && received.back () == '\n';
+        if (!complete)
+        {
+            // Nothing (or a truncated line) received: the Master waits for its timeout
+            statistics.timeouts++;
+            elapsedUs += settings.timeoutUs;
+            if (responders > 0)
+                statistics.busyUs += settings.turnaroundUs + wireTimeUs (raw.size ());
+            continue;
+        }
+
+        elapsedUs += settings.turnaroundUs + wireTimeUs (raw.size ()) + frameEndUs;
+        statistics.busyUs += wireTimeUs (raw.size ());
+
+        std::vector<uint8> bin;
+        bool decoded = rtu ? decodeRtu (received, bin) : decodeAscii (received, bin);
+        if (!decoded || bin.size () < 3 ||
+            bin [0] != requestBin [0] || bin [1] != requestBin [1] || bin [2] != expectedDataSize ||
+            bin.size () != 3 + (size_t) expectedDataSize)
+        {
+            statistics.invalid++;
+            continue;
+        }
+
+        statistics.succeeded++;
+        statistics.goodputBytes += expectedDataSize;
+        if (responseData != NULL)
+            responseData->assign (bin.begin () + 3, bin.end ());
+        return elapsedUs;
+    }
+
+    statistics.failed++;
+    return elapsedUs;
+}
+
+// Poll every slave once with a Read Input Registers request
+static double pollCycle ()
+{
+    double cycleUs = 0;
+    for (int id = 1; id <= settings.slaves; id++)
+    {
+        std::vector<uint8> request;
+        request.push_back ((uint8) id);
+        request.push_back (0x04); // Read Input Registers
+        request.push_back ((uint8) (settings.address >> 8));
+        request.push_back ((uint8) (settings.address & 0xff));
+        request.push_back ((uint8) (settings.count >> 8));
+        request.push_back ((uint8) (settings.count & 0xff));
+        cycleUs += transaction (request, (uint8) (2 * settings.count));
+    }
+    return cycleUs;
+}
+
+// -----------------------------
+// Master side: discovery
+// -----------------------------
+
+enum Presence
+{
+    PRESENCE_NONE,   // Nothing received
+    PRESENCE_SINGLE, // Valid response
+    PRESENCE_SEVERAL // Something received but not valid: collision (or noise)
+};
+
+struct DiscoveryStatistics
+{
+    unsigned long probes = 0;
+    unsigned long assignments = 0;
+    unsigned long passes = 0;
+    unsigned long unresolved = 0; // Identical serial numbers or more than MAX_SLAVE_ID slaves
+    unsigned long collisions = 0; // Expected: slaves sharing a prefix answer together
+    int nextId = 1;
+    double elapsedUs = 0;
+};
+
+static DiscoveryStatistics discovery;
+
+// Send a discovery request once and advance the virtual clock (as transaction ()).
+// Discovery traffic is not part of the poll statistics (bus)
+static Presence discoveryExchange (const std::vector<uint8>& requestBin, std::vector<uint8>& bin)
+{
+    bool rtu = settings.framing == FRAMING_RTU;
+    std::vector<uint8> request = rtu ? encodeRtu (requestBin) : encodeAscii (requestBin);
+    double frameEndUs = rtu ? RTU_SILENCE_US : 0;
+
+    std::vector<uint8> raw;
+    int responders = exchange (request, raw);
+    discovery.elapsedUs += wireTimeUs (request.size ()) + frameEndUs;
+    if (responders > 1)
+        discovery.collisions++;
+
+    std::vector<uint8> received = applyNoise (raw);
+    bool complete = rtu ? !received.empty () :
+                          received.size () >= 2 && received.back () == '\n';
+    if (!complete)
+    {
+        discovery.elapsedUs += settings.discoveryTimeoutUs;
+        return PRESENCE_NONE;
+    }
+
+    discovery.elapsedUs += settings.turnaroundUs + wireTimeUs (raw.size ()) + frameEndUs;
+    bool decoded = rtu ? decodeRtu (received, bin) : decodeAscii (received, bin);
+    return decoded ? PRESENCE_SINGLE : PRESENCE_SEVERAL;
+}
+
+// Preset Multiple Registers request sent to DISCOVERY_SLAVE_ID
+static std::vector<uint8> discoveryRequest (uint16 address, uint64_t value, uint16 last)
+{
+    std::vector<uint8> request = {DISCOVERY_SLAVE_ID, 0x10, (uint8) (address >> 8), (uint8) (address & 0xff)};
+    if (address == CMD_DISCOVERY_START)
+    {
+        request.insert (request.end (), {0, 0, 0});
+        return request;
+    }
+    request.insert (request.end (), {0, (uint8) DISCOVERY_REGISTERS, (uint8) (2 * DISCOVERY_REGISTERS)});
+    if (address == CMD_DISCOVERY_PROBE)
+        request.insert (request.end (), {(uint8) (last >> 8), (uint8) (last & 0xff)});
+    for (int i = 0; i < SERIAL_NUMBER_SIZE; i++)
+        request.push_back ((uint8) (value >> (56 - 8 * i)));
+    if (address == CMD_DISCOVERY_ASSIGN)
+        request.insert (request.end (), {(uint8) (last >> 8), (uint8) (last & 0xff)});
+    return request;
+}
+
+// Ask the undiscovered slaves matching the bitCount first bits of prefix for their serial number
+static Presence probe (uint64_t prefix, uint16 bitCount, uint64_t& serialNumber)
+{
+    discovery.probes++;
+    std::vector<uint8> bin;
+    Presence presence = discoveryExchange (discoveryRequest (CMD_DISCOVERY_PROBE, prefix, bitCount), bin);
+    if (presence != PRESENCE_SINGLE)
+        return presence;
+
+    if (bin.size () != 3 + SERIAL_NUMBER_SIZE || bin [0] != DISCOVERY_SLAVE_ID ||
+        bin [1] != 0x04 || bin [2] != SERIAL_NUMBER_SIZE)
+        return PRESENCE_SEVERAL;
+    serialNumber = 0;
+    for (int i = 0; i < SERIAL_NUMBER_SIZE; i++)
+        serialNumber = serialNumber << 8 | bin [3 + i];
+
+    // The OR of colliding responses may still be a valid frame
+    uint64_t mask = bitCount == 0 ? 0 : ~0ull << (64 - bitCount);
+    return (serialNumber & mask) == (prefix & mask) ? PRESENCE_SINGLE : PRESENCE_SEVERAL;
+}
+
+// Give the next id to the slave with the serial number. The assignment is
+// idempotent: it is retried, and the id is not reused if it is not confirmed
+static bool assign (uint64_t serialNumber)
+{
+    uint8 id = (uint8) discovery.nextId++;
+    for (int attempt = 0; attempt <= settings.retries; attempt++)
+    {
+        discovery.assignments++;
+        std::vector<uint8> bin;
+        Presence presence = discoveryExchange (discoveryRequest (CMD_DISCOVERY_ASSIGN, serialNumber, id), bin);
+        if (presence == PRESENCE_SINGLE && bin.size () == 6 && bin [0] == id && bin [1] == 0x10 &&
+            bin [5] == DISCOVERY_REGISTERS)
+            return true;
+    }
+    return false;
+}
+
+// Tree walk over the serial number prefixes. several: the prefix is known to match
+// several slaves (no need to probe it). A prefix is done once its probe gets no
+// response. Return false if no slave matched
+static bool discoverPrefix (uint64_t prefix, uint16 bitCount, bool several)
+{
+    bool inferred = several;
+    bool found = several;
+    while (!several)
+    {
+        uint64_t serialNumber = 0;
+        Presence presence = probe (prefix, bitCount, serialNumber);
+        if (presence == PRESENCE_NONE)
+            return found;
+        found = true;
+
+        if (discovery.nextId > MAX_SLAVE_ID)
+        {
+            discovery.unresolved++; // More slaves than ids
+            return true;
+        }
+
+        // Colliding responses may look valid: probe again once the slave is quiet
+        if (presence == PRESENCE_SINGLE && assign (serialNumber))
+            continue;
+        several = true;
+    }
+
+    if (bitCount == 64)
+    {
+        discovery.unresolved++; // Identical serial numbers
+        return true;
+    }
+
+    // If nothing matches the 0 branch, the collision comes from the 1 branch
+    // (only inferred from a probed collision: a spurious one costs a few probes)
+    bool low = discoverPrefix (prefix, bitCount + 1, false);
+    discoverPrefix (prefix | 1ull << (63 - bitCount), bitCount + 1, !low && !inferred);
+    return true;
+}
+
+// Assign ids 1 to N. A pass ends when the empty prefix gets no response
+// (a slave that missed a request is found by the next pass)
+static void discoverSlaves ()
+{
+    std::vector<uint8> bin;
+    discoveryExchange (discoveryRequest (CMD_DISCOVERY_START, 0, 0), bin);
+    for (int pass = 0; pass <= settings.retries && discovery.nextId <= MAX_SLAVE_ID; pass++)
+    {
+        discovery.passes++;
+        if (!discoverPrefix (0, 0, false))
+            break;
+    }
+}
+
+// -----------------------------
+// Master side: firmware update
+// -----------------------------
+
+// Rounds of block transmission and bitmap collection before giving up
+static const int MAX_UPDATE_ROUNDS = 10;
+
+struct UpdateStatistics
+{
+    unsigned long blocks = 0;        // Blocks of the image
+    unsigned long blocksSent = 0;    // Retransmissions included
+    unsigned long rounds = 0;
+    unsigned long verified = 0;      // Slaves with the whole image verified
+    unsigned long activated = 0;     // Slaves running the image
+    BusStatistics reads;             // Status and bitmap reads (not part of the poll statistics)
+    double elapsedUs = 0;
+};
+
+static UpdateStatistics update;
+
+// Broadcast a Preset Multiple Registers request (no response) and advance the
+// virtual clock, the slaves process it during the turnaround
+static void updateBroadcast (uint16 address, const std::vector<uint8>& data)
+{
+    std::vector<uint8> requestBin = {BROADCAST_SLAVE_ID, 0x10, (uint8) (address >> 8), (uint8) (address & 0xff),
+                                     0, (uint8) ((data.size () + 1) / 2), (uint8) data.size ()};
+    requestBin.insert (requestBin.end (), data.begin (), data.end ());
+
+    bool rtu = settings.framing == FRAMING_RTU;
+    std::vector<uint8> request = rtu ? encodeRtu (requestBin) : encodeAscii (requestBin);
+    std::vector<uint8> raw;
+    exchange (request, raw);
+    update.elapsedUs += wireTimeUs (request.size ()) + (rtu ? RTU_SILENCE_US : 0) + settings.turnaroundUs;
+}
+
+// Read count registers of slave id, return false if the transaction failed
+static bool updateRead (int id, uint16 address, uint16 count, std::vector<uint8>& values)
+{
+    std::vector<uint8> request = {(uint8) id, 0x04, (uint8) (address >> 8), (uint8) (address & 0xff),
+                                  (uint8) (count >> 8), (uint8) (count & 0xff)};
+    update.elapsedUs += transaction (request, (uint8) (2 * count), update.reads, &values);
+    return !values.empty ();
+}
+
+static std::vector<uint8> toBytes (uint32 value, int size)
+{
+    std::vector<uint8> bytes;
+    for (int i = size - 1; i >= 0; i--)
+        bytes.push_back ((uint8) (value >> (8 * i)));
+    return bytes;
+}
+
+// Distribute the image to every slave: the blocks are broadcasted once, then each
+// round collects the missing-block bitmap of the slaves not verified yet and
+// broadcasts the union of their missing blocks. The image is activated on all
+// slaves at once, only if every slave verified it
+static void updateSlaves ()
+{
+    std::vector<uint8> image ((size_t) settings.updateSize);
+    for (size_t offset = 0; offset < image.size (); offset++)
+        image [offset] = imageByte ((uint32) offset);
+    uint16 imageCrc = crc16 (image, image.size ());
+    uint16 blockCount = (uint16) ((image.size () + UPDATE_BLOCK_SIZE - 1) / UPDATE_BLOCK_SIZE);
+    update.blocks = blockCount;
+
+    std::vector<uint8> start = toBytes ((uint32) image.size (), 4);
+    std::vector<uint8> crc = toBytes (imageCrc, 2);
+    start.insert (start.end (), crc.begin (), crc.end ());
+
+    std::vector<int> pending; // Slaves not verified yet
+    for (int id = 1; id <= settings.slaves; id++)
+        pending.push_back (id);
+
+    bool sendStart = true;
+    std::vector<bool> sendBlock (blockCount, true);
+    while (!pending.empty () && update.rounds < MAX_UPDATE_ROUNDS)
+    {
+        update.rounds++;
+
+        // Slaves that missed the start keep it, then take the blocks
+        if (sendStart)
+            updateBroadcast (CMD_UPDATE_START, start);
+        for (uint16 block = 0; block < blockCount; block++)
+        {
+            if (!sendBlock [block])
+                continue;
+            size_t offset = (size_t) block * UPDATE_BLOCK_SIZE;
+            size_t size = std::min ((size_t) UPDATE_BLOCK_SIZE, image.size () - offset);
+            std::vector<uint8> data = toBytes (block, 2);
+            data.insert (data.end (), image.begin () + offset, image.begin () + offset + size);
+            std::vector<uint8> blockCrc = toBytes (computeCRC16 (image.data () + offset, (uint16) size), 2);
+            data.insert (data.end (), blockCrc.begin (), blockCrc.end ());
+            updateBroadcast (CMD_UPDATE_BLOCK, data);
+            update.blocksSent++;
+        }
+        // Ignored by the slaves still missing blocks
+        updateBroadcast (CMD_UPDATE_VERIFY, crc);
+        update.elapsedUs += settings.verifyWaitUs;
+
+        sendStart = false;
+        sendBlock.assign (blockCount, false);
+        std::vector<int> stillPending;
+        for (size_t i = 0; i < pending.size (); i++)
+        {
+            int id = pending [i];
+            std::vector<uint8> status;
+            if (!updateRead (id, CMD_UPDATE_STATUS, UPDATE_REGISTERS, status))
+            {
+                stillPending.push_back (id); // Unreachable this round
+                continue;
+            }
+            uint16 state = (uint16) (status [2 * UPDATE_STATE] << 8 | status [2 * UPDATE_STATE + 1]);
+            uint16 missing = (uint16) (status [2 * UPDATE_MISSING_COUNT] << 8 | status [2 * UPDATE_MISSING_COUNT + 1]);
+            uint16 slaveCrc = (uint16) (status [2 * UPDATE_IMAGE_CRC] << 8 | status [2 * UPDATE_IMAGE_CRC + 1]);
+            if (state == UPDATE_VERIFIED && slaveCrc == imageCrc)
+            {
+                update.verified++;
+                continue;
+            }
+            stillPending.push_back (id);
+
+            // Start missed (or staging failed): every block again
+            if (state != UPDATE_RECEIVING || slaveCrc != imageCrc)
+            {
+                sendStart = true;
+                sendBlock.assign (blockCount, true);
+                continue;
+            }
+
+            // Verify missed
+            if (missing == 0)
+                continue;
+
+            // Bitmap pages covering the blocks of the image
+            uint16 bitmapSize = (uint16) ((blockCount + 15) / 16 * 2);
+            for (uint16 offset = 0; offset < bitmapSize; offset += UPDATE_BITMAP_PAGE_SIZE)
+            {
+                uint16 size = std::min ((uint16) (bitmapSize - offset), UPDATE_BITMAP_PAGE_SIZE);
+                std::vector<uint8> bitmap;
+                if (!updateRead (id, CMD_UPDATE_MISSING_START + offset / UPDATE_BITMAP_PAGE_SIZE, size / 2, bitmap))
+                {
+                    // Bitmap unknown: every block of the page again
+                    bitmap.assign (size, 0xff);
+                }
+                for (uint16 b = 0; b < 8 * size && 8 * offset + b < blockCount; b++)
+                    if ((bitmap [b / 8] >> (b % 8)) & 1)
+                        sendBlock [8 * offset + b] = true;
+            }
+        }
+        pending = stillPending;
+    }
+
+    // Coordinated activation: all slaves or none. A slave that
+    // missed the activation is still verified, activated ones are idle
+    if (!pending.empty ())
+        return;
+    std::vector<int> verified;
+    for (int id = 1; id <= settings.slaves; id++)
+        verified.push_back (id);
+    for (int attempt = 0; attempt <= settings.retries && !verified.empty (); attempt++)
+    {
+        updateBroadcast (CMD_UPDATE_ACTIVATE, crc);
+        std::vector<int> stillVerified;
+        for (size_t i = 0; i < verified.size (); i++)
+        {
+            std::vector<uint8> status;
+            if (!updateRead (verified [i], CMD_UPDATE_STATUS, UPDATE_REGISTERS, status))
+                stillVerified.push_back (verified [i]); // Restarting (or stopped on a wrong image)
+            else if (status [2 * UPDATE_STATE + 1] == UPDATE_IDLE)
+                update.activated++;
+            else
+                stillVerified.push_back (verified [i]);
+        }
+        verified = stillVerified;
+    }
+}
+
+// -----------------------------
+// Master side: power cut
+// -----------------------------
+
+// Option changed by the Master (Speed_Levels_b1, broadcastable)
+static const uint16 POWER_CUT_ADDRESS = OPTIONS_ADDRESS_START + 8;
+static const uint16 POWER_CUT_COUNT = 4;
+
+// Presets sent before the power cut: only the last values are stored
+static const int POWER_CUT_CHANGES = 5;
+
+struct PowerCutStatistics
+{
+    unsigned long changed = 0;   // Slaves with the last values before the power cut
+    unsigned long restored = 0;  // Changed slaves with the same values after the restart
+    BusStatistics reads;         // Option reads (not part of the poll statistics)
+};
+
+static PowerCutStatistics powerCut;
+
+static void killSlaves ()
+{
+    for (size_t i = 0; i < slaves.size (); i++)
+        kill (slaves [i].pid, SIGKILL);
+    stopSlaves ();
+    slaves.clear ();
+}
+
+// Read the option of slave id, empty if the transaction failed
+static std::vector<uint8> powerCutRead (int id)
+{
+    std::vector<uint8> request = {(uint8) id, 0x04, (uint8) (POWER_CUT_ADDRESS >> 8),
+                                  (uint8) (POWER_CUT_ADDRESS & 0xff), 0, (uint8) POWER_CUT_COUNT};
+    std::vector<uint8> values;
+    transaction (request, (uint8) (2 * POWER_CUT_COUNT), powerCut.reads, &values);
+    return values;
+}
+
+// Change the option on every slave, cut the power once the values are stored
+// and check the values restored by the slaves that received the last change
+static bool powerCutSlaves ()
+{
+    std::vector<uint8> values;
+    for (int change = 1; change <= POWER_CUT_CHANGES; change++)
+    {
+        values.clear ();
+        for (uint16 i = 0; i < POWER_CUT_COUNT; i++)
+        {
+            std::vector<uint8> value = toBytes ((uint32) (100 * change + 10 * i), 2);
+            values.insert (values.end (), value.begin (), value.end ());
+        }
+        std::vector<uint8> requestBin = {BROADCAST_SLAVE_ID, 0x10, (uint8) (POWER_CUT_ADDRESS >> 8),
+                                         (uint8) (POWER_CUT_ADDRESS & 0xff), 0, (uint8) POWER_CUT_COUNT,
+                                         (uint8) values.size ()};
+        requestBin.insert (requestBin.end (), values.begin (), values.end ());
+        std::vector<uint8> raw;
+        exchange (settings.framing == FRAMING_RTU ? encodeRtu (requestBin) : encodeAscii (requestBin), raw);
+    }
+
+    // Broadcasts are not acknowledged: noise may have hidden the last change
+    std::vector<bool> changed (settings.slaves + 1, false);
+    for (int id = 1; id <= settings.slaves; id++)
+        if (powerCutRead (id) == values)
+        {
+            changed [id] = true;
+            powerCut.changed++;
+        }
+
+    // Slaves are idle once the record is written
+    killSlaves ();
+    if (!spawnSlaves ())
+        return false;
+
+    for (int id = 1; id <= settings.slaves; id++)
+        if (changed [id] && powerCutRead (id) == values)
+            powerCut.restored++;
+    return true;
+}
+
+// -----------------------------
+// Main program
+// -----------------------------
+
+static void usage (const char* name)
+{
+    fprintf (stderr, "Usage: %s [options]\n"
+                     "  --slaves N        number of slaves on the bus (default: %d)\n"
+                     "  --baud N          baud rate (default: 115200)\n"
+                     "  --cycles N        number of poll cycles (default: 10)\n"
+                     "  --ber P           bit error probability (default: 0)\n"
+                     "  --drop P          dropped character probability (default: 0)\n"
+                     "  --timeout US      Master response timeout in us (default: 100000)\n"
+                     "  --discovery-timeout US  Master response timeout of the discovery in us (default: 10000)\n"
+                     "  --turnaround US   slave turnaround in us (default: 50)\n"
+                     "  --retries N       retries per transaction (default: 2)\n"
+                     "  --address A       register address polled (default: 0x100)\n"
+                     "  --count N         number of uint16 polled (default: 1)\n"
+                     "  --seed N          seed of the noise generator (default: 1)\n"
+                     "  --rtu             binary RTU framing instead of ASCII\n"
+                     "  --discover        start with random ids, assigned by the serial number tree walk\n"
+                     "  --random-serials  random serial numbers instead of sequential ones\n"
+                     "  --update BYTES    distribute a firmware update image of BYTES bytes first\n"
+                     "  --verify-wait US  wait for the slaves to verify the update in us (default: 100000)\n"
+                     "  --power-cut       check that the slaves restore their options after a power cut\n"
+                     "  --persist-delay US  quiet time before the slaves store their options in us (default: 20000)\n",
+                     name, (int) MAX_SLAVE_ID);
+}
+
+int main (int argc, char** argv)
+{
+    static const struct option longOptions [] =
+    {
+        {"slaves",     required_argument, NULL, 'n'},
+        {"baud",       required_argument, NULL, 'b'},
+        {"cycles",     required_argument, NULL, 'c'},
+        {"ber",        required_argument, NULL, 'e'},
+        {"drop",       required_argument, NULL, 'd'},
+        {"timeout",    required_argument, NULL, 't'},
+        {"turnaround", required_argument, NULL, 'u'},
+        {"retries",    required_argument, NULL, 'r'},
+        {"address",    required_argument, NULL, 'a'},
+        {"count",      required_argument, NULL, 'k'},
+        {"seed",       required_argument, NULL, 's'},
+        {"rtu",        no_argument,       NULL, 'p'},
+        {"discover",   no_argument,       NULL, 'i'},
+        {"discovery-timeout", required_argument, NULL, 'y'},
+        {"random-serials", no_argument,   NULL, 'z'},
+        {"update",     required_argument, NULL, 'w'},
+        {"verify-wait", required_argument, NULL, 'v'},
+        {"power-cut",  no_argument,       NULL, 'x'},
+        {"persist-delay", required_argument, NULL, 'g'},
+        {"help",       no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int c;
+    while ((c = getopt_long (argc, argv, "", longOptions, NULL)) != -1)
+    {
+        switch (c)
+        {
+            case 'n': settings.slaves       = atoi (optarg); break;
+            case 'b': settings.baudRate     = atol (optarg); break;
+            case 'c': settings.cycles       = atoi (optarg); break;
+            case 'e': settings.bitErrorRate = atof (optarg); break;
+            case 'd': settings.dropRate     = atof (optarg); break;
+            case 't': settings.timeoutUs    = atol (optarg); break;
+            case 'u': settings.turnaroundUs = atol (optarg); break;
+            case 'r': settings.retries      = atoi (optarg); break;
+            case 'a': settings.address      = (uint16) strtoul (optarg, NULL, 0); break;
+            case 'k': settings.count        = (uint16) strtoul (optarg, NULL, 0); break;
+            case 's': settings.seed         = (unsigned int) strtoul (optarg, NULL, 0); break;
+            case 'p': settings.framing      = FRAMING_RTU; break;
+            case 'i': settings.discover     = true; break;
+            case 'y': settings.discoveryTimeoutUs = atol (optarg); break;
+            case 'z': settings.randomSerials = true; break;
+            case 'w': settings.updateSize   = atol (optarg); break;
+            case 'v': settings.verifyWaitUs = atol (optarg); break;
+            case 'x': settings.powerCut     = true; break;
+            case 'g': settings.persistDelayUs = atol (optarg); break;
+            default:
+                usage (argv [0]);
+                return c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (settings.slaves < 1 || settings.slaves > MAX_SLAVE_ID || settings.baudRate <= 0 ||
+        settings.cycles < 1 || settings.count < 1 || settings.count > 127 ||
+        settings.updateSize < 0 || settings.updateSize > (long) MAX_UPDATE_BLOCKS * UPDATE_BLOCK_SIZE ||
+        settings.verifyWaitUs < 0 || settings.persistDelayUs < 0 ||
+        (settings.powerCut && settings.discover)) // Random ids after the restart
+    {
+        usage (argv [0]);
+        return EXIT_FAILURE;
+    }
+
+    randomState = settings.seed != 0 ? settings.seed : 1;
+    signal (SIGPIPE, SIG_IGN);
+
+    if (settings.powerCut)
+    {
+        strcpy (storageDirectory, "/tmp/voltiris-simulator-XXXXXX");
+        if (mkdtemp (storageDirectory) == NULL)
+        {
+            perror ("mkdtemp");
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (!spawnSlaves ())
+    {
+        perror ("spawnSlaves");
+        stopSlaves ();
+        return EXIT_FAILURE;
+    }
+
+    if (settings.discover)
+        discoverSlaves ();
+
+    if (settings.powerCut && !powerCutSlaves ())
+    {
+        perror ("spawnSlaves");
+        stopSlaves ();
+        return EXIT_FAILURE;
+    }
+
+    if (settings.updateSize > 0)
+        updateSlaves ();
+
+    double minUs = 0, maxUs = 0, totalUs = 0;
+    for (int cycle = 0; cycle < settings.cycles; cycle++)
+    {
+        double cycleUs = pollCycle ();
+        if (cycle == 0 || cycleUs < minUs)
+            minUs = cycleUs;
+        if (cycleUs > maxUs)
+            maxUs = cycleUs;
+        totalUs += cycleUs;
+    }
+
+    stopSlaves ();
+
+    if (settings.powerCut)
+    {
+        for (int i = 1; i <= settings.slaves; i++)
+            unlink (storageFileOf ((uint8) i));
+        rmdir (storageDirectory);
+    }
+
+    printf ("slaves:              %d\n", settings.slaves);
+    printf ("baud rate:           %ld\n", settings.baudRate);
+    printf ("framing:             %s\n", settings.framing == FRAMING_RTU ? "RTU" : "ASCII");
+    printf ("poll:                address 0x%x, %u register(s)\n", (unsigned) settings.address, (unsigned) settings.count);
+    if (settings.discover)
+    {
+        printf ("discovery:           %d id(s) assigned in %.3f ms, %lu probes (%lu collisions), %lu assignments, %lu pass(es)\n",
+                discovery.nextId - 1, discovery.elapsedUs / 1000.0, discovery.probes, discovery.collisions,
+                discovery.assignments, discovery.passes);
+        if (discovery.unresolved > 0)
+            printf ("unresolved:          %lu\n", discovery.unresolved);
+    }
+    if (settings.updateSize > 0)
+    {
+        printf ("update:              %ld bytes, %lu blocks in %.3f ms, %lu round(s), %lu blocks sent (%lu retransmitted)\n",
+                settings.updateSize, update.blocks, update.elapsedUs / 1000.0, update.rounds,
+                update.blocksSent, update.blocksSent - update.blocks);
+        printf ("update status reads: %lu (failed %lu, %lu retries)\n",
+                update.reads.transactions, update.reads.failed, update.reads.retries);
+        printf ("updated slaves:      %lu verified, %lu activated\n", update.verified, update.activated);
+    }
+    if (settings.powerCut)
+    {
+        printf ("power cut:           %lu/%lu slaves restored the option values of the last of %d changes (%d slaves)\n",
+                powerCut.restored, powerCut.changed, POWER_CUT_CHANGES, settings.slaves);
+        printf ("option reads:        %lu (failed %lu, %lu retries)\n",
+                powerCut.reads.transactions, powerCut.reads.failed, powerCut.reads.retries);
+    }
+    printf ("poll cycle (ms):     min %.3f avg %.3f max %.3f\n",
+            minUs / 1000.0, totalUs / settings.cycles / 1000.0, maxUs / 1000.0);
+    printf ("transactions:        %lu (succeeded %lu, failed %lu)\n", bus.transactions, bus.succeeded, bus.failed);
+    printf ("retries:             %lu (%.2f%% of transactions)\n", bus.retries,
+            bus.transactions ? 100.0 * bus.retries / bus.transactions : 0.0);
+    printf ("timeouts:            %lu\n", bus.timeouts);
+    printf ("invalid responses:   %lu\n", bus.invalid);
+    printf ("collisions:          %lu\n", bus.collisions);
+    printf ("noise:               %lu corrupted, %lu dropped characters\n", noise.corrupted, noise.dropped);
+    printf ("goodput (bytes/s):   %.1f\n", totalUs > 0 ? bus.goodputBytes * 1e6 / totalUs : 0.0);
+    printf ("bus utilization:     %.2f%%\n", totalUs > 0 ? 100.0 * bus.busyUs / totalUs : 0.0);
+    bool updated = settings.updateSize == 0 || update.activated == (unsigned long) settings.slaves;
+    bool restored = !settings.powerCut || powerCut.restored == powerCut.changed;
+    return bus.failed == 0 && updated && restored ? EXIT_SUCCESS : 2;
+}
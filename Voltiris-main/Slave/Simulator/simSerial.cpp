@@ -0,0 +1,125 @@
+#include "simSerial.hpp"
+
+#include <errno.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Serial functions of the simulated slaves. The Master writes each request at
+// once and waits for the idle notification of every slave before reading the
+// responses: nothing is received during a timed wait, so serialWait () jumps
+// to its end in virtual time instead of sleeping.
+
+namespace voltiris
+{
+    static SimulatorSerialPort serial;
+
+    static uint32 virtualTimeUs = 0;
+
+    void serialUseDescriptors (int fd, int controlFd)
+    {
+        serial.fd = fd;
+        serial.controlFd = controlFd;
+    }
+
+    uint32 serialClock ()
+    {
+        return virtualTimeUs;
+    }
+
+    SerialPort* serialInit ()
+    {
+        if (serial.fd < 0 || serial.controlFd < 0)
+            return NULL;
+        return (SerialPort*) &serial;
+    }
+
+    int serialRead (SerialPort* sp)
+    {
+        assert (sp != NULL);
+        uint8 c;
+        if (recv (((SimulatorSerialPort*) sp)->fd, &c, 1, MSG_DONTWAIT) != 1)
+            return SERIAL_NO_CHARACTER_AVAILABLE;
+        return c;
+    }
+
+    int serialReadBlock (SerialPort* sp, uint8* buffer, uint16 bufferCapacity, bool& silence)
+    {
+        assert (sp != NULL);
+        silence = false; // Frames end with the timed waits of the framework
+        ssize_t count = recv (((SimulatorSerialPort*) sp)->fd, buffer, bufferCapacity, MSG_DONTWAIT);
+        return count > 0 ? (int) count : 0;
+    }
+
+    int serialAvailable (SerialPort* sp)
+    {
+        assert (sp != NULL);
+        int count = 0;
+        if (ioctl (((SimulatorSerialPort*) sp)->fd, FIONREAD, &count) != 0)
+            return 0;
+        return count;
+    }
+
+    int serialWrite (SerialPort* sp, uint8* buffer, uint16 bufferSizeinBtes)
+    {
+        assert (sp != NULL);
+        uint16 written = 0;
+        while (written < bufferSizeinBtes)
+        {
+            ssize_t count = send (((SimulatorSerialPort*) sp)->fd, buffer + written,
+                                  bufferSizeinBtes - written, MSG_NOSIGNAL);
+            if (count > 0)
+                written += (uint16) count;
+            else if (count < 0 && errno == EINTR)
+                continue;
+            else
+                break; // Master is gone
+        }
+        return (int) written;
+    }
+
+    int serialWriteNonBlocking (SerialPort* sp, const uint8* buffer, uint16 bufferSizeinBtes)
+    {
+        assert (sp != NULL);
+        ssize_t count = send (((SimulatorSerialPort*) sp)->fd, buffer, bufferSizeinBtes,
+                              MSG_DONTWAIT | MSG_NOSIGNAL);
+        return count > 0 ? (int) count : 0;
+    }
+
+    int serialWait (SerialPort* sp, long timeoutUs)
+    {
+        assert (sp != NULL);
+        SimulatorSerialPort* port = (SimulatorSerialPort*) sp;
+        int available = serialAvailable (sp);
+        if (available > 0)
+            return available;
+
+        if (timeoutUs >= 0)
+        {
+            virtualTimeUs += (uint32) timeoutUs;
+            return 0;
+        }
+
+        // Nothing pending (frame, option record): the request is processed
+        // and its response written. Sleep until the next request
+        uint8 idle = 0;
+        if (send (port->controlFd, &idle, 1, MSG_NOSIGNAL) != 1)
+            return -1;
+
+        struct pollfd pfd = {port->fd, POLLIN, 0};
+        while (poll (&pfd, 1, -1) < 0)
+        {
+            if (errno != EINTR)
+                return -1;
+        }
+
+        // The line was silent at least until the request (start of a RTU frame)
+        virtualTimeUs += RTU_SILENCE_US;
+
+        available = serialAvailable (sp);
+        if (available == 0 && (pfd.revents & (POLLHUP | POLLERR)) != 0)
+            return -1;
+        return available;
+    }
+}
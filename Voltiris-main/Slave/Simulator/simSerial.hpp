@@ -0,0 +1,23 @@
+#pragma once
+
+#include "vltSerial.hpp"
+
+namespace voltiris
+{
+    // Serial port of a simulated slave: one end of a socketpair connected to the
+    // Master (the simulator process), and a control socket on which the slave
+    // tells the Master that every received character has been processed
+    struct SimulatorSerialPort: SerialPort
+    {
+        int fd = -1;
+        int controlFd = -1;
+    };
+
+    // Use these descriptors for the next serialInit () call
+    void serialUseDescriptors (int fd, int controlFd);
+
+    // Virtual time of the slave in microseconds (hostConfiguration.clock).
+    // Only serialWait () advances it: the processing of a request takes no time,
+    // the silences and timeouts of the framework do not depend on the scheduling
+    uint32 serialClock ();
+}
@@ -0,0 +1,83 @@
+# Static RAM and flash used by each module of a build, from the sizes of its objects.
+# cmake -DSIZE=size -DOBJECTS="a.o;b.o" [-DIMAGE=firmware.elf] -DPROFILE=default -DOUTPUT=report.txt -P memoryReport.cmake
+#
+# Flash: code and initialized data (text + data), static RAM: data + bss.
+# Objects are measured before linking (unused sections included), the linked
+# image (IMAGE) is added as the last line. Stack and heap are not included.
+
+# Pad text with spaces to width characters (aligned to the right if right is set)
+function (pad text width right result)
+    set (blank "                                        ")
+    string (LENGTH "${text}" length)
+    set (spaces "")
+    if (length LESS width)
+        math (EXPR count "${width} - ${length}")
+        string (SUBSTRING "${blank}" 0 ${count} spaces)
+    endif ()
+    if (right)
+        set (${result} "${spaces}${text}" PARENT_SCOPE)
+    else ()
+        set (${result} "${text}${spaces}" PARENT_SCOPE)
+    endif ()
+endfunction ()
+
+function (reportLine module flash ram result)
+    pad ("${module}" 30 FALSE module)
+    pad ("${flash}" 9 TRUE flash)
+    pad ("${ram}" 13 TRUE ram)
+    set (${result} "${module}${flash}${ram}\n" PARENT_SCOPE)
+endfunction ()
+
+# Sizes of files (Berkeley format: text data bss dec hex filename)
+function (readSizes files result)
+    execute_process (COMMAND ${SIZE} ${files}
+        OUTPUT_VARIABLE sizes
+        RESULT_VARIABLE status)
+    if (NOT status EQUAL 0)
+        message (FATAL_ERROR "${SIZE} failed")
+    endif ()
+    string (REPLACE "\n" ";" sizes "${sizes}")
+    set (${result} "${sizes}" PARENT_SCOPE)
+endfunction ()
+
+set (sizeLine "^[ \t]*([0-9]+)[ \t]+([0-9]+)[ \t]+([0-9]+)[ \t]+[0-9]+[ \t]+[0-9a-fA-F]+[ \t]+(.+)$")
+
+set (report "Memory profile: ${PROFILE}\n")
+reportLine ("module" "flash" "static RAM" line)
+string (APPEND report "${line}")
+set (totalFlash 0)
+set (totalRam 0)
+
+readSizes ("${OBJECTS}" lines)
+foreach (line IN LISTS lines)
+    if (NOT line MATCHES "${sizeLine}")
+        continue ()
+    endif ()
+    math (EXPR flash "${CMAKE_MATCH_1} + ${CMAKE_MATCH_2}")
+    math (EXPR ram "${CMAKE_MATCH_2} + ${CMAKE_MATCH_3}")
+    get_filename_component (module "${CMAKE_MATCH_4}" NAME)
+    string (REGEX REPLACE "\\.(c|cpp|ino|S)\\.(o|obj)$" "" module "${module}")
+
+    math (EXPR totalFlash "${totalFlash} + ${flash}")
+    math (EXPR totalRam "${totalRam} + ${ram}")
+    reportLine ("${module}" ${flash} ${ram} line)
+    string (APPEND report "${line}")
+endforeach ()
+
+reportLine ("total" ${totalFlash} ${totalRam} line)
+string (APPEND report "${line}")
+
+if (IMAGE)
+    readSizes ("${IMAGE}" lines)
+    foreach (line IN LISTS lines)
+        if (line MATCHES "${sizeLine}")
+            math (EXPR flash "${CMAKE_MATCH_1} + ${CMAKE_MATCH_2}")
+            math (EXPR ram "${CMAKE_MATCH_2} + ${CMAKE_MATCH_3}")
+            reportLine ("linked image" ${flash} ${ram} line)
+            string (APPEND report "${line}")
+        endif ()
+    endforeach ()
+endif ()
+
+file (WRITE ${OUTPUT} "${report}")
+message ("${report}")